@@ -0,0 +1,205 @@
+#ifndef ASSET_ARCHIVE_H
+#define ASSET_ARCHIVE_H
+
+// Dùng chung giữa game (main.cpp) và tools/pack_assets.cpp: danh sách tài nguyên init() cần,
+// định dạng file archive và các hàm thu nhỏ ảnh để packer tạo đúng dữ liệu game sẽ dùng.
+
+#include <SDL.h>
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstring>
+#include <string>
+
+const int SCREEN_WIDTH = 1600;
+const int SCREEN_HEIGHT = 900;
+const int PLAYER_SIZE = 168;
+const int PROJECTILE_SIZE = 100;
+
+// Định dạng thiết bị âm thanh; packer chuyển sẵn WAV về đúng định dạng này.
+const int AUDIO_FREQUENCY = 22050;
+const Uint16 AUDIO_SAMPLE_FORMAT = AUDIO_S16SYS;
+const int AUDIO_CHANNELS = 1;
+
+enum TextureQuality { QUALITY_LOW, QUALITY_MEDIUM, QUALITY_HIGH };
+
+inline float qualityScale(TextureQuality quality) {
+    switch (quality) {
+    case QUALITY_LOW: return 0.5f;
+    case QUALITY_MEDIUM: return 1.0f;
+    case QUALITY_HIGH: return 2.0f;
+    }
+    return 1.0f;
+}
+
+inline bool parseTextureQuality(const char* name, TextureQuality& quality) {
+    if (std::strcmp(name, "low") == 0) quality = QUALITY_LOW;
+    else if (std::strcmp(name, "medium") == 0) quality = QUALITY_MEDIUM;
+    else if (std::strcmp(name, "high") == 0) quality = QUALITY_HIGH;
+    else return false;
+    return true;
+}
+
+// Kích thước sau khi thu nhỏ: không bao giờ phóng to ảnh gốc.
+inline int scaledSize(int source, int displaySize, TextureQuality quality) {
+    int target = static_cast<int>(std::ceil(displaySize * qualityScale(quality)));
+    return std::max(1, std::min(source, target));
+}
+
+// Thu nhỏ region của surface ARGB8888 bằng box filter trên màu premultiplied,
+// tránh viền tối quanh vùng trong suốt.
+inline SDL_Surface* resampleSurface(SDL_Surface* source, const SDL_Rect& region, int dstW, int dstH) {
+    SDL_Surface* result = SDL_CreateRGBSurfaceWithFormat(0, dstW, dstH, 32, SDL_PIXELFORMAT_ARGB8888);
+    if (!result) return nullptr;
+    for (int y = 0; y < dstH; y++) {
+        int sy0 = region.y + y * region.h / dstH;
+        int sy1 = std::max(sy0 + 1, region.y + (y + 1) * region.h / dstH);
+        Uint32* dstRow = reinterpret_cast<Uint32*>(static_cast<Uint8*>(result->pixels) + y * result->pitch);
+        for (int x = 0; x < dstW; x++) {
+            int sx0 = region.x + x * region.w / dstW;
+            int sx1 = std::max(sx0 + 1, region.x + (x + 1) * region.w / dstW);
+            Uint32 a = 0, r = 0, g = 0, b = 0;
+            for (int sy = sy0; sy < sy1; sy++) {
+                const Uint32* srcRow = reinterpret_cast<const Uint32*>(static_cast<const Uint8*>(source->pixels) + sy * source->pitch);
+                for (int sx = sx0; sx < sx1; sx++) {
+                    Uint32 p = srcRow[sx];
+                    Uint32 pa = p >> 24;
+                    a += pa;
+                    r += ((p >> 16) & 0xFF) * pa;
+                    g += ((p >> 8) & 0xFF) * pa;
+                    b += (p & 0xFF) * pa;
+                }
+            }
+            Uint32 count = static_cast<Uint32>((sy1 - sy0) * (sx1 - sx0));
+            Uint32 outA = a / count;
+            Uint32 outR = a ? r / a : 0, outG = a ? g / a : 0, outB = a ? b / a : 0;
+            dstRow[x] = (outA << 24) | (outR << 16) | (outG << 8) | outB;
+        }
+    }
+    return result;
+}
+
+// Loại tài nguyên. ASSET_FRAME trong manifest là một dãy file đánh số path1.png..pathN.png.
+enum AssetKind { ASSET_SHEET, ASSET_FRAME, ASSET_TEXTURE, ASSET_SOUND, ASSET_MUSIC, ASSET_FONT };
+
+enum ManifestId {
+    MANIFEST_PLAYER_IDLE,
+    MANIFEST_PLAYER_WALK,
+    MANIFEST_PLAYER_ATTACK,
+    MANIFEST_PLAYER_HURT,
+    MANIFEST_PLAYER_DEAD,
+    MANIFEST_BASIC_WALKING,
+    MANIFEST_BASIC_SLASHING,
+    MANIFEST_BASIC_DYING,
+    MANIFEST_FAST_WALKING,
+    MANIFEST_FAST_SLASHING,
+    MANIFEST_FAST_DYING,
+    MANIFEST_CHASER_WALKING,
+    MANIFEST_CHASER_SLASHING,
+    MANIFEST_CHASER_DYING,
+    MANIFEST_MAP1,
+    MANIFEST_MAP2,
+    MANIFEST_MAP3,
+    MANIFEST_MAP4,
+    MANIFEST_MENU_BACKGROUND,
+    MANIFEST_PROJECTILE,
+    MANIFEST_SOUND_SHOOT,
+    MANIFEST_SOUND_HURT,
+    MANIFEST_SOUND_DEATH,
+    MANIFEST_SOUND_ENEMY_ATTACK,
+    MANIFEST_SOUND_ENEMY_DEATH,
+    MANIFEST_SOUND_SPAWN,
+    MANIFEST_SOUND_LEVEL_UP,
+    MANIFEST_SOUND_UPGRADE,
+    MANIFEST_SOUND_CLICK,
+    MANIFEST_MUSIC,
+    MANIFEST_FONT,
+    MANIFEST_COUNT
+};
+
+struct ManifestEntry {
+    AssetKind kind;
+    const char* path;
+    int frameCount;
+    int displayW, displayH;
+};
+
+const ManifestEntry ASSET_MANIFEST[MANIFEST_COUNT] = {
+    { ASSET_SHEET, "assets/player/idle.png", 6, PLAYER_SIZE, PLAYER_SIZE },
+    { ASSET_SHEET, "assets/player/walk.png", 7, PLAYER_SIZE, PLAYER_SIZE },
+    { ASSET_SHEET, "assets/player/attack.png", 7, PLAYER_SIZE, PLAYER_SIZE },
+    { ASSET_SHEET, "assets/player/hurt.png", 4, PLAYER_SIZE, PLAYER_SIZE },
+    { ASSET_SHEET, "assets/player/dead.png", 4, PLAYER_SIZE, PLAYER_SIZE },
+    { ASSET_FRAME, "assets/enemy_basic/Walking/enemy_basic_walking_", 24, PLAYER_SIZE, PLAYER_SIZE },
+    { ASSET_FRAME, "assets/enemy_basic/Slashing/enemy_basic_slashing_", 12, PLAYER_SIZE, PLAYER_SIZE },
+    { ASSET_FRAME, "assets/enemy_basic/Dying/enemy_basic_dying_", 15, PLAYER_SIZE, PLAYER_SIZE },
+    { ASSET_FRAME, "assets/enemy_fast/Walking/enemy_fast_walking_", 24, PLAYER_SIZE, PLAYER_SIZE },
+    { ASSET_FRAME, "assets/enemy_fast/Slashing/enemy_fast_slashing_", 12, PLAYER_SIZE, PLAYER_SIZE },
+    { ASSET_FRAME, "assets/enemy_fast/Dying/enemy_fast_dying_", 15, PLAYER_SIZE, PLAYER_SIZE },
+    { ASSET_FRAME, "assets/enemy_chaser/Walking/enemy_chaser_walking_", 24, PLAYER_SIZE, PLAYER_SIZE },
+    { ASSET_FRAME, "assets/enemy_chaser/Slashing/enemy_chaser_slashing_", 12, PLAYER_SIZE, PLAYER_SIZE },
+    { ASSET_FRAME, "assets/enemy_chaser/Dying/enemy_chaser_dying_", 15, PLAYER_SIZE, PLAYER_SIZE },
+    { ASSET_TEXTURE, "assets/map1.png", 1, SCREEN_WIDTH, SCREEN_HEIGHT },
+    { ASSET_TEXTURE, "assets/map2.png", 1, SCREEN_WIDTH, SCREEN_HEIGHT },
+    { ASSET_TEXTURE, "assets/map3.png", 1, SCREEN_WIDTH, SCREEN_HEIGHT },
+    { ASSET_TEXTURE, "assets/map4.png", 1, SCREEN_WIDTH, SCREEN_HEIGHT },
+    { ASSET_TEXTURE, "assets/menu_background.png", 1, SCREEN_WIDTH, SCREEN_HEIGHT },
+    { ASSET_TEXTURE, "assets/projectile.png", 1, PROJECTILE_SIZE, PROJECTILE_SIZE },
+    { ASSET_SOUND, "assets/audio/shoot.wav", 1, 0, 0 },
+    { ASSET_SOUND, "assets/audio/hurt.wav", 1, 0, 0 },
+    { ASSET_SOUND, "assets/audio/death.wav", 1, 0, 0 },
+    { ASSET_SOUND, "assets/audio/enemy_attack.wav", 1, 0, 0 },
+    { ASSET_SOUND, "assets/audio/enemy_death.wav", 1, 0, 0 },
+    { ASSET_SOUND, "assets/audio/spawn.wav", 1, 0, 0 },
+    { ASSET_SOUND, "assets/audio/level_up.wav", 1, 0, 0 },
+    { ASSET_SOUND, "assets/audio/upgrade.wav", 1, 0, 0 },
+    { ASSET_SOUND, "assets/audio/click.wav", 1, 0, 0 },
+    { ASSET_MUSIC, "assets/audio/game_music.mp3", 1, 0, 0 },
+    { ASSET_FONT, "assets/arial.ttf", 1, 0, 0 },
+};
+
+// Đường dẫn file thứ index (từ 0) của một entry trong manifest.
+inline std::string manifestFilePath(const ManifestEntry& entry, int index) {
+    if (entry.kind != ASSET_FRAME) return entry.path;
+    return entry.path + std::to_string(index + 1) + ".png";
+}
+
+// Khóa tra cứu trong archive: chữ thường, dấu '/', để không phụ thuộc hoa/thường của hệ thống file.
+inline std::string normalizeAssetPath(const std::string& path) {
+    std::string key = path;
+    for (char& c : key) {
+        if (c == '\\') c = '/';
+        else c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+    }
+    return key;
+}
+
+// File archive (little-endian): ArchiveHeader, entryCount ArchiveEntry, rồi các blob căn lề ARCHIVE_ALIGNMENT.
+// Ảnh lưu sẵn dạng ARGB8888 đã thu nhỏ theo quality, âm thanh lưu PCM đúng định dạng thiết bị,
+// font và nhạc lưu nguyên file.
+const Uint32 ARCHIVE_MAGIC = 0x4B505144; // "DQPK"
+const Uint32 ARCHIVE_VERSION = 1;
+const int ARCHIVE_PATH_SIZE = 112;
+const Uint64 ARCHIVE_ALIGNMENT = 64;
+
+enum ArchiveEntryType : Uint32 { ARCHIVE_PIXELS, ARCHIVE_PCM, ARCHIVE_RAW };
+
+struct ArchiveHeader {
+    Uint32 magic;
+    Uint32 version;
+    Uint32 entryCount;
+    Uint32 quality;
+};
+
+struct ArchiveEntry {
+    char path[ARCHIVE_PATH_SIZE];
+    Uint32 type;
+    Uint32 width, height, pitch;
+    Uint32 audioFrequency;
+    Uint16 audioFormat;
+    Uint16 audioChannels;
+    Uint64 offset;
+    Uint64 size;
+};
+
+#endif
@@ -10,12 +10,41 @@
 #include <iostream>
 #include <algorithm>
 #include <cfloat>
+#include <cstring>
+#include <unordered_map>
+#include <fstream>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <memory>
+#include <new>
+#include <cstdarg>
+#include <cstddef>
+#include "AssetArchive.h"
+#ifdef _WIN32
 #include <direct.h>
+#include <malloc.h>
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define STEERING_SIMD 1
+#include <immintrin.h>
+#endif
+#if defined(__GNUC__) || defined(__clang__)
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define TARGET_AVX2
+#endif
 
-const int SCREEN_WIDTH = 1600;
-const int SCREEN_HEIGHT = 900;
-const int PLAYER_SIZE = 168;
-const int PROJECTILE_SIZE = 100;
 const float PLAYER_SPEED = 300.0f;
 const float ENEMY_SPEED = 150.0f;
 const float PROJECTILE_SPEED = 1200.0f;
@@ -25,6 +54,9 @@ const float COMBO_TIMEOUT = 3.0f;
 const float LEVEL_DURATION = 30.0f;
 const float SPAWN_RATE_BASE = 40.0f;
 const float SPAWN_RATE_DECREASE = 15.0f;
+const float SPAWN_RATE_MIN = 10.0f;
+const float SPAWN_REFERENCE_FPS = 60.0f;
+const int MAX_CONCURRENT_ENEMIES = 120;
 const float ENEMY_SPEED_INCREASE = 30.0f;
 const int NUM_MAPS = 4;
 const float MIN_SPAWN_DISTANCE = 150.0f;
@@ -33,17 +65,95 @@ const float SLASHING_DISTANCE = 80.0f;
 const int MAX_HEALTH = 100;
 const float ENEMY_ATTACK_COOLDOWN = 1.5f;
 const float PRE_LEVEL_UP_DELAY = 3.0f;
+// Texture của trang atlas được tạo đủ kích thước ngay khi mở trang nên giữ trang vừa phải.
+const int ATLAS_PAGE_SIZE = 2048;
+const int ATLAS_PADDING = 2;
+// Số hàng pixel tối đa upload một lần (2048 x 128 x 4 byte = 1 MB).
+const int ATLAS_UPLOAD_ROWS = 128;
+// Thời gian tối đa mỗi frame luồng chính dành để tạo texture/upload khi đang nạp tài nguyên.
+const double ASSET_UPLOAD_BUDGET = 0.004;
+const int MAX_ASSET_THREADS = 4;
+const char* const DEFAULT_ARCHIVE_PATH = "assets.pak";
+const float ENEMY_HITBOX_SIZE = PLAYER_SIZE * 0.5f;
+const float ENEMY_HITBOX_OFFSET = (PLAYER_SIZE - ENEMY_HITBOX_SIZE) / 2.0f;
+const int GRID_CELL_SIZE = PLAYER_SIZE / 2;
+const int DEFAULT_TICK_RATE = 120;
+const double MAX_FRAME_TIME = 0.25;
+const int MAX_TICKS_PER_FRAME = 8;
+const size_t MAX_ENEMIES = 65536;
+const size_t MAX_PROJECTILES = 1024;
+const size_t MAX_MARKERS = 1024;
+// Dung lượng ring buffer của mỗi emitter, phải là lũy thừa của 2.
+const size_t MAX_PARTICLES = 131072;
+const Uint32 REPLAY_MAGIC = 0x50524451; // "QDRP" trên đĩa (little-endian); giữ nguyên để replay cũ vẫn mở được
+const Uint32 REPLAY_VERSION = 3;
+const Uint64 CHECKSUM_INTERVAL = 120;
+const Uint32 TELEMETRY_MAGIC = 0x4D4C5444; // "DTLM"
+const Uint32 TELEMETRY_VERSION = 1;
+// Số frame file telemetry giữ lại (khoảng 18 phút ở 60 FPS), frame cũ hơn bị ghi đè.
+const Uint32 TELEMETRY_RING_FRAMES = 65536;
+// Hàng đợi giữa luồng chính và luồng ghi telemetry, phải là lũy thừa của 2.
+const Uint32 TELEMETRY_QUEUE_SIZE = 1024;
+// Level từ TELEMETRY_MAX_LEVEL trở lên được gộp chung một dòng thống kê.
+const int TELEMETRY_MAX_LEVEL = 32;
+// Histogram thời gian frame: ô rộng TELEMETRY_BIN_MS, ô cuối gom mọi frame dài hơn.
+const int TELEMETRY_BINS = 1000;
+const double TELEMETRY_BIN_MS = 0.1;
+const char* const TELEMETRY_RING_FILE = "telemetry.bin";
+const char* const TELEMETRY_SUMMARY_FILE = "telemetry_summary.json";
+const int MAX_THREADS = 64;
+// Kích thước chunk khi chia việc; ENEMY_GRAIN là bội của 8 để nhóm lane SIMD trùng với khi chạy một luồng.
+const size_t ENEMY_GRAIN = 2048;
+const size_t PROJECTILE_GRAIN = 256;
+const size_t PARTICLE_GRAIN = 4096;
+const Uint64 DEFAULT_HEADLESS_TICKS = 3600ull * DEFAULT_TICK_RATE;
+const int DEFAULT_BENCH_SAMPLES = 31;
+const char* const DEFAULT_BENCH_PATH = "bench.json";
+const char* const DEFAULT_RENDER_BENCH_PATH = "render_bench.json";
+const int DEFAULT_RENDER_BENCH_FRAMES = 60;
+const size_t FRAME_ARENA_SIZE = 64 * 1024;
+// Số particle mỗi emitter được đặt trước chỗ trong snapshot và bộ đệm đỉnh.
+const size_t FRAME_PARTICLE_RESERVE = 4096;
+// Số frame PLAYING đầu tiên được phép cấp phát (bộ đệm lớn dần tới kích thước ổn định).
+const int ALLOCATION_WARMUP_FRAMES = 120;
+const int DEFAULT_ALLOC_CHECK_FRAMES = 7200;
+const int GRID_COLS = (SCREEN_WIDTH + GRID_CELL_SIZE - 1) / GRID_CELL_SIZE;
+const int GRID_ROWS = (SCREEN_HEIGHT + GRID_CELL_SIZE - 1) / GRID_CELL_SIZE;
 
 enum GameState { MENU, SETTINGS, PLAYING, PAUSED, LEVEL_UP, UPGRADE_MENU, GAME_OVER, PRE_LEVEL_UP };
 enum EnemyType { BASIC, FAST, CHASER };
 enum WeaponType { SINGLE, SHOTGUN };
 enum PlayerState { IDLE, WALK, ATTACK, HURT, DEAD };
 enum EnemyState { WALKING, SLASHING, DYING };
+const int ENEMY_STATE_COUNT = 3;
+const int ENEMY_CLIP_COUNT = 3 * ENEMY_STATE_COUNT;
+// Hệ số tốc độ theo EnemyType (BASIC, FAST, CHASER).
+const float ENEMY_SPEED_SCALE[3] = { 1.0f, 1.5f, 0.8f };
+
+enum SteeringKernelType { STEER_SCALAR, STEER_SSE2, STEER_AVX2 };
+const char* const STEERING_KERNEL_NAMES[] = { "scalar", "sse2", "avx2" };
+
+enum ParticleEmitter { EMIT_ENEMY_DEATH, NUM_PARTICLE_EMITTERS };
+
+// Tham số emitter: số hạt mỗi lần phát, tốc độ tối đa mỗi trục (pixel/giây), thời gian sống, màu.
+struct ParticleEmitterDef {
+    int count;
+    float speed;
+    float lifetime;
+    SDL_Color color;
+    float size;
+};
+
+const ParticleEmitterDef PARTICLE_EMITTERS[NUM_PARTICLE_EMITTERS] = {
+    { 5, 100.0f, 0.3f, { 255, 0, 0, 255 }, 4.0f },
+};
 
 SDL_Texture* projectileTexture = nullptr;
 SDL_Texture* maps[NUM_MAPS] = { nullptr };
 SDL_Texture* menuBackground = nullptr;
 int currentMap = 0;
+// Map của màn (hoặc ván) tiếp theo, được chọn trước để MapStreamer kịp nạp nền; -1 nếu chưa chọn.
+int nextMap = -1;
 
 Mix_Music* gameMusic = nullptr;
 Mix_Chunk* shootSound = nullptr;
@@ -56,15 +166,22 @@ Mix_Chunk* levelUpSound = nullptr;
 Mix_Chunk* upgradeSound = nullptr;
 Mix_Chunk* clickSound = nullptr;
 
+// textures[i]/frames[i]: trang atlas và vùng chứa frame i trong trang đó.
+// trims[i]: vị trí phần ảnh đã cắt viền trong khung gốc frameWidth x frameHeight.
 struct Animation {
     std::vector<SDL_Texture*> textures;
     std::vector<SDL_Rect> frames;
+    std::vector<SDL_Rect> trims;
     float frameTime;
     size_t currentFrame;
     float elapsedTime;
     SDL_RendererFlip flip;
     int frameWidth;
     int frameHeight;
+    // Chỉ luồng chính đọc/ghi: clip chưa nạp xong được vẽ bằng placeholder.
+    int pendingTasks;
+    int pendingFrames;
+    bool loaded;
 };
 
 struct PlayerAnimations {
@@ -86,14 +203,320 @@ EnemyAnimations enemyFastAnim;
 EnemyAnimations enemyChaserAnim;
 PlayerAnimations playerAnim;
 
+// Clip id của enemy = type * ENEMY_STATE_COUNT + state. Các Animation của enemy chỉ
+// là mô tả clip (frame, frameTime), mỗi enemy tự giữ clip và thời điểm bắt đầu.
+Animation* const enemyClips[ENEMY_CLIP_COUNT] = {
+    &enemyBasicAnim.walking, &enemyBasicAnim.slashing, &enemyBasicAnim.dying,
+    &enemyFastAnim.walking, &enemyFastAnim.slashing, &enemyFastAnim.dying,
+    &enemyChaserAnim.walking, &enemyChaserAnim.slashing, &enemyChaserAnim.dying,
+};
+
+// Clip animation: tài nguyên trong ASSET_MANIFEST và thời gian mỗi frame.
+struct AnimationSpec {
+    Animation* anim;
+    ManifestId asset;
+    float frameTime;
+};
+
+const AnimationSpec animationSpecs[] = {
+    { &playerAnim.idle, MANIFEST_PLAYER_IDLE, 0.1f },
+    { &playerAnim.walk, MANIFEST_PLAYER_WALK, 0.07f },
+    { &playerAnim.attack, MANIFEST_PLAYER_ATTACK, 0.03f },
+    { &playerAnim.hurt, MANIFEST_PLAYER_HURT, 0.05f },
+    { &playerAnim.dead, MANIFEST_PLAYER_DEAD, 0.07f },
+    { &enemyBasicAnim.walking, MANIFEST_BASIC_WALKING, 0.05f },
+    { &enemyBasicAnim.slashing, MANIFEST_BASIC_SLASHING, 0.0833f },
+    { &enemyBasicAnim.dying, MANIFEST_BASIC_DYING, 0.05f },
+    { &enemyFastAnim.walking, MANIFEST_FAST_WALKING, 0.05f },
+    { &enemyFastAnim.slashing, MANIFEST_FAST_SLASHING, 0.0417f },
+    { &enemyFastAnim.dying, MANIFEST_FAST_DYING, 0.05f },
+    { &enemyChaserAnim.walking, MANIFEST_CHASER_WALKING, 0.05f },
+    { &enemyChaserAnim.slashing, MANIFEST_CHASER_SLASHING, 0.0667f },
+    { &enemyChaserAnim.dying, MANIFEST_CHASER_DYING, 0.05f },
+};
+
+struct AtlasEntry {
+    SDL_Surface* surface;
+    Animation* anim;
+    size_t frame;
+    SDL_Rect trim;
+};
+
+// Trang atlas đang dựng: frame được xếp theo kiểu shelf vào surface ngay khi nhận, texture tạo sẵn cả
+// trang và được upload dần từng dải hàng đã xếp xong. Chỉ một trang mở (closed == false) tại một thời điểm.
+struct PendingAtlasPage {
+    SDL_Surface* surface;
+    SDL_Texture* texture;
+    int shelfX, shelfY, shelfH;
+    int uploadedHeight;
+    bool closed;
+    std::vector<AtlasEntry> entries;
+};
+
+std::vector<AtlasEntry> atlasEntries;
+std::vector<PendingAtlasPage> pendingAtlasPages;
+std::vector<SDL_Texture*> atlasPages;
+
+// Ảnh gốc được thu nhỏ về kích thước hiển thị lớn nhất nhân với hệ số của mức chất lượng.
+TextureQuality textureQuality = QUALITY_MEDIUM;
+size_t textureMemoryBytes = 0;
+std::atomic<size_t> sourceImageBytes(0);
+
+// Đếm mọi lần cấp phát heap của game (operator new) và của SDL (SDL_SetMemoryFunctions);
+// hiệu hai lần đọc là số cấp phát của một frame. Luồng nạp tài nguyên tắt trackAllocations vì
+// việc của chúng không thuộc về frame nào.
+std::atomic<Uint64> heapAllocations(0);
+thread_local bool trackAllocations = true;
+Uint64 frameAllocations = 0;
+
+inline void countAllocation() {
+    if (trackAllocations) heapAllocations.fetch_add(1, std::memory_order_relaxed);
+}
+
+void* operator new(std::size_t size) {
+    countAllocation();
+    if (void* memory = std::malloc(size ? size : 1)) return memory;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* memory) noexcept {
+    std::free(memory);
+}
+
+void operator delete(void* memory, std::size_t) noexcept {
+    std::free(memory);
+}
+
+// Kiểu có alignas lớn hơn mặc định đi qua các dạng align_val_t, cũng phải được đếm.
+void* operator new(std::size_t size, std::align_val_t alignment) {
+    countAllocation();
+    std::size_t align = std::max(static_cast<std::size_t>(alignment), sizeof(void*));
+#ifdef _WIN32
+    if (void* memory = _aligned_malloc(size ? size : 1, align)) return memory;
+#else
+    void* memory = nullptr;
+    if (posix_memalign(&memory, align, size ? size : 1) == 0) return memory;
+#endif
+    throw std::bad_alloc();
+}
+
+void operator delete(void* memory, std::align_val_t) noexcept {
+#ifdef _WIN32
+    _aligned_free(memory);
+#else
+    std::free(memory);
+#endif
+}
+
+void operator delete(void* memory, std::size_t, std::align_val_t alignment) noexcept {
+    operator delete(memory, alignment);
+}
+
+SDL_malloc_func sdlMalloc = nullptr;
+SDL_calloc_func sdlCalloc = nullptr;
+SDL_realloc_func sdlRealloc = nullptr;
+SDL_free_func sdlFree = nullptr;
+
+void* SDLCALL countingMalloc(size_t size) {
+    countAllocation();
+    return sdlMalloc(size);
+}
+
+void* SDLCALL countingCalloc(size_t count, size_t size) {
+    countAllocation();
+    return sdlCalloc(count, size);
+}
+
+void* SDLCALL countingRealloc(void* memory, size_t size) {
+    countAllocation();
+    return sdlRealloc(memory, size);
+}
+
+// Phải gọi trước mọi hàm SDL khác để bộ nhớ SDL cấp phát và giải phóng qua cùng một cặp hàm.
+void installAllocationHooks() {
+    SDL_GetMemoryFunctions(&sdlMalloc, &sdlCalloc, &sdlRealloc, &sdlFree);
+    if (!sdlMalloc || !sdlCalloc || !sdlRealloc || !sdlFree) return;
+    if (SDL_SetMemoryFunctions(countingMalloc, countingCalloc, countingRealloc, sdlFree) != 0) {
+        std::cout << "WARNING: Failed to hook SDL memory functions - " << SDL_GetError() << std::endl;
+    }
+}
+
+// Bộ nhớ tạm của một frame (chuỗi HUD...): cấp phát chỉ tăng con trỏ, reset() đầu mỗi frame thu hồi
+// toàn bộ nên con trỏ lấy từ arena chỉ dùng được tới hết frame.
+struct FrameArena {
+    std::unique_ptr<char[]> buffer;
+    size_t capacity = 0;
+    size_t used = 0;
+
+    explicit FrameArena(size_t size) : buffer(new char[size]), capacity(size) {}
+
+    void reset() {
+        used = 0;
+    }
+
+    // nullptr nếu arena đã đầy.
+    void* allocate(size_t size, size_t align = alignof(std::max_align_t)) {
+        size_t start = (used + align - 1) / align * align;
+        if (start + size > capacity) return nullptr;
+        used = start + size;
+        return buffer.get() + start;
+    }
+
+    // Như snprintf nhưng ghi vào arena; chuỗi rỗng nếu không đủ chỗ.
+    const char* format(const char* fmt, ...) {
+        va_list args, copy;
+        va_start(args, fmt);
+        va_copy(copy, args);
+        int length = std::vsnprintf(nullptr, 0, fmt, args);
+        va_end(args);
+        char* out = length < 0 ? nullptr : static_cast<char*>(allocate(static_cast<size_t>(length) + 1, 1));
+        if (out) std::vsnprintf(out, static_cast<size_t>(length) + 1, fmt, copy);
+        va_end(copy);
+        return out ? out : "";
+    }
+};
+
+FrameArena frameArena(FRAME_ARENA_SIZE);
+
 SDL_Window* window = nullptr;
 SDL_Renderer* renderer = nullptr;
 TTF_Font* font = nullptr;
 TTF_Font* titleFont = nullptr; // Font mới cho tiêu đề
 
+// Thống kê lệnh vẽ của một frame. Mọi lệnh vẽ đi qua các hàm render* bên dưới để được đếm; diện tích
+// pixel chỉ tính khi countPixels bật (benchmark render) vì phải duyệt từng tam giác.
+struct RenderStats {
+    int drawCalls = 0;
+    int textureBinds = 0;
+    int colorChanges = 0;
+    double pixelsFilled = 0.0;
+};
+
+RenderStats renderStats;
+RenderStats lastRenderStats;
+bool countPixels = false;
+SDL_Texture* boundTexture = nullptr;
+SDL_Color drawColor = { 0, 0, 0, 0 };
+// Thời gian SDL_RenderPresent của frame vừa vẽ (chờ vsync/driver).
+double presentMs = 0.0;
+
+void beginRenderStats() {
+    lastRenderStats = renderStats;
+    renderStats = RenderStats();
+    boundTexture = nullptr;
+}
+
+void bindTexture(SDL_Texture* texture) {
+    renderStats.drawCalls++;
+    if (texture != boundTexture) {
+        renderStats.textureBinds++;
+        boundTexture = texture;
+    }
+}
+
+// Diện tích phần rect nằm trong màn hình; rect == nullptr nghĩa là cả màn hình.
+double visibleArea(const SDL_Rect* rect) {
+    SDL_Rect screen = { 0, 0, SCREEN_WIDTH, SCREEN_HEIGHT };
+    if (!rect) return static_cast<double>(SCREEN_WIDTH) * SCREEN_HEIGHT;
+    SDL_Rect clipped;
+    if (!SDL_IntersectRect(rect, &screen, &clipped)) return 0.0;
+    return static_cast<double>(clipped.w) * clipped.h;
+}
+
+void setDrawColor(Uint8 r, Uint8 g, Uint8 b, Uint8 a) {
+    if (drawColor.r != r || drawColor.g != g || drawColor.b != b || drawColor.a != a) {
+        renderStats.colorChanges++;
+        drawColor = { r, g, b, a };
+    }
+    SDL_SetRenderDrawColor(renderer, r, g, b, a);
+}
+
+void renderClear() {
+    renderStats.drawCalls++;
+    if (countPixels) renderStats.pixelsFilled += visibleArea(nullptr);
+    SDL_RenderClear(renderer);
+}
+
+void renderCopy(SDL_Texture* texture, const SDL_Rect* src, const SDL_Rect* dst) {
+    bindTexture(texture);
+    if (countPixels) renderStats.pixelsFilled += visibleArea(dst);
+    SDL_RenderCopy(renderer, texture, src, dst);
+}
+
+void renderFillRect(const SDL_Rect* rect) {
+    renderStats.drawCalls++;
+    if (countPixels) renderStats.pixelsFilled += visibleArea(rect);
+    SDL_RenderFillRect(renderer, rect);
+}
+
+void renderFillRects(const SDL_Rect* rects, int count) {
+    renderStats.drawCalls++;
+    if (countPixels) for (int i = 0; i < count; i++) renderStats.pixelsFilled += visibleArea(&rects[i]);
+    SDL_RenderFillRects(renderer, rects, count);
+}
+
+void renderDrawRect(const SDL_Rect* rect) {
+    renderStats.drawCalls++;
+    if (countPixels && rect) renderStats.pixelsFilled += 2.0 * (rect->w + rect->h);
+    SDL_RenderDrawRect(renderer, rect);
+}
+
+void renderDrawLine(int x1, int y1, int x2, int y2) {
+    renderStats.drawCalls++;
+    if (countPixels) renderStats.pixelsFilled += std::max(std::abs(x2 - x1), std::abs(y2 - y1)) + 1;
+    SDL_RenderDrawLine(renderer, x1, y1, x2, y2);
+}
+
+void renderGeometry(SDL_Texture* texture, const SDL_Vertex* vertices, int vertexCount, const int* indices, int indexCount) {
+    bindTexture(texture);
+    if (countPixels) {
+        double area = 0.0;
+        for (int i = 0; i + 2 < indexCount; i += 3) {
+            const SDL_FPoint& a = vertices[indices[i]].position;
+            const SDL_FPoint& b = vertices[indices[i + 1]].position;
+            const SDL_FPoint& c = vertices[indices[i + 2]].position;
+            area += std::fabs((b.x - a.x) * (c.y - a.y) - (c.x - a.x) * (b.y - a.y)) * 0.5;
+        }
+        renderStats.pixelsFilled += area;
+    }
+    SDL_RenderGeometry(renderer, texture, vertices, vertexCount, indices, indexCount);
+}
+
+const int FIRST_GLYPH = 32;
+const int LAST_GLYPH = 126;
+const int GLYPH_ATLAS_WIDTH = 512;
+
+struct Glyph {
+    SDL_Rect src;
+    int advance;
+};
+
+// Toàn bộ ký tự ASCII in được của một font, dựng sẵn một lần vào một texture.
+struct GlyphAtlas {
+    TTF_Font* font = nullptr;
+    SDL_Texture* texture = nullptr;
+    int width = 0, height = 0;
+    Glyph glyphs[LAST_GLYPH - FIRST_GLYPH + 1];
+};
+
+// Các quad của một chuỗi ở toạ độ gốc (0,0), màu trắng; chuỗi tĩnh được lưu lại để dùng mỗi khung hình.
+struct TextLayout {
+    std::vector<SDL_Vertex> vertices;
+    std::vector<int> indices;
+    int width = 0, height = 0;
+};
+
+GlyphAtlas textAtlas;
+GlyphAtlas titleAtlas;
+std::unordered_map<std::string, TextLayout> textCache;
+std::unordered_map<std::string, TextLayout> titleTextCache;
+TextLayout dynamicText;
+std::vector<SDL_Vertex> textVertices;
+
 struct GameObject {
     SDL_FRect rect;
     SDL_FRect hitbox;
+    float prevX, prevY;
     float vx, vy;
     bool active;
     EnemyType type;
@@ -123,713 +546,2663 @@ struct Marker {
     bool isSpawnMarker;
 };
 
-struct Particle {
-    SDL_FPoint pos;
-    float vx, vy;
-    float lifetime;
-};
-
 struct Button {
     SDL_Rect rect;
-    std::string text;
+    const char* text;
     SDL_Color color;
     bool hovered;
 };
 
-std::vector<GameObject> enemies;
-std::vector<GameObject> projectiles;
-std::vector<Marker> markers;
-std::vector<Particle> particles;
-GameState previousState = MENU;
-GameObject player;
-int score = 0;
-int combo = 0;
-float comboTime = 0;
-float qCooldown = 0;
-bool qReady = true;
-float gameTime = 0.0f;
-int level = 1;
-float spawnRate = SPAWN_RATE_BASE;
-int upgradePoints = 0;
-int projectileDamage = 1;
-float playerSpeed = PLAYER_SPEED;
-float qCooldownMax = Q_COOLDOWN;
-WeaponType currentWeapon = SINGLE;
-GameState gameState = MENU;
-float levelUpTimer = 0.0f;
-float preLevelUpTimer = 0.0f;
-float deathTimer = 0.0f;
-float lastDamageTime = 0.0f;
-int musicVolume = 64;
-int sfxVolume = 64;
-bool shotgunUnlocked = false;
-bool draggingMusicSlider = false;
-bool draggingSFXSlider = false;
+const Uint32 INVALID_SLOT = 0xFFFFFFFFu;
 
-void loadAnimation(Animation& anim, const std::string& path, int frameCount, float frameTime, bool isSpriteSheet = false) {
-    anim.frameTime = frameTime;
-    anim.currentFrame = 0;
-    anim.elapsedTime = 0.0f;
-    anim.flip = SDL_FLIP_NONE;
+// Handle = slot + generation: slot được tái sử dụng sau khi despawn nhưng generation
+// tăng lên, nên handle cũ giữ qua nhiều frame sẽ tự trở nên không hợp lệ.
+struct Handle {
+    Uint32 index;
+    Uint32 generation;
 
-    if (isSpriteSheet) {
-        SDL_Texture* texture = IMG_LoadTexture(renderer, path.c_str());
-        if (!texture) std::cout << "ERROR: Failed to load texture: " << path << " - " << IMG_GetError() << std::endl;
-        anim.textures.resize(1);
-        anim.textures[0] = texture;
-        int w, h;
-        SDL_QueryTexture(texture, nullptr, nullptr, &w, &h);
-        anim.frameWidth = w / frameCount;
-        anim.frameHeight = h;
-        anim.frames.resize(frameCount);
-        for (int i = 0; i < frameCount; i++) anim.frames[i] = { i * anim.frameWidth, 0, anim.frameWidth, anim.frameHeight };
-    }
-    else {
-        anim.frames.clear();
-        anim.textures.clear();
-        std::string basePath = path.substr(0, path.find_last_of('_') + 1);
-        for (int i = 0; i < frameCount; i++) {
-            std::string framePath = basePath + std::to_string(i + 1) + ".png";
-            SDL_Texture* frameTexture = IMG_LoadTexture(renderer, framePath.c_str());
-            if (!frameTexture) std::cout << "ERROR: Failed to load frame: " << framePath << " - " << IMG_GetError() << std::endl;
-            int w, h;
-            SDL_QueryTexture(frameTexture, nullptr, nullptr, &w, &h);
-            anim.frameWidth = w;
-            anim.frameHeight = h;
-            anim.frames.push_back({ 0, 0, w, h });
-            anim.textures.push_back(frameTexture);
-        }
+    bool valid() const { return index != INVALID_SLOT; }
+};
+
+const Handle INVALID_HANDLE = { INVALID_SLOT, 0 };
+
+// Ánh xạ slot <-> vị trí trong mảng dense. Mảng dense luôn liền mạch, xóa bằng
+// cách đưa phần tử cuối vào chỗ trống nên spawn/despawn đều O(1) và không cấp phát.
+struct HandleTable {
+    std::vector<Uint32> denseOf;
+    std::vector<Uint32> slotOf;
+    std::vector<Uint32> generation;
+    std::vector<Uint32> freeSlots;
+    size_t count = 0;
+
+    void init(size_t capacity) {
+        denseOf.assign(capacity, INVALID_SLOT);
+        slotOf.assign(capacity, INVALID_SLOT);
+        generation.assign(capacity, 0);
+        freeSlots.resize(capacity);
+        for (size_t i = 0; i < capacity; i++) freeSlots[i] = static_cast<Uint32>(capacity - 1 - i);
+        count = 0;
     }
-}
 
-void updateAnimation(Animation& anim, float deltaTime, bool loop = true) {
-    anim.elapsedTime += deltaTime;
-    while (anim.elapsedTime >= anim.frameTime) {
-        anim.elapsedTime -= anim.frameTime;
-        anim.currentFrame++;
-        if (loop) {
-            anim.currentFrame %= anim.frames.size();
-        }
-        else if (anim.currentFrame >= anim.frames.size()) {
-            anim.currentFrame = anim.frames.size() - 1;
-        }
+    void reset() {
+        for (size_t i = 0; i < count; i++) generation[slotOf[i]]++;
+        std::fill(denseOf.begin(), denseOf.end(), INVALID_SLOT);
+        std::fill(slotOf.begin(), slotOf.end(), INVALID_SLOT);
+        freeSlots.resize(denseOf.size());
+        for (size_t i = 0; i < freeSlots.size(); i++) freeSlots[i] = static_cast<Uint32>(freeSlots.size() - 1 - i);
+        count = 0;
     }
-}
 
-bool init() {
-    if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO) < 0) return false;
-    if ((IMG_Init(IMG_INIT_PNG | IMG_INIT_JPG) & (IMG_INIT_PNG | IMG_INIT_JPG)) != (IMG_INIT_PNG | IMG_INIT_JPG)) return false;
-    if (TTF_Init() == -1) return false;
-    if (Mix_OpenAudio(22050, MIX_DEFAULT_FORMAT, 1, 512) < 0) return false;
+    bool full() const { return freeSlots.empty(); }
+
+    // Phần tử mới luôn nằm ở cuối mảng dense (index = count - 1).
+    Handle acquire() {
+        if (freeSlots.empty()) return INVALID_HANDLE;
+        Uint32 slot = freeSlots.back();
+        freeSlots.pop_back();
+        denseOf[slot] = static_cast<Uint32>(count);
+        slotOf[count] = slot;
+        count++;
+        return { slot, generation[slot] };
+    }
 
-    window = SDL_CreateWindow("DodgeAndQ", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, SCREEN_WIDTH, SCREEN_HEIGHT, SDL_WINDOW_SHOWN);
-    if (!window) return false;
+    // Giải phóng phần tử dense i; phần tử cuối chuyển vào chỗ i, caller tự chuyển dữ liệu.
+    void release(size_t i) {
+        Uint32 slot = slotOf[i];
+        size_t last = count - 1;
+        Uint32 lastSlot = slotOf[last];
+        slotOf[i] = lastSlot;
+        denseOf[lastSlot] = static_cast<Uint32>(i);
+        denseOf[slot] = INVALID_SLOT;
+        slotOf[last] = INVALID_SLOT;
+        generation[slot]++;
+        freeSlots.push_back(slot);
+        count--;
+    }
 
-    renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
-    if (!renderer) return false;
+    Handle handleAt(size_t i) const { return { slotOf[i], generation[slotOf[i]] }; }
 
-    font = TTF_OpenFont("assets/arial.ttf", 24);
-    if (!font) return false;
+    int lookup(Handle h) const {
+        if (h.index >= denseOf.size() || generation[h.index] != h.generation) return -1;
+        return static_cast<int>(denseOf[h.index]);
+    }
+};
 
-    titleFont = TTF_OpenFont("assets/arial.ttf", 48); // Font lớn hơn cho tiêu đề
-    if (!titleFont) return false;
+// Pool cố định dung lượng cho các đối tượng dạng AoS (đạn, marker).
+template <typename T>
+struct Pool {
+    HandleTable table;
+    std::vector<T> items;
+
+    explicit Pool(size_t capacity) : items(capacity) { table.init(capacity); }
+
+    size_t size() const { return table.count; }
+    bool empty() const { return table.count == 0; }
+    T* begin() { return items.data(); }
+    T* end() { return items.data() + table.count; }
+    const T* begin() const { return items.data(); }
+    const T* end() const { return items.data() + table.count; }
+    T& operator[](size_t i) { return items[i]; }
+    const T& operator[](size_t i) const { return items[i]; }
+
+    Handle spawn(const T& value) {
+        Handle h = table.acquire();
+        if (h.valid()) items[table.count - 1] = value;
+        return h;
+    }
 
-    gameMusic = Mix_LoadMUS("assets/audio/game_music.wav");
-    if (gameMusic) Mix_VolumeMusic(musicVolume);
-
-    shootSound = Mix_LoadWAV("assets/audio/shoot.wav");
-    if (shootSound) Mix_VolumeChunk(shootSound, sfxVolume);
-    hurtSound = Mix_LoadWAV("assets/audio/hurt.wav");
-    if (hurtSound) Mix_VolumeChunk(hurtSound, sfxVolume);
-    deathSound = Mix_LoadWAV("assets/audio/death.wav");
-    if (deathSound) Mix_VolumeChunk(deathSound, sfxVolume);
-    enemyAttackSound = Mix_LoadWAV("assets/audio/enemy_attack.wav");
-    if (enemyAttackSound) Mix_VolumeChunk(enemyAttackSound, sfxVolume);
-    enemyDeathSound = Mix_LoadWAV("assets/audio/enemy_death.wav");
-    if (enemyDeathSound) Mix_VolumeChunk(enemyDeathSound, sfxVolume);
-    spawnSound = Mix_LoadWAV("assets/audio/spawn.wav");
-    if (spawnSound) Mix_VolumeChunk(spawnSound, sfxVolume);
-    levelUpSound = Mix_LoadWAV("assets/audio/level_up.wav");
-    if (levelUpSound) Mix_VolumeChunk(levelUpSound, sfxVolume);
-    upgradeSound = Mix_LoadWAV("assets/audio/upgrade.wav");
-    if (upgradeSound) Mix_VolumeChunk(upgradeSound, sfxVolume);
-    clickSound = Mix_LoadWAV("assets/audio/click.wav");
-    if (clickSound) Mix_VolumeChunk(clickSound, sfxVolume);
-
-    loadAnimation(playerAnim.idle, "assets/player/idle.png", 6, 0.1f, true);
-    loadAnimation(playerAnim.walk, "assets/player/walk.png", 7, 0.07f, true);
-    loadAnimation(playerAnim.attack, "assets/player/attack.png", 7, 0.03f, true);
-    loadAnimation(playerAnim.hurt, "assets/player/hurt.png", 4, 0.05f, true);
-    loadAnimation(playerAnim.dead, "assets/player/dead.png", 4, 0.07f, true);
-
-    loadAnimation(enemyBasicAnim.walking, "assets/enemy_basic/Walking/enemy_basic_Walking_1.png", 24, 0.05f, false);
-    loadAnimation(enemyBasicAnim.slashing, "assets/enemy_basic/Slashing/enemy_basic_Slashing_1.png", 12, 0.0833f, false);
-    loadAnimation(enemyBasicAnim.dying, "assets/enemy_basic/Dying/enemy_basic_Dying_1.png", 15, 0.05f, false);
-
-    loadAnimation(enemyFastAnim.walking, "assets/enemy_fast/Walking/enemy_fast_Walking_1.png", 24, 0.05f, false);
-    loadAnimation(enemyFastAnim.slashing, "assets/enemy_fast/Slashing/enemy_fast_Slashing_1.png", 12, 0.0417f, false);
-    loadAnimation(enemyFastAnim.dying, "assets/enemy_fast/Dying/enemy_fast_Dying_1.png", 15, 0.05f, false);
-
-    loadAnimation(enemyChaserAnim.walking, "assets/enemy_chaser/Walking/enemy_chaser_Walking_1.png", 24, 0.05f, false);
-    loadAnimation(enemyChaserAnim.slashing, "assets/enemy_chaser/Slashing/enemy_chaser_Slashing_1.png", 12, 0.0667f, false);
-    loadAnimation(enemyChaserAnim.dying, "assets/enemy_chaser/Dying/enemy_chaser_Dying_1.png", 15, 0.05f, false);
-
-    maps[0] = IMG_LoadTexture(renderer, "assets/map1.png");
-    maps[1] = IMG_LoadTexture(renderer, "assets/map2.png");
-    maps[2] = IMG_LoadTexture(renderer, "assets/map3.png");
-    maps[3] = IMG_LoadTexture(renderer, "assets/map4.png");
-    currentMap = rand() % NUM_MAPS;
-
-    menuBackground = IMG_LoadTexture(renderer, "assets/menu_background.png");
-    projectileTexture = IMG_LoadTexture(renderer, "assets/projectile.png");
+    T* get(Handle h) {
+        int i = table.lookup(h);
+        return (i >= 0) ? &items[i] : nullptr;
+    }
 
-    SDL_ShowCursor(SDL_ENABLE);
-    return true;
-}
+    void removeAt(size_t i) {
+        items[i] = items[table.count - 1];
+        table.release(i);
+    }
 
-void spawnEnemyMarker() {
-    SDL_FPoint spawnPos;
-    float distance;
-    do {
-        spawnPos.x = rand() % (SCREEN_WIDTH - PLAYER_SIZE);
-        spawnPos.y = rand() % (SCREEN_HEIGHT - PLAYER_SIZE);
-        float dx = spawnPos.x - (player.rect.x + player.rect.w / 2);
-        float dy = spawnPos.y - (player.rect.y + player.rect.h / 2);
-        distance = std::sqrt(dx * dx + dy * dy);
-    } while (distance < MIN_SPAWN_DISTANCE);
+    // Duyệt ngược để phần tử cuối được chuyển vào chỗ trống đã được kiểm tra rồi.
+    template <typename Pred>
+    void removeIf(Pred pred) {
+        for (size_t i = table.count; i-- > 0;) {
+            if (pred(items[i])) removeAt(i);
+        }
+    }
 
-    markers.push_back({ spawnPos, SPAWN_DELAY, true });
-}
+    void clear() { table.reset(); }
+};
 
-void spawnEnemyAtMarker(const SDL_FPoint& pos) {
-    if (spawnSound) Mix_PlayChannel(-1, spawnSound, 0);
-    GameObject enemy;
-    enemy.type = static_cast<EnemyType>(rand() % 3);
-    enemy.rect = { pos.x - PLAYER_SIZE / 2, pos.y - PLAYER_SIZE / 2, (float)PLAYER_SIZE, (float)PLAYER_SIZE };
-    enemy.updateHitbox();
-    enemy.health = (enemy.type == CHASER) ? 2 : 1;
-    enemy.active = true;
-    enemy.enemyState = WALKING;
-    enemy.animTime = 0.0f;
-    enemy.angle = 0.0f;
-    enemy.hitEffectTimer = 0.0f;
-    enemy.hurtTimer = 0.0f;
-    switch (enemy.type) {
-    case BASIC: enemy.attackCooldown = 1.0f; break;
-    case FAST: enemy.attackCooldown = 0.5f; break;
-    case CHASER: enemy.attackCooldown = 0.8f; break;
-    }
-    enemies.push_back(enemy);
-}
-
-GameObject* findNearestEnemy(float x, float y) {
-    GameObject* nearest = nullptr;
-    float minDist = FLT_MAX;
-    for (auto& enemy : enemies) {
-        if (!enemy.active || enemy.enemyState == DYING) continue;
-        float dx = enemy.rect.x + enemy.rect.w / 2 - x;
-        float dy = enemy.rect.y + enemy.rect.h / 2 - y;
-        float dist = std::sqrt(dx * dx + dy * dy);
-        if (dist < minDist) {
-            minDist = dist;
-            nearest = &enemy;
-        }
+// Enemy lưu dạng SoA: vòng lặp di chuyển/va chạm chỉ đọc các mảng "nóng",
+// timer và máu nằm ở các mảng "lạnh" riêng để không kéo theo vào cache.
+// Các mảng được cấp phát một lần với MAX_ENEMIES phần tử (--bench tạo lại store lớn hơn cho riêng nó).
+struct EnemyStore {
+    HandleTable table;
+    // hot
+    std::vector<float> x, y;
+    std::vector<float> vx, vy;
+    std::vector<float> hitX, hitY;
+    std::vector<Uint8> type;
+    std::vector<Uint8> state;
+    std::vector<Uint8> active;
+    std::vector<float> speedScale;
+    // kết quả của pass steering: 1 nếu enemy đã vào tầm chém trong tick này
+    std::vector<Uint8> inRange;
+    // vị trí ở tick trước, chỉ dùng khi render để nội suy
+    std::vector<float> prevX, prevY;
+    // cold
+    std::vector<int> health;
+    std::vector<Uint8> animClip;
+    std::vector<float> animStart;
+    std::vector<float> hitEffectTimer;
+    std::vector<float> attackCooldown;
+
+    explicit EnemyStore(size_t capacity) {
+        table.init(capacity);
+        x.resize(capacity); y.resize(capacity);
+        vx.resize(capacity); vy.resize(capacity);
+        hitX.resize(capacity); hitY.resize(capacity);
+        type.resize(capacity); state.resize(capacity); active.resize(capacity);
+        speedScale.resize(capacity); inRange.resize(capacity);
+        prevX.resize(capacity); prevY.resize(capacity);
+        health.resize(capacity);
+        animClip.resize(capacity);
+        animStart.resize(capacity);
+        hitEffectTimer.resize(capacity);
+        attackCooldown.resize(capacity);
     }
-    return nearest;
-}
 
-void shootProjectile() {
-    if (!qReady) return;
-    if (shootSound) Mix_PlayChannel(-1, shootSound, 0);
-    GameObject proj;
-    proj.rect = { player.rect.x + player.rect.w - PROJECTILE_SIZE, player.rect.y + player.rect.h / 2 - PROJECTILE_SIZE / 2, PROJECTILE_SIZE, PROJECTILE_SIZE };
-    proj.updateHitbox();
+    size_t size() const { return table.count; }
+    size_t capacity() const { return x.size(); }
+
+    // Trả về index dense của enemy mới, -1 nếu pool đã đầy.
+    int add(EnemyType enemyType, float posX, float posY, float time) {
+        if (!table.acquire().valid()) return -1;
+        size_t i = table.count - 1;
+        x[i] = posX;
+        y[i] = posY;
+        vx[i] = 0.0f;
+        vy[i] = 0.0f;
+        hitX[i] = posX + ENEMY_HITBOX_OFFSET;
+        hitY[i] = posY + ENEMY_HITBOX_OFFSET;
+        type[i] = static_cast<Uint8>(enemyType);
+        state[i] = WALKING;
+        active[i] = 1;
+        speedScale[i] = ENEMY_SPEED_SCALE[enemyType];
+        inRange[i] = 0;
+        prevX[i] = posX;
+        prevY[i] = posY;
+        health[i] = 0;
+        animClip[i] = static_cast<Uint8>(enemyType * ENEMY_STATE_COUNT + WALKING);
+        animStart[i] = time;
+        hitEffectTimer[i] = 0.0f;
+        attackCooldown[i] = 0.0f;
+        return static_cast<int>(i);
+    }
 
-    GameObject* target = findNearestEnemy(player.rect.x + player.rect.w / 2, player.rect.y + player.rect.h / 2);
-    if (target) {
-        float targetCenterX = target->rect.x + target->rect.w / 2;
-        float targetCenterY = target->rect.y + target->rect.h / 2;
-        float dx = targetCenterX - (player.rect.x + player.rect.w / 2);
-        float dy = targetCenterY - (player.rect.y + player.rect.h / 2);
-        float length = std::sqrt(dx * dx + dy * dy);
-        if (length > 0) {
-            proj.vx = (dx / length) * PROJECTILE_SPEED;
-            proj.vy = (dy / length) * PROJECTILE_SPEED;
-            proj.angle = std::atan2(dy, dx) * 180 / M_PI;
-            playerAnim.attack.flip = (dx < 0) ? SDL_FLIP_HORIZONTAL : SDL_FLIP_NONE;
-            playerAnim.idle.flip = playerAnim.attack.flip;
-            playerAnim.walk.flip = playerAnim.attack.flip;
-        }
+    // Đổi trạng thái và bắt đầu lại clip tương ứng nếu trạng thái thực sự thay đổi.
+    void setState(size_t i, EnemyState newState, float time) {
+        if (state[i] == newState) return;
+        state[i] = static_cast<Uint8>(newState);
+        animClip[i] = static_cast<Uint8>(type[i] * ENEMY_STATE_COUNT + newState);
+        animStart[i] = time;
     }
-    else {
-        proj.vx = PROJECTILE_SPEED;
-        proj.vy = 0;
-        proj.angle = 0;
-        playerAnim.attack.flip = SDL_FLIP_NONE;
-        playerAnim.idle.flip = SDL_FLIP_NONE;
-        playerAnim.walk.flip = SDL_FLIP_NONE;
+
+    Handle handleAt(size_t i) const { return table.handleAt(i); }
+    int indexOf(Handle h) const { return table.lookup(h); }
+
+    void updateHitbox(size_t i) {
+        hitX[i] = x[i] + ENEMY_HITBOX_OFFSET;
+        hitY[i] = y[i] + ENEMY_HITBOX_OFFSET;
     }
-    proj.active = true;
-    projectiles.push_back(proj);
-    qReady = false;
-    qCooldown = qCooldownMax;
-}
 
-void shootShotgun() {
-    if (!qReady) return;
-    if (shootSound) Mix_PlayChannel(-1, shootSound, 0);
-    float baseX = player.rect.x + player.rect.w - PROJECTILE_SIZE;
-    float baseY = player.rect.y + player.rect.h / 2 - PROJECTILE_SIZE / 2;
-    GameObject* target = findNearestEnemy(player.rect.x + player.rect.w / 2, player.rect.y + player.rect.h / 2);
+    SDL_FRect hitbox(size_t i) const {
+        return { hitX[i], hitY[i], ENEMY_HITBOX_SIZE, ENEMY_HITBOX_SIZE };
+    }
 
-    for (int i = -2; i <= 2; i++) {
-        GameObject proj;
-        proj.rect = { baseX, baseY, PROJECTILE_SIZE, PROJECTILE_SIZE };
-        proj.updateHitbox();
-        if (target) {
-            float targetCenterX = target->rect.x + target->rect.w / 2;
-            float targetCenterY = target->rect.y + target->rect.h / 2;
-            float dx = targetCenterX - (player.rect.x + player.rect.w / 2);
-            float dy = targetCenterY - (player.rect.y + player.rect.h / 2);
-            float length = std::sqrt(dx * dx + dy * dy);
-            float angleOffset = i * 15.0f;
-            float rad = std::atan2(dy, dx) + angleOffset * M_PI / 180.0f;
-            if (length > 0) {
-                proj.vx = std::cos(rad) * PROJECTILE_SPEED;
-                proj.vy = std::sin(rad) * PROJECTILE_SPEED;
-                proj.angle = rad * 180 / M_PI;
-                playerAnim.attack.flip = (dx < 0) ? SDL_FLIP_HORIZONTAL : SDL_FLIP_NONE;
-                playerAnim.idle.flip = playerAnim.attack.flip;
-                playerAnim.walk.flip = playerAnim.attack.flip;
-            }
+    float centerX(size_t i) const { return x[i] + PLAYER_SIZE / 2.0f; }
+    float centerY(size_t i) const { return y[i] + PLAYER_SIZE / 2.0f; }
+
+    void removeAt(size_t i) {
+        size_t last = table.count - 1;
+        if (i != last) {
+            x[i] = x[last]; y[i] = y[last];
+            vx[i] = vx[last]; vy[i] = vy[last];
+            hitX[i] = hitX[last]; hitY[i] = hitY[last];
+            type[i] = type[last]; state[i] = state[last]; active[i] = active[last];
+            speedScale[i] = speedScale[last];
+            prevX[i] = prevX[last]; prevY[i] = prevY[last];
+            health[i] = health[last];
+            animClip[i] = animClip[last];
+            animStart[i] = animStart[last];
+            hitEffectTimer[i] = hitEffectTimer[last];
+            attackCooldown[i] = attackCooldown[last];
         }
-        else {
-            proj.vx = PROJECTILE_SPEED + i * 100.0f;
-            proj.vy = 0;
-            proj.angle = 0;
-            playerAnim.attack.flip = SDL_FLIP_NONE;
-            playerAnim.idle.flip = SDL_FLIP_NONE;
-            playerAnim.walk.flip = SDL_FLIP_NONE;
+        table.release(i);
+    }
+
+    void savePreviousPositions() {
+        std::copy(x.begin(), x.begin() + table.count, prevX.begin());
+        std::copy(y.begin(), y.begin() + table.count, prevY.begin());
+    }
+
+    void removeInactive() {
+        for (size_t i = table.count; i-- > 0;) {
+            if (!active[i]) removeAt(i);
         }
-        proj.active = true;
-        projectiles.push_back(proj);
     }
-    qReady = false;
-    qCooldown = qCooldownMax * 1.5f;
-}
 
-void renderText(const std::string& text, int x, int y, SDL_Color color = { 255, 255, 255 }, bool useTitleFont = false) {
-    TTF_Font* selectedFont = useTitleFont ? titleFont : font;
-    SDL_Surface* surface = TTF_RenderText_Solid(selectedFont, text.c_str(), color);
-    if (!surface) return;
-    SDL_Texture* texture = SDL_CreateTextureFromSurface(renderer, surface);
-    if (!texture) {
-        SDL_FreeSurface(surface);
-        return;
+    void clear() { table.reset(); }
+};
+
+EnemyStore enemies(MAX_ENEMIES);
+Pool<GameObject> projectiles(MAX_PROJECTILES);
+Pool<Marker> markers(MAX_MARKERS);
+
+// Particle của một emitter: mọi hạt có cùng thời gian sống nên hết hạn theo thứ tự FIFO,
+// chỉ cần tăng tail. Chỉ luồng mô phỏng ghi, không cần khóa. Ring đầy thì ghi đè hạt cũ nhất.
+struct ParticleRing {
+    std::vector<float> x, y;
+    std::vector<float> vx, vy;
+    std::vector<double> birth;
+    size_t mask = 0;
+    // chỉ số logic tăng dần, vị trí vật lý = chỉ số & mask
+    size_t head = 0, tail = 0;
+
+    explicit ParticleRing(size_t capacity) : mask(capacity - 1) {
+        x.resize(capacity); y.resize(capacity);
+        vx.resize(capacity); vy.resize(capacity);
+        birth.resize(capacity);
     }
-    SDL_Rect rect = { x, y, surface->w, surface->h };
-    SDL_RenderCopy(renderer, texture, nullptr, &rect);
-    SDL_FreeSurface(surface);
-    SDL_DestroyTexture(texture);
-}
 
-bool checkCollision(const SDL_FRect& a, const SDL_FRect& b) {
-    return (a.x < b.x + b.w && a.x + a.w > b.x && a.y < b.y + b.h && a.y + a.h > b.y);
-}
+    size_t size() const { return head - tail; }
+    size_t capacity() const { return mask + 1; }
 
-void applyUpgrade(int choice) {
-    if (upgradePoints < 1) return;
-    if (upgradeSound) Mix_PlayChannel(-1, upgradeSound, 0);
-    switch (choice) {
-    case 1: playerSpeed += 50.0f; break;
-    case 2: qCooldownMax *= 0.8f; break;
-    case 3: projectileDamage += 1; break;
-    case 4: if (!shotgunUnlocked) { currentWeapon = SHOTGUN; shotgunUnlocked = true; } break;
+    void push(float px, float py, float pvx, float pvy, double time) {
+        if (size() == capacity()) tail++;
+        size_t i = head++ & mask;
+        x[i] = px; y[i] = py;
+        vx[i] = pvx; vy[i] = pvy;
+        birth[i] = time;
     }
-    upgradePoints -= 1;
-    gameState = PLAYING;
-}
 
-void resetGame() {
-    enemies.clear();
-    projectiles.clear();
-    markers.clear();
-    particles.clear();
+    void expire(double time, float lifetime) {
+        while (tail != head && birth[tail & mask] + lifetime <= time) tail++;
+    }
 
-    player.rect = { SCREEN_WIDTH / 2.0f - PLAYER_SIZE / 2.0f, SCREEN_HEIGHT / 2.0f - PLAYER_SIZE / 2.0f, (float)PLAYER_SIZE, (float)PLAYER_SIZE };
-    player.updateHitbox();
-    player.active = true;
-    player.health = MAX_HEALTH;
-    player.playerState = IDLE;
-    player.animTime = 0.0f;
-    player.angle = 0.0f;
-    player.hurtTimer = 0.0f;
-    player.vx = 0.0f;
-    player.vy = 0.0f;
+    // Gọi fn(physBegin, physEnd) cho các đoạn liên tục trong bộ nhớ ứng với [begin, end) tính từ tail.
+    template <typename Fn>
+    void forSegments(size_t begin, size_t end, Fn fn) const {
+        while (begin < end) {
+            size_t phys = (tail + begin) & mask;
+            size_t n = std::min(end - begin, capacity() - phys);
+            fn(phys, phys + n);
+            begin += n;
+        }
+    }
 
-    score = 0;
-    combo = 0;
-    comboTime = 0.0f;
-    qCooldown = 0.0f;
-    qReady = true;
-    gameTime = 0.0f;
-    level = 1;
-    spawnRate = SPAWN_RATE_BASE;
-    upgradePoints = 0;
-    projectileDamage = 1;
-    playerSpeed = PLAYER_SPEED;
-    qCooldownMax = Q_COOLDOWN;
-    currentWeapon = SINGLE;
-    gameState = PLAYING;
-    levelUpTimer = 0.0f;
-    preLevelUpTimer = 0.0f;
-    deathTimer = 0.0f;
-    lastDamageTime = 0.0f;
-    currentMap = rand() % NUM_MAPS;
-    shotgunUnlocked = false;
+    void clear() { head = tail = 0; }
+};
 
-    playerAnim.idle.currentFrame = 0;
-    playerAnim.idle.elapsedTime = 0.0f;
-    playerAnim.idle.flip = SDL_FLIP_NONE;
-    SDL_SetTextureColorMod(playerAnim.idle.textures[0], 255, 255, 255);
+std::vector<ParticleRing> particles(NUM_PARTICLE_EMITTERS, ParticleRing(MAX_PARTICLES));
+double particleClock = 0.0;
+
+// Lưới đều cho va chạm: mỗi enemy nằm trong đúng một ô theo tâm hitbox,
+// cellStart/cellItems là kết quả counting sort nên build lại không cần cấp phát.
+struct SpatialGrid {
+    std::vector<int> cellStart;
+    std::vector<int> cellItems;
+    std::vector<int> itemCell;
+    float maxHalfW;
+    float maxHalfH;
+};
 
-    for (int i = 0; i < 2; i++) spawnEnemyMarker();
+SpatialGrid enemyGrid;
+
+#ifndef DODGE_NO_PROFILER
+// Profiler theo zone: PROFILE_ZONE("tên") đo từ chỗ khai báo tới hết scope. Mỗi luồng ghi vào ring buffer
+// riêng (một luồng ghi, luồng chính đọc ở endFrame) nên không có khóa trên đường đo. Khi tắt, mỗi zone chỉ
+// tốn một lần đọc cờ; build với -DDODGE_NO_PROFILER thì macro rỗng và toàn bộ phần này bị bỏ.
+const Uint32 PROFILE_RING_SIZE = 8192;
+const int PROFILE_HISTORY = 240;
+const int PROFILE_WINDOW = 60;
+const double DEFAULT_TRACE_SECONDS = 10.0;
+const char* const DEFAULT_TRACE_PATH = "trace.json";
+
+struct ProfileEvent {
+    const char* name;
+    Uint64 start;
+    Uint64 end;
+};
 
-    Mix_HaltMusic();
-    if (gameMusic) Mix_PlayMusic(gameMusic, -1);
-}
+struct ProfileThread {
+    ProfileEvent events[PROFILE_RING_SIZE];
+    std::atomic<Uint32> head{ 0 };
+    Uint32 tail = 0;
+    int id = 0;
+    const char* name = "Thread";
+};
 
-void spawnParticles(float x, float y) {
-    for (int i = 0; i < 5; i++) {
-        Particle p;
-        p.pos = { x + PLAYER_SIZE / 2, y + PLAYER_SIZE / 2 };
-        p.vx = (rand() % 200 - 100) / 100.0f;
-        p.vy = (rand() % 200 - 100) / 100.0f;
-        p.lifetime = 0.3f;
-        particles.push_back(p);
-    }
-}
+// Một dòng của file trace: zone ('X', có dur), counter ('C', có value) hoặc tên luồng ('M').
+struct TraceRecord {
+    char phase;
+    int thread;
+    const char* name;
+    double ts;
+    double dur;
+    double value;
+};
 
-void updateParticles(float deltaTime) {
-    for (auto& p : particles) {
-        p.pos.x += p.vx * deltaTime * 100;
-        p.pos.y += p.vy * deltaTime * 100;
-        p.lifetime -= deltaTime;
+// Ghi trace dạng Chrome trace event JSON (mở được bằng chrome://tracing và ui.perfetto.dev).
+// Luồng chính chỉ chép record vào hàng đợi; định dạng chuỗi và ghi đĩa chạy trên luồng riêng.
+struct TraceWriter {
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::vector<TraceRecord> queue;
+    bool closing = false;
+    std::ofstream file;
+    bool first = true;
+
+    bool open(const std::string& path) {
+        file.open(path, std::ios::binary | std::ios::trunc);
+        if (!file) {
+            std::cout << "ERROR: Failed to create trace: " << path << std::endl;
+            return false;
+        }
+        file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+        first = true;
+        closing = false;
+        thread = std::thread(&TraceWriter::writerLoop, this);
+        return true;
     }
-    particles.erase(std::remove_if(particles.begin(), particles.end(),
-        [](const Particle& p) { return p.lifetime <= 0; }), particles.end());
-}
-
-void updatePlayer(float deltaTime) {
-    if (gameState != PLAYING || player.playerState == DEAD) return;
-
-    const Uint8* keys = SDL_GetKeyboardState(nullptr);
-    float speed = playerSpeed * deltaTime;
-    bool moving = false;
 
-    player.vx = 0;
-    player.vy = 0;
-    if (keys[SDL_SCANCODE_W] && player.rect.y > 0) { player.vy = -speed; moving = true; }
-    if (keys[SDL_SCANCODE_S] && player.rect.y + player.rect.h < SCREEN_HEIGHT) { player.vy = speed; moving = true; }
-    if (keys[SDL_SCANCODE_A] && player.rect.x > 0) {
-        player.vx = -speed;
-        moving = true;
-        if (player.playerState != ATTACK && player.playerState != HURT) playerAnim.walk.flip = SDL_FLIP_HORIZONTAL;
-    }
-    if (keys[SDL_SCANCODE_D] && player.rect.x + player.rect.w < SCREEN_WIDTH) {
-        player.vx = speed;
-        moving = true;
-        if (player.playerState != ATTACK && player.playerState != HURT) playerAnim.walk.flip = SDL_FLIP_NONE;
+    void submit(std::vector<TraceRecord>& records) {
+        if (records.empty()) return;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            queue.insert(queue.end(), records.begin(), records.end());
+        }
+        records.clear();
+        wake.notify_one();
     }
 
-    if (moving && player.playerState != ATTACK && player.playerState != HURT) {
-        float length = std::sqrt(player.vx * player.vx + player.vy * player.vy);
-        if (length > 0) {
-            player.vx = (player.vx / length) * speed;
-            player.vy = (player.vy / length) * speed;
+    void writerLoop() {
+        std::vector<TraceRecord> batch;
+        std::string text;
+        char line[256];
+        for (;;) {
+            bool done;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [this] { return closing || !queue.empty(); });
+                batch.swap(queue);
+                done = closing;
+            }
+            text.clear();
+            for (const TraceRecord& r : batch) {
+                int n = 0;
+                if (r.phase == 'X') {
+                    n = std::snprintf(line, sizeof(line), "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+                        first ? "" : ",\n", r.name, r.thread, r.ts, r.dur);
+                }
+                else if (r.phase == 'C') {
+                    n = std::snprintf(line, sizeof(line), "%s{\"name\":\"%s\",\"ph\":\"C\",\"pid\":1,\"ts\":%.3f,\"args\":{\"value\":%.0f}}",
+                        first ? "" : ",\n", r.name, r.ts, r.value);
+                }
+                else {
+                    n = std::snprintf(line, sizeof(line), "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+                        first ? "" : ",\n", r.thread, r.name);
+                }
+                text.append(line, std::min<size_t>(n, sizeof(line) - 1));
+                first = false;
+            }
+            batch.clear();
+            file.write(text.data(), static_cast<std::streamsize>(text.size()));
+            if (done) return;
         }
-        player.rect.x += player.vx;
-        player.rect.y += player.vy;
-        player.updateHitbox();
-        player.playerState = WALK;
-    }
-    else if (player.playerState != ATTACK && player.playerState != HURT) {
-        player.playerState = IDLE;
     }
 
-    Animation* currentPlayerAnim = nullptr;
-    switch (player.playerState) {
-    case IDLE: currentPlayerAnim = &playerAnim.idle; break;
-    case WALK: currentPlayerAnim = &playerAnim.walk; break;
-    case ATTACK: currentPlayerAnim = &playerAnim.attack; break;
-    case HURT: currentPlayerAnim = &playerAnim.hurt; break;
-    case DEAD: currentPlayerAnim = &playerAnim.dead; break;
+    // Luồng ghi còn chạy khi hủy sẽ gọi std::terminate, nên luôn đóng trước.
+    ~TraceWriter() {
+        close();
     }
-    if (currentPlayerAnim) {
-        updateAnimation(*currentPlayerAnim, deltaTime, player.playerState != DEAD && player.playerState != HURT);
-        if ((player.playerState == ATTACK || player.playerState == HURT) &&
-            currentPlayerAnim->currentFrame == currentPlayerAnim->frames.size() - 1) {
-            player.playerState = IDLE;
+
+    void close() {
+        if (!thread.joinable()) return;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            closing = true;
         }
+        wake.notify_one();
+        thread.join();
+        file << "\n]}\n";
+        file.close();
     }
+};
 
-    if (player.hurtTimer > 0) {
-        player.hurtTimer -= deltaTime;
-        if (player.hurtTimer <= 0) player.hurtTimer = 0.0f;
+// Thống kê một zone: tổng thời gian trong frame hiện tại, gộp theo cửa sổ PROFILE_WINDOW frame.
+struct ZoneStats {
+    const char* name;
+    double frameTotal;
+    double windowSum;
+    double windowMax;
+    double avgMs;
+    double maxMs;
+};
+
+struct Profiler {
+    // Bật khi overlay đang hiện hoặc đang capture trace.
+    std::atomic<bool> enabled{ false };
+    bool overlay = false;
+    bool capturing = false;
+    Uint64 captureStart = 0;
+    Uint64 captureEnd = 0;
+    std::string capturePath;
+    TraceWriter trace;
+    std::vector<TraceRecord> traceBatch;
+    std::mutex mutex;
+    std::vector<std::unique_ptr<ProfileThread>> threads;
+    std::vector<ZoneStats> zones;
+    float frameMs[PROFILE_HISTORY] = {};
+    int frameCursor = 0;
+    int windowFrames = 0;
+    double windowFrameSum = 0.0;
+    double windowFrameMax = 0.0;
+    double frameAvgMs = 0.0;
+    double frameMaxMs = 0.0;
+
+    // Đặt trước chỗ để zone mới xuất hiện giữa ván không làm cấp phát lại.
+    Profiler() {
+        zones.reserve(64);
     }
-}
 
-void updateEnemies(float deltaTime) {
-    float currentEnemySpeed = ENEMY_SPEED + (level - 1) * ENEMY_SPEED_INCREASE;
-    for (auto& enemy : enemies) {
-        if (!enemy.active) continue;
+    ProfileThread* registerThread() {
+        std::lock_guard<std::mutex> lock(mutex);
+        threads.emplace_back(new ProfileThread());
+        threads.back()->id = static_cast<int>(threads.size());
+        return threads.back().get();
+    }
 
-        float dx = player.rect.x + player.rect.w / 2 - (enemy.rect.x + enemy.rect.w / 2);
-        float dy = player.rect.y + player.rect.h / 2 - (enemy.rect.y + enemy.rect.h / 2);
-        float length = std::sqrt(dx * dx + dy * dy);
+    double traceMicros(Uint64 counter) const {
+        return static_cast<double>(static_cast<Sint64>(counter - captureStart)) * 1e6 / SDL_GetPerformanceFrequency();
+    }
 
-        Animation* currentAnim = nullptr;
-        switch (enemy.type) {
-        case BASIC: currentAnim = (enemy.enemyState == WALKING) ? &enemyBasicAnim.walking : (enemy.enemyState == SLASHING) ? &enemyBasicAnim.slashing : &enemyBasicAnim.dying; break;
-        case FAST: currentAnim = (enemy.enemyState == WALKING) ? &enemyFastAnim.walking : (enemy.enemyState == SLASHING) ? &enemyFastAnim.slashing : &enemyFastAnim.dying; break;
-        case CHASER: currentAnim = (enemy.enemyState == WALKING) ? &enemyChaserAnim.walking : (enemy.enemyState == SLASHING) ? &enemyChaserAnim.slashing : &enemyChaserAnim.dying; break;
-        }
-
-        if (currentAnim) {
-            updateAnimation(*currentAnim, deltaTime, enemy.enemyState != DYING);
-            currentAnim->flip = (dx < 0) ? SDL_FLIP_HORIZONTAL : SDL_FLIP_NONE;
-            if (enemy.enemyState == DYING && currentAnim->currentFrame == currentAnim->frames.size() - 1) {
-                enemy.active = false;
-                if (enemyDeathSound) Mix_PlayChannel(-1, enemyDeathSound, 0);
-                score += SCORE_PER_KILL * (combo + 1);
-                combo++;
-                comboTime = COMBO_TIMEOUT;
-                spawnParticles(enemy.rect.x, enemy.rect.y);
-            }
-        }
+    void record(ProfileThread* thread, const char* name, Uint64 start, Uint64 end) {
+        Uint32 head = thread->head.load(std::memory_order_relaxed);
+        thread->events[head & (PROFILE_RING_SIZE - 1)] = { name, start, end };
+        thread->head.store(head + 1, std::memory_order_release);
+    }
+
+    // So theo nội dung: cùng tên ở nhiều chỗ gọi (chuỗi literal khác địa chỉ) vẫn gộp vào một dòng.
+    ZoneStats& zone(const char* name) {
+        for (ZoneStats& stats : zones) if (stats.name == name || std::strcmp(stats.name, name) == 0) return stats;
+        zones.push_back({ name, 0.0, 0.0, 0.0, 0.0, 0.0 });
+        return zones.back();
+    }
 
-        if (enemy.enemyState != DYING) {
-            if (length <= SLASHING_DISTANCE) {
-                if (enemy.enemyState != SLASHING) {
-                    enemy.enemyState = SLASHING;
-                    if (enemyAttackSound) Mix_PlayChannel(-1, enemyAttackSound, 0);
+    // Luồng chính, mỗi frame: lấy sự kiện mới từ mọi ring và cập nhật thống kê.
+    void endFrame(double frameSeconds) {
+        if (!enabled.load(std::memory_order_relaxed)) return;
+        const double msPerCount = 1000.0 / SDL_GetPerformanceFrequency();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (auto& thread : threads) {
+                Uint32 head = thread->head.load(std::memory_order_acquire);
+                // Ring bị ghi đè nếu một luồng ghi quá PROFILE_RING_SIZE zone giữa hai lần đọc: bỏ phần cũ.
+                if (head - thread->tail > PROFILE_RING_SIZE) thread->tail = head - PROFILE_RING_SIZE;
+                for (; thread->tail != head; thread->tail++) {
+                    const ProfileEvent& event = thread->events[thread->tail & (PROFILE_RING_SIZE - 1)];
+                    zone(event.name).frameTotal += (event.end - event.start) * msPerCount;
+                    if (capturing && event.end > captureStart) {
+                        traceBatch.push_back({ 'X', thread->id, event.name, traceMicros(event.start), traceMicros(event.end) - traceMicros(event.start), 0.0 });
+                    }
                 }
             }
-            else {
-                enemy.enemyState = WALKING;
-                float speedMultiplier = enemy.type == FAST ? 1.5f : (enemy.type == CHASER ? 0.8f : 1.0f);
-                float moveDx = dx / length * currentEnemySpeed * speedMultiplier * deltaTime;
-                float moveDy = dy / length * currentEnemySpeed * speedMultiplier * deltaTime;
-                enemy.rect.x += moveDx;
-                enemy.rect.y += moveDy;
-                enemy.updateHitbox();
-            }
         }
-
-        if (enemy.hitEffectTimer > 0) {
-            enemy.hitEffectTimer -= deltaTime;
-            if (enemy.hitEffectTimer <= 0) enemy.hitEffectTimer = 0.0f;
+        if (capturing) {
+            trace.submit(traceBatch);
+            if (SDL_GetPerformanceCounter() >= captureEnd) stopCapture();
         }
 
-        if (enemy.attackCooldown > 0) {
-            enemy.attackCooldown -= deltaTime;
+        double ms = frameSeconds * 1000.0;
+        frameMs[frameCursor] = static_cast<float>(ms);
+        frameCursor = (frameCursor + 1) % PROFILE_HISTORY;
+        windowFrameSum += ms;
+        windowFrameMax = std::max(windowFrameMax, ms);
+        for (ZoneStats& stats : zones) {
+            stats.windowSum += stats.frameTotal;
+            stats.windowMax = std::max(stats.windowMax, stats.frameTotal);
+            stats.frameTotal = 0.0;
         }
-    }
-}
-
-void updateProjectiles(float deltaTime) {
-    for (auto& proj : projectiles) {
-        if (!proj.active) continue;
-        proj.rect.x += proj.vx * deltaTime;
-        proj.rect.y += proj.vy * deltaTime;
-        proj.updateHitbox();
-        if (proj.rect.x + proj.rect.w < 0 || proj.rect.x > SCREEN_WIDTH ||
-            proj.rect.y + proj.rect.h < 0 || proj.rect.y > SCREEN_HEIGHT) {
-            proj.active = false;
+        if (++windowFrames < PROFILE_WINDOW) return;
+        frameAvgMs = windowFrameSum / windowFrames;
+        frameMaxMs = windowFrameMax;
+        for (ZoneStats& stats : zones) {
+            stats.avgMs = stats.windowSum / windowFrames;
+            stats.maxMs = stats.windowMax;
+            stats.windowSum = 0.0;
+            stats.windowMax = 0.0;
         }
+        windowFrames = 0;
+        windowFrameSum = 0.0;
+        windowFrameMax = 0.0;
     }
 
-    for (auto& proj : projectiles) {
-        if (!proj.active) continue;
-        for (auto& enemy : enemies) {
-            if (!enemy.active || enemy.enemyState == DYING) continue;
-            if (checkCollision(proj.hitbox, enemy.hitbox)) {
-                proj.active = false;
-                enemy.health -= projectileDamage;
-                enemy.hitEffectTimer = 0.2f;
-                qReady = true;
-                qCooldown = 0;
-                if (enemy.health <= 0 && enemy.enemyState != DYING) {
-                    enemy.enemyState = DYING;
-                    enemy.vx = 0;
-                    enemy.vy = 0;
-                }
-                break;
-            }
-        }
+    // Bỏ sự kiện cũ còn trong ring và thống kê lại từ đầu, khi profiler vừa được bật.
+    void reset() {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto& thread : threads) thread->tail = thread->head.load(std::memory_order_acquire);
+        zones.clear();
+        std::fill(frameMs, frameMs + PROFILE_HISTORY, 0.0f);
+        windowFrames = 0;
+        windowFrameSum = windowFrameMax = frameAvgMs = frameMaxMs = 0.0;
     }
-}
 
-void update(float deltaTime) {
-    switch (gameState) {
-    case MENU: {
-        if (!Mix_PlayingMusic() && gameMusic) Mix_PlayMusic(gameMusic, -1);
-        break;
+    void toggleOverlay() {
+        overlay = !overlay;
+        if (overlay && !capturing) reset();
+        enabled.store(overlay || capturing);
     }
-    case SETTINGS: {
-        if (!Mix_PlayingMusic() && gameMusic) Mix_PlayMusic(gameMusic, -1);
-        break;
+
+    // Ghi mọi zone trong seconds giây tới (tính từ lúc gọi) cùng các counter vào file trace.
+    bool startCapture(const std::string& path, double seconds) {
+        if (capturing) return false;
+        if (!trace.open(path)) return false;
+        if (!overlay) reset();
+        capturePath = path;
+        captureStart = SDL_GetPerformanceCounter();
+        captureEnd = captureStart + static_cast<Uint64>(seconds * SDL_GetPerformanceFrequency());
+        capturing = true;
+        enabled.store(true);
+        std::cout << "Capturing trace to " << path << " for " << seconds << " s" << std::endl;
+        return true;
     }
-    case PAUSED: {
-        break;
+
+    void counter(const char* name, double value) {
+        if (capturing) traceBatch.push_back({ 'C', 0, name, traceMicros(SDL_GetPerformanceCounter()), 0.0, value });
     }
-    case PRE_LEVEL_UP: {
-        preLevelUpTimer -= deltaTime;
-        for (auto& enemy : enemies) {
-            if (enemy.active && enemy.enemyState != DYING) {
-                enemy.enemyState = DYING;
-                enemy.health = 0;
-                enemy.vx = 0;
-                enemy.vy = 0;
-            }
-        }
-        if (preLevelUpTimer <= 0) {
-            if (levelUpSound) Mix_PlayChannel(-1, levelUpSound, 0);
-            gameState = LEVEL_UP;
-            levelUpTimer = 2.0f;
+
+    void stopCapture() {
+        if (!capturing) return;
+        capturing = false;
+        enabled.store(overlay);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (auto& thread : threads) traceBatch.push_back({ 'M', thread->id, thread->name, 0.0, 0.0, 0.0 });
         }
-        break;
+        trace.submit(traceBatch);
+        trace.close();
+        std::cout << "Trace written to " << capturePath << std::endl;
     }
-    case LEVEL_UP: {
-        levelUpTimer -= deltaTime;
-        if (player.health < MAX_HEALTH) player.health = MAX_HEALTH;
-        if (levelUpTimer <= 0) {
-            level++;
-            upgradePoints++;
-            spawnRate = std::max(SPAWN_RATE_BASE - (level - 1) * SPAWN_RATE_DECREASE, 10.0f);
-            enemies.clear();
-            int newMap;
-            do { newMap = rand() % NUM_MAPS; } while (newMap == currentMap);
-            currentMap = newMap;
-            gameState = (upgradePoints >= 1) ? UPGRADE_MENU : PLAYING;
-        }
-        break;
+};
+
+Profiler profiler;
+thread_local ProfileThread* profileThread = nullptr;
+// File và thời lượng capture cho --trace và phím F4.
+std::string tracePath = DEFAULT_TRACE_PATH;
+double traceSeconds = DEFAULT_TRACE_SECONDS;
+
+// Đặt tên luồng hiện tại trong file trace.
+void profileThreadName(const char* name) {
+    if (!profileThread) profileThread = profiler.registerThread();
+    profileThread->name = name;
+}
+
+struct ProfileScope {
+    const char* name;
+    Uint64 start;
+
+    explicit ProfileScope(const char* zone) : name(zone), start(profiler.enabled.load(std::memory_order_relaxed) ? SDL_GetPerformanceCounter() : 0) {}
+
+    ~ProfileScope() {
+        if (!start) return;
+        if (!profileThread) profileThread = profiler.registerThread();
+        profiler.record(profileThread, name, start, SDL_GetPerformanceCounter());
     }
-    case UPGRADE_MENU: {
-        break;
+};
+
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+#define PROFILE_ZONE(name) ProfileScope PROFILE_CONCAT(profileScope, __LINE__)(name)
+#define PROFILE_THREAD(name) profileThreadName(name)
+#else
+#define PROFILE_ZONE(name)
+#define PROFILE_THREAD(name)
+#endif
+
+// Pool luồng cho parallelFor. Mỗi luồng (kể cả luồng gọi) nhận một dải chunk liên tiếp, lấy từ đầu dải
+// của mình; hết việc thì lấy trộm từ cuối dải của luồng khác. Dải được gói trong một atomic 64 bit
+// (32 bit thấp: chunk kế tiếp, 32 bit cao: cuối dải) nên cả hai phía chỉ cần một CAS.
+struct JobSystem {
+    struct alignas(64) ChunkRange {
+        std::atomic<Uint64> range;
+    };
+
+    std::vector<std::thread> workers;
+    std::unique_ptr<ChunkRange[]> ranges;
+    int participants = 1;
+    std::mutex mutex;
+    std::condition_variable wake;
+    // Báo cho luồng gọi parallelFor khi chunk cuối xong hoặc luồng worker cuối rời job.
+    std::condition_variable idle;
+    Uint64 generation = 0;
+    bool quitting = false;
+    int busyWorkers = 0;
+    std::atomic<size_t> remaining{ 0 };
+
+    void (*jobFn)(void*, size_t, size_t, size_t) = nullptr;
+    void* jobContext = nullptr;
+    size_t jobCount = 0;
+    size_t jobGrain = 1;
+
+    static size_t chunkCount(size_t count, size_t grain) { return (count + grain - 1) / grain; }
+
+    void start(int threadCount) {
+        participants = std::max(1, std::min(threadCount, MAX_THREADS));
+        ranges.reset(new ChunkRange[participants]);
+        for (int i = 0; i < participants; i++) ranges[i].range.store(0);
+        for (int i = 1; i < participants; i++) workers.emplace_back(&JobSystem::workerLoop, this, i);
     }
-    case PLAYING: {
-        if (!Mix_PlayingMusic() && gameMusic) Mix_PlayMusic(gameMusic, -1);
-        gameTime += deltaTime;
 
-        if (gameTime > LEVEL_DURATION * level) {
-            gameState = PRE_LEVEL_UP;
-            preLevelUpTimer = PRE_LEVEL_UP_DELAY;
-            break;
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            quitting = true;
         }
+        wake.notify_all();
+        for (auto& worker : workers) worker.join();
+        workers.clear();
+        participants = 1;
+    }
 
-        updatePlayer(deltaTime);
-        updateEnemies(deltaTime);
-        updateProjectiles(deltaTime);
-        updateParticles(deltaTime);
+    bool popOwn(int self, Uint32& chunk) {
+        std::atomic<Uint64>& range = ranges[self].range;
+        Uint64 current = range.load();
+        for (;;) {
+            Uint32 front = static_cast<Uint32>(current), back = static_cast<Uint32>(current >> 32);
+            if (front >= back) return false;
+            if (range.compare_exchange_weak(current, (static_cast<Uint64>(back) << 32) | (front + 1))) {
+                chunk = front;
+                return true;
+            }
+        }
+    }
 
-        for (auto& enemy : enemies) {
-            if (!enemy.active || enemy.enemyState != SLASHING) continue;
-            if (checkCollision(player.hitbox, enemy.hitbox) && enemy.attackCooldown <= 0) {
-                player.health -= 20;
-                switch (enemy.type) {
-                case BASIC: enemy.attackCooldown = 1.0f; break;
-                case FAST: enemy.attackCooldown = 0.5f; break;
-                case CHASER: enemy.attackCooldown = 0.8f; break;
-                }
-                lastDamageTime = gameTime;
-                if (player.health > 0 && player.playerState != DEAD && player.playerState != HURT) {
-                    if (hurtSound) Mix_PlayChannel(-1, hurtSound, 0);
-                    player.playerState = HURT;
-                    player.animTime = 0.0f;
-                    player.hurtTimer = 0.3f;
-                    playerAnim.hurt.currentFrame = 0;
-                    playerAnim.hurt.elapsedTime = 0.0f;
-                }
-                if (player.health <= 0 && player.playerState != DEAD) {
-                    if (deathSound) Mix_PlayChannel(-1, deathSound, 0);
-                    player.playerState = DEAD;
-                    player.animTime = 0.0f;
-                    playerAnim.dead.currentFrame = 0;
-                    playerAnim.dead.elapsedTime = 0.0f;
-                    deathTimer = playerAnim.dead.frames.size() * playerAnim.dead.frameTime + 1.0f;
+    bool steal(int self, Uint32& chunk) {
+        for (int k = 1; k < participants; k++) {
+            std::atomic<Uint64>& range = ranges[(self + k) % participants].range;
+            Uint64 current = range.load();
+            for (;;) {
+                Uint32 front = static_cast<Uint32>(current), back = static_cast<Uint32>(current >> 32);
+                if (front >= back) break;
+                if (range.compare_exchange_weak(current, (static_cast<Uint64>(back - 1) << 32) | front)) {
+                    chunk = back - 1;
+                    return true;
                 }
             }
         }
+        return false;
+    }
 
-        if (player.playerState == DEAD && deathTimer > 0) {
-            updateAnimation(playerAnim.dead, deltaTime, false);
-            deathTimer -= deltaTime;
-            if (deathTimer <= 0) {
-                gameState = GAME_OVER;
+    void runChunks(int self, void (*fn)(void*, size_t, size_t, size_t), void* context, size_t count, size_t grain) {
+        Uint32 chunk;
+        while (popOwn(self, chunk) || steal(self, chunk)) {
+            size_t begin = chunk * grain;
+            fn(context, begin, std::min(begin + grain, count), chunk);
+            if (remaining.fetch_sub(1) == 1) {
+                std::lock_guard<std::mutex> lock(mutex);
+                idle.notify_all();
             }
         }
+    }
 
-        if (comboTime > 0) comboTime -= deltaTime;
-        else combo = 0;
-
-        if (!qReady) {
-            qCooldown -= deltaTime;
-            if (qCooldown <= 0) qReady = true;
+    void workerLoop(int self) {
+        PROFILE_THREAD("Job worker");
+        Uint64 seen = 0;
+        for (;;) {
+            void (*fn)(void*, size_t, size_t, size_t);
+            void* context;
+            size_t count, grain;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [&] { return quitting || generation != seen; });
+                if (quitting) return;
+                seen = generation;
+                busyWorkers++;
+                fn = jobFn;
+                context = jobContext;
+                count = jobCount;
+                grain = jobGrain;
+            }
+            runChunks(self, fn, context, count, grain);
+            std::lock_guard<std::mutex> lock(mutex);
+            if (--busyWorkers == 0) idle.notify_all();
         }
+    }
 
-        for (auto& marker : markers) {
-            marker.timer -= deltaTime;
-            if (marker.isSpawnMarker && marker.timer <= 0) spawnEnemyAtMarker(marker.position);
+    // Gọi body(begin, end, chunk) cho từng chunk grain phần tử của [0, count). Chunk là đơn vị gộp
+    // kết quả: ghi side effect theo chunk rồi gộp theo thứ tự chunk thì kết quả không phụ thuộc số luồng.
+    template <typename Body>
+    void parallelFor(size_t count, size_t grain, Body&& body) {
+        size_t chunks = chunkCount(count, grain);
+        if (chunks <= 1 || participants == 1) {
+            for (size_t c = 0; c < chunks; c++) body(c * grain, std::min((c + 1) * grain, count), c);
+            return;
         }
-        markers.erase(std::remove_if(markers.begin(), markers.end(),
-            [](const Marker& m) { return m.timer <= 0; }), markers.end());
 
-        enemies.erase(std::remove_if(enemies.begin(), enemies.end(),
-            [](const GameObject& e) { return !e.active; }), enemies.end());
-        projectiles.erase(std::remove_if(projectiles.begin(), projectiles.end(),
-            [](const GameObject& p) { return !p.active; }), projectiles.end());
-
-        break;
-    }
-    case GAME_OVER: {
-        if (!Mix_PlayingMusic() && gameMusic) Mix_PlayMusic(gameMusic, -1);
-        for (auto& enemy : enemies) {
-            enemy.vx = 0;
-            enemy.vy = 0;
+        auto trampoline = [](void* context, size_t begin, size_t end, size_t chunk) {
+            (*static_cast<typename std::remove_reference<Body>::type*>(context))(begin, end, chunk);
+        };
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            // Luồng thức muộn từ lần trước phải rời job cũ trước khi ghi job mới.
+            idle.wait(lock, [this] { return busyWorkers == 0; });
+            jobFn = trampoline;
+            jobContext = &body;
+            jobCount = count;
+            jobGrain = grain;
+            remaining.store(chunks);
+            for (int i = 0; i < participants; i++) {
+                Uint64 front = chunks * i / participants, back = chunks * (i + 1) / participants;
+                ranges[i].range.store((back << 32) | front);
+            }
+            generation++;
         }
-        break;
-    }
-    }
-}
-
-void renderButton(const Button& button) {
-    SDL_SetRenderDrawColor(renderer, 0, 0, 0, 100);
-    SDL_Rect shadowRect = { button.rect.x + 5, button.rect.y + 5, button.rect.w, button.rect.h };
-    SDL_RenderFillRect(renderer, &shadowRect);
-
-    SDL_SetRenderDrawColor(renderer, button.hovered ? 150 : 100, button.hovered ? 150 : 100, 50, 255);
-    SDL_RenderFillRect(renderer, &button.rect);
-
-    SDL_SetRenderDrawColor(renderer, button.hovered ? 255 : 200, button.hovered ? 255 : 200, 100, 255);
-    SDL_RenderDrawRect(renderer, &button.rect);
+        wake.notify_all();
 
-    renderText(button.text, button.rect.x + 10, button.rect.y + 10, button.color);
-}
+        // Hết chunk của mình và không còn gì để lấy trộm: ngủ tới khi các worker xong chunk đang chạy.
+        runChunks(0, trampoline, &body, count, grain);
+        std::unique_lock<std::mutex> lock(mutex);
+        idle.wait(lock, [this] { return remaining.load() == 0; });
+    }
+};
 
-void renderMenu() {
-    if (menuBackground) SDL_RenderCopy(renderer, menuBackground, nullptr, nullptr);
+JobSystem jobs;
+// Sự kiện theo chunk của updateEnemies, gộp theo thứ tự chunk sau pass song song.
+std::vector<std::vector<Uint32>> chunkKills;
+std::vector<int> chunkAttackStarts;
+std::vector<int> gridChunkCounts;
+
+// Một sprite cần vẽ: vị trí ở tick trước và tick hiện tại để render tự nội suy theo alpha.
+// clip == nullptr nghĩa là projectile (projectileTexture, xoay theo angle).
+struct SpriteDraw {
+    const Animation* clip;
+    Uint32 frame;
+    float prevX, prevY;
+    float x, y;
+    float w, h;
+    float angle;
+    SDL_RendererFlip flip;
+    SDL_Color tint;
+};
 
-    Uint8 alpha = static_cast<Uint8>(128 + 127 * sin(SDL_GetTicks() / 500.0f));
-    SDL_Color titleColor = { 255, 215, 0, alpha };
-    renderText("Dodge And Q", SCREEN_WIDTH / 2 - 140, SCREEN_HEIGHT / 2 - 200, titleColor, true);
+// Âm thanh do mô phỏng phát ra trong các tick của một frame; luồng chính phát khi trình bày snapshot.
+struct AudioEvents {
+    std::vector<Mix_Chunk*> sounds;
+    bool keepMusic = false;
+    bool restartMusic = false;
+};
 
-    Button startButton = { {SCREEN_WIDTH / 2 - 100, SCREEN_HEIGHT / 2 - 60, 200, 40}, "Start Game", {0, 255, 127}, false };
-    Button settingsButton = { {SCREEN_WIDTH / 2 - 100, SCREEN_HEIGHT / 2, 200, 40}, "Settings", {255, 215, 0}, false };
-    Button quitButton = { {SCREEN_WIDTH / 2 - 100, SCREEN_HEIGHT / 2 + 60, 200, 40}, "Quit", {255, 69, 0}, false };
+// Ảnh chụp bất biến của mọi thứ render cần cho một frame. Mô phỏng ghi vào một buffer trong khi
+// luồng chính vẽ buffer còn lại, nên render không bao giờ đọc trạng thái game đang thay đổi.
+struct RenderSnapshot {
+    GameState gameState = MENU;
+    float alpha = 0.0f;
+    bool finished = false;
+    // Thời gian mô phỏng các tick và chụp snapshot này, cho telemetry.
+    float simMs = 0.0f;
+    int currentMap = 0;
+    int nextMap = -1;
+    bool hasPlayer = false;
+    SpriteDraw player;
+    std::vector<SpriteDraw> enemies;
+    std::vector<SpriteDraw> projectiles;
+    std::vector<SDL_FPoint> markers;
+    std::vector<SDL_FPoint> particles[NUM_PARTICLE_EMITTERS];
+    int health = 0;
+    int score = 0;
+    int level = 1;
+    int combo = 0;
+    float levelProgress = 0.0f;
+    float cooldownRatio = 0.0f;
+    bool qReady = true;
+    float preLevelUpTimer = 0.0f;
+    float deathTimer = 0.0f;
+    bool shotgunUnlocked = false;
+    AudioEvents audio;
+};
 
-    int mouseX, mouseY;
-    SDL_GetMouseState(&mouseX, &mouseY);
+RenderSnapshot snapshots[2];
+int frontSnapshot = 0;
+AudioEvents audioEvents;
+GameState previousState = MENU;
+GameObject player;
+int score = 0;
+int combo = 0;
+float comboTime = 0;
+float qCooldown = 0;
+bool qReady = true;
+float gameTime = 0.0f;
+int level = 1;
+float spawnRate = SPAWN_RATE_BASE;
+float nextSpawnTimer = 0.0f;
+int upgradePoints = 0;
+int projectileDamage = 1;
+float playerSpeed = PLAYER_SPEED;
+float qCooldownMax = Q_COOLDOWN;
+WeaponType currentWeapon = SINGLE;
+GameState gameState = MENU;
+float levelUpTimer = 0.0f;
+float preLevelUpTimer = 0.0f;
+float deathTimer = 0.0f;
+float lastDamageTime = 0.0f;
+int musicVolume = 64;
+int sfxVolume = 64;
+bool shotgunUnlocked = false;
+bool draggingMusicSlider = false;
+bool draggingSFXSlider = false;
+int tickRate = DEFAULT_TICK_RATE;
+SteeringKernelType steeringKernel = STEER_SCALAR;
+bool audioEnabled = false;
+
+// Trạng thái phím di chuyển; cửa sổ đọc từ bàn phím, chế độ headless do bot điền.
+struct InputState {
+    bool up, down, left, right;
+};
+
+InputState input = { false, false, false, false };
+
+enum InputKey : Uint8 { KEY_UP = 1, KEY_DOWN = 2, KEY_LEFT = 4, KEY_RIGHT = 8 };
+
+// Mọi thao tác làm thay đổi mô phỏng đi qua hàng đợi lệnh và được áp dụng ở đầu tick kế tiếp,
+// nhờ vậy một tick được mô tả đầy đủ bởi phím đang giữ cộng danh sách lệnh.
+enum GameCommand : Uint8 {
+    CMD_SHOOT, CMD_START_GAME, CMD_PAUSE, CMD_RESUME, CMD_OPEN_SETTINGS, CMD_CLOSE_SETTINGS,
+    CMD_UPGRADE_1, CMD_UPGRADE_2, CMD_UPGRADE_3, CMD_UPGRADE_4
+};
+
+std::vector<Uint8> pendingCommands;
+std::vector<Uint8> tickCommands;
+
+// PCG32: mỗi hệ thống một luồng riêng để thêm/bớt lượt rút ở hệ này không làm lệch hệ khác.
+struct Rng {
+    Uint64 state;
+    Uint64 increment;
+
+    void seed(Uint64 seedValue, Uint64 stream) {
+        state = 0;
+        increment = (stream << 1) | 1;
+        next();
+        state += seedValue;
+        next();
+    }
+
+    Uint32 next() {
+        Uint64 old = state;
+        state = old * 6364136223846793005ull + increment;
+        Uint32 xorShifted = static_cast<Uint32>(((old >> 18) ^ old) >> 27);
+        Uint32 rot = static_cast<Uint32>(old >> 59);
+        return (xorShifted >> rot) | (xorShifted << ((32 - rot) & 31));
+    }
+
+    // Số thực trong (0, 1), không bao giờ bằng 0 để an toàn khi lấy log.
+    float unit() {
+        return ((next() >> 8) + 0.5f) / 16777216.0f;
+    }
+
+    int below(int n) {
+        return static_cast<int>((static_cast<Uint64>(next()) * static_cast<Uint32>(n)) >> 32);
+    }
+};
+
+Rng spawnRng;
+Rng particleRng;
+Rng mapRng;
+
+std::ofstream recordFile;
+std::ifstream replayFile;
+Uint64 simTick = 0;
+
+struct HeadlessResult {
+    Uint64 ticks;
+    double simSeconds;
+    double wallSeconds;
+    int runs;
+    int bestScore;
+    int bestLevel;
+};
+
+int scaledSize(int source, int displaySize) {
+    return scaledSize(source, displaySize, textureQuality);
+}
+
+// File archive được map vào bộ nhớ: ảnh trở thành SDL_Surface trỏ thẳng vào vùng map, âm thanh thành
+// Mix_Chunk trỏ vào PCM, nên khi khởi động không phải giải nén PNG/WAV. Chỉ đọc sau open(), các luồng
+// nạp tra cứu song song được. Phải đóng sau khi mọi chunk, nhạc và font đã được giải phóng.
+struct AssetArchive {
+    const Uint8* data = nullptr;
+    size_t size = 0;
+    TextureQuality quality = QUALITY_MEDIUM;
+    std::unordered_map<std::string, const ArchiveEntry*> entries;
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = nullptr;
+#endif
+
+    bool open(const std::string& path) {
+#ifdef _WIN32
+        file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE) return false;
+        LARGE_INTEGER fileSize;
+        if (GetFileSizeEx(file, &fileSize) && fileSize.QuadPart > 0) {
+            size = static_cast<size_t>(fileSize.QuadPart);
+            mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            if (mapping) data = static_cast<const Uint8*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+        }
+#else
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        struct stat info;
+        if (fstat(fd, &info) == 0 && info.st_size > 0) {
+            size = static_cast<size_t>(info.st_size);
+            void* mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapped != MAP_FAILED) data = static_cast<const Uint8*>(mapped);
+        }
+        ::close(fd);
+#endif
+        if (!data) {
+            std::cout << "ERROR: Failed to map asset archive: " << path << std::endl;
+            close();
+            return false;
+        }
+
+        ArchiveHeader header;
+        if (size < sizeof(header)) return fail(path);
+        std::memcpy(&header, data, sizeof(header));
+        if (header.magic != ARCHIVE_MAGIC || header.version != ARCHIVE_VERSION || header.quality > QUALITY_HIGH) return fail(path);
+        if (header.entryCount > (size - sizeof(header)) / sizeof(ArchiveEntry)) return fail(path);
+        const ArchiveEntry* table = reinterpret_cast<const ArchiveEntry*>(data + sizeof(header));
+        for (Uint32 i = 0; i < header.entryCount; i++) {
+            const ArchiveEntry& entry = table[i];
+            if (entry.offset > size || entry.size > size - entry.offset) return fail(path);
+            if (std::memchr(entry.path, 0, ARCHIVE_PATH_SIZE) == nullptr) return fail(path);
+            if (entry.type == ARCHIVE_PIXELS && static_cast<Uint64>(entry.pitch) * entry.height > entry.size) return fail(path);
+            entries[entry.path] = &entry;
+        }
+        quality = static_cast<TextureQuality>(header.quality);
+        return true;
+    }
+
+    bool fail(const std::string& path) {
+        std::cout << "ERROR: Invalid asset archive: " << path << std::endl;
+        close();
+        return false;
+    }
+
+    void close() {
+#ifdef _WIN32
+        if (data) UnmapViewOfFile(data);
+        if (mapping) CloseHandle(mapping);
+        if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+        mapping = nullptr;
+        file = INVALID_HANDLE_VALUE;
+#else
+        if (data) munmap(const_cast<Uint8*>(data), size);
+#endif
+        data = nullptr;
+        size = 0;
+        entries.clear();
+    }
+
+    const ArchiveEntry* find(const std::string& path, ArchiveEntryType type) const {
+        if (!data) return nullptr;
+        auto it = entries.find(normalizeAssetPath(path));
+        return (it != entries.end() && it->second->type == type) ? it->second : nullptr;
+    }
+
+    const Uint8* blob(const ArchiveEntry& entry) const { return data + entry.offset; }
+};
+
+AssetArchive archive;
+
+SDL_Texture* createTexture(SDL_Surface* surface) {
+    SDL_Texture* texture = SDL_CreateTextureFromSurface(renderer, surface);
+    if (texture) textureMemoryBytes += static_cast<size_t>(surface->w) * surface->h * 4;
+    return texture;
+}
+
+SDL_Surface* loadSurface(const std::string& path) {
+    if (const ArchiveEntry* entry = archive.find(path, ARCHIVE_PIXELS)) {
+        sourceImageBytes += static_cast<size_t>(entry->width) * entry->height * 4;
+        // Trỏ thẳng vào vùng map chỉ đọc; SDL_FreeSurface không giải phóng pixel của surface kiểu này.
+        SDL_Surface* mapped = SDL_CreateRGBSurfaceWithFormatFrom(const_cast<Uint8*>(archive.blob(*entry)), entry->width, entry->height, 32, entry->pitch, SDL_PIXELFORMAT_ARGB8888);
+        if (!mapped) std::cout << "ERROR: Failed to wrap archived image: " << path << " - " << SDL_GetError() << std::endl;
+        return mapped;
+    }
+    SDL_Surface* loaded = IMG_Load(path.c_str());
+    if (!loaded) {
+        std::cout << "ERROR: Failed to load image: " << path << " - " << IMG_GetError() << std::endl;
+        return nullptr;
+    }
+    sourceImageBytes += static_cast<size_t>(loaded->w) * loaded->h * 4;
+    SDL_Surface* converted = SDL_ConvertSurfaceFormat(loaded, SDL_PIXELFORMAT_ARGB8888, 0);
+    SDL_FreeSurface(loaded);
+    if (!converted) std::cout << "ERROR: Failed to convert image: " << path << " - " << SDL_GetError() << std::endl;
+    return converted;
+}
+
+// PCM trong archive chỉ dùng được khi thiết bị mở đúng định dạng packer đã chuyển sẵn.
+Mix_Chunk* loadSound(const std::string& path) {
+    if (const ArchiveEntry* entry = archive.find(path, ARCHIVE_PCM)) {
+        int frequency = 0, channels = 0;
+        Uint16 format = 0;
+        Mix_QuerySpec(&frequency, &format, &channels);
+        if (entry->audioFrequency == static_cast<Uint32>(frequency) && entry->audioFormat == format && entry->audioChannels == channels) {
+            return Mix_QuickLoad_RAW(const_cast<Uint8*>(archive.blob(*entry)), static_cast<Uint32>(entry->size));
+        }
+    }
+    Mix_Chunk* chunk = Mix_LoadWAV(path.c_str());
+    if (!chunk) std::cout << "ERROR: Failed to load sound: " << path << " - " << Mix_GetError() << std::endl;
+    return chunk;
+}
+
+// Font và nhạc: đọc từ archive nếu có, không thì từ file rời.
+SDL_RWops* openAssetStream(const std::string& path) {
+    if (const ArchiveEntry* entry = archive.find(path, ARCHIVE_RAW)) {
+        return SDL_RWFromConstMem(archive.blob(*entry), static_cast<int>(entry->size));
+    }
+    return SDL_RWFromFile(path.c_str(), "rb");
+}
+
+// Hình chữ nhật nhỏ nhất trong region chứa pixel có alpha khác 0 (w = 0 nếu trong suốt hoàn toàn).
+SDL_Rect opaqueBounds(SDL_Surface* surface, const SDL_Rect& region) {
+    int minX = region.x + region.w, minY = region.y + region.h, maxX = region.x - 1, maxY = region.y - 1;
+    for (int y = region.y; y < region.y + region.h; y++) {
+        const Uint32* row = reinterpret_cast<const Uint32*>(static_cast<const Uint8*>(surface->pixels) + y * surface->pitch);
+        for (int x = region.x; x < region.x + region.w; x++) {
+            if ((row[x] >> 24) == 0) continue;
+            minX = std::min(minX, x);
+            maxX = std::max(maxX, x);
+            minY = std::min(minY, y);
+            maxY = std::max(maxY, y);
+        }
+    }
+    if (maxX < minX) return { 0, 0, 0, 0 };
+    return { minX, minY, maxX - minX + 1, maxY - minY + 1 };
+}
+
+// Thu nhỏ region về frameWidth x frameHeight, cắt viền trong suốt rồi thêm vào out;
+// chỉ làm việc trên surface nên chạy được trên luồng nạp.
+void prepareAtlasFrame(Animation& anim, size_t frame, int frameWidth, int frameHeight, SDL_Surface* source, const SDL_Rect& region, std::vector<AtlasEntry>& out) {
+    SDL_Surface* scaled = nullptr;
+    SDL_Rect area = region;
+    if (frameWidth != region.w || frameHeight != region.h) {
+        scaled = resampleSurface(source, region, frameWidth, frameHeight);
+        if (!scaled) return;
+        source = scaled;
+        area = { 0, 0, frameWidth, frameHeight };
+    }
+
+    SDL_Rect bounds = opaqueBounds(source, area);
+    SDL_Surface* trimmed = nullptr;
+    if (bounds.w > 0) trimmed = SDL_CreateRGBSurfaceWithFormat(0, bounds.w, bounds.h, 32, SDL_PIXELFORMAT_ARGB8888);
+    if (trimmed) {
+        SDL_SetSurfaceBlendMode(source, SDL_BLENDMODE_NONE);
+        SDL_BlitSurface(source, &bounds, trimmed, nullptr);
+        out.push_back({ trimmed, &anim, frame, { bounds.x - area.x, bounds.y - area.y, bounds.w, bounds.h } });
+    }
+    if (scaled) SDL_FreeSurface(scaled);
+}
+
+// Nạp ảnh đơn và thu nhỏ về tối đa displayW x displayH (theo mức chất lượng), chưa tạo texture.
+SDL_Surface* loadScaledSurface(const std::string& path, int displayW, int displayH) {
+    SDL_Surface* surface = loadSurface(path);
+    if (!surface) return nullptr;
+    int w = scaledSize(surface->w, displayW);
+    int h = scaledSize(surface->h, displayH);
+    if (w != surface->w || h != surface->h) {
+        SDL_Surface* scaled = resampleSurface(surface, { 0, 0, surface->w, surface->h }, w, h);
+        if (scaled) {
+            SDL_FreeSurface(surface);
+            surface = scaled;
+        }
+    }
+    return surface;
+}
+
+// Số frame và thời gian frame của clip, đủ cho mô phỏng khi không nạp texture.
+void defineAnimation(Animation& anim, int frameCount, float frameTime) {
+    anim.frameTime = frameTime;
+    anim.currentFrame = 0;
+    anim.elapsedTime = 0.0f;
+    anim.flip = SDL_FLIP_NONE;
+    anim.frameWidth = 0;
+    anim.frameHeight = 0;
+    anim.pendingTasks = 0;
+    anim.pendingFrames = 0;
+    anim.loaded = false;
+    anim.textures.assign(frameCount, nullptr);
+    anim.frames.assign(frameCount, { 0, 0, 0, 0 });
+    anim.trims.assign(frameCount, { 0, 0, 0, 0 });
+}
+
+int atlasPageSize() {
+    int pageSize = ATLAS_PAGE_SIZE;
+    SDL_RendererInfo info;
+    if (SDL_GetRendererInfo(renderer, &info) == 0 && info.max_texture_width > 0 && info.max_texture_height > 0) {
+        pageSize = std::min(pageSize, std::min(info.max_texture_width, info.max_texture_height));
+    }
+    return pageSize;
+}
+
+PendingAtlasPage* openAtlasPage() {
+    for (PendingAtlasPage& page : pendingAtlasPages) if (!page.closed) return &page;
+    return nullptr;
+}
+
+PendingAtlasPage* addAtlasPage(int w, int h) {
+    SDL_Surface* surface = SDL_CreateRGBSurfaceWithFormat(0, w, h, 32, SDL_PIXELFORMAT_ARGB8888);
+    SDL_Texture* texture = surface ? SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STATIC, w, h) : nullptr;
+    if (!texture) {
+        std::cout << "ERROR: Failed to allocate atlas page - " << SDL_GetError() << std::endl;
+        if (surface) SDL_FreeSurface(surface);
+        return nullptr;
+    }
+    SDL_FillRect(surface, nullptr, 0);
+    SDL_SetTextureBlendMode(texture, SDL_BLENDMODE_BLEND);
+    textureMemoryBytes += static_cast<size_t>(w) * h * 4;
+    atlasPages.push_back(texture);
+    pendingAtlasPages.push_back({ surface, texture, 0, 0, 0, 0, false, {} });
+    return &pendingAtlasPages.back();
+}
+
+// Frame đã upload (hoặc bị bỏ vì lỗi); clip hết placeholder khi đã nhận mọi file và upload mọi frame.
+void finishAtlasFrame(Animation& anim) {
+    if (--anim.pendingFrames == 0 && anim.pendingTasks == 0) anim.loaded = true;
+}
+
+// Xếp một frame vào trang đang mở, hết chỗ thì đóng trang đó và mở trang mới.
+void packAtlasEntry(const AtlasEntry& entry) {
+    const int pageSize = atlasPageSize();
+    int w = entry.surface->w;
+    int h = entry.surface->h;
+    PendingAtlasPage* page = nullptr;
+    SDL_Rect dst = { 0, 0, w, h };
+    if (w > pageSize || h > pageSize) {
+        // Frame lớn hơn cả một trang: trang riêng, không làm đóng trang đang mở.
+        page = addAtlasPage(w, h);
+        if (page) {
+            page->shelfH = h;
+            page->closed = true;
+        }
+    }
+    else {
+        page = openAtlasPage();
+        if (page && page->shelfX + w > pageSize) {
+            page->shelfY += page->shelfH + ATLAS_PADDING;
+            page->shelfX = 0;
+            page->shelfH = 0;
+        }
+        if (page && page->shelfY + h > pageSize) {
+            page->closed = true;
+            page = nullptr;
+        }
+        if (!page) page = addAtlasPage(pageSize, pageSize);
+        if (page) {
+            dst = { page->shelfX, page->shelfY, w, h };
+            page->shelfX += w + ATLAS_PADDING;
+            page->shelfH = std::max(page->shelfH, h);
+        }
+    }
+    if (page) {
+        SDL_SetSurfaceBlendMode(entry.surface, SDL_BLENDMODE_NONE);
+        SDL_BlitSurface(entry.surface, nullptr, page->surface, &dst);
+        entry.anim->frames[entry.frame] = dst;
+        page->entries.push_back(entry);
+    }
+    else {
+        finishAtlasFrame(*entry.anim);
+    }
+    SDL_FreeSurface(entry.surface);
+}
+
+// Upload tối đa ATLAS_UPLOAD_ROWS hàng đã xếp xong của trang đầu tiên còn hàng chờ (trang đang mở thì chỉ
+// tới đầu kệ đang xếp dở); frame nằm trọn trong phần đã upload thì có texture. false khi không còn gì để upload.
+bool uploadAtlasRows() {
+    for (size_t i = 0; i < pendingAtlasPages.size();) {
+        PendingAtlasPage& page = pendingAtlasPages[i];
+        int readyHeight = page.closed ? std::min(page.shelfY + page.shelfH, page.surface->h) : page.shelfY;
+        if (page.uploadedHeight < readyHeight) {
+            SDL_Rect band = { 0, page.uploadedHeight, page.surface->w, std::min(ATLAS_UPLOAD_ROWS, readyHeight - page.uploadedHeight) };
+            const Uint8* pixels = static_cast<const Uint8*>(page.surface->pixels) + band.y * page.surface->pitch;
+            if (SDL_UpdateTexture(page.texture, &band, pixels, page.surface->pitch) != 0) {
+                std::cout << "ERROR: Failed to upload atlas page - " << SDL_GetError() << std::endl;
+            }
+            page.uploadedHeight += band.h;
+            size_t kept = 0;
+            for (const AtlasEntry& entry : page.entries) {
+                const SDL_Rect& rect = entry.anim->frames[entry.frame];
+                if (rect.y + rect.h <= page.uploadedHeight) {
+                    entry.anim->textures[entry.frame] = page.texture;
+                    finishAtlasFrame(*entry.anim);
+                }
+                else {
+                    page.entries[kept++] = entry;
+                }
+            }
+            page.entries.resize(kept);
+            return true;
+        }
+        if (page.closed) {
+            SDL_FreeSurface(page.surface);
+            pendingAtlasPages.erase(pendingAtlasPages.begin() + i);
+        }
+        else {
+            i++;
+        }
+    }
+    return false;
+}
+
+// Một file cần nạp: sprite sheet, một frame rời của clip, ảnh đơn hoặc âm thanh.
+struct AssetTask {
+    AssetKind kind;
+    std::string path;
+    Animation* anim;
+    int frame;
+    int frameCount;
+    SDL_Texture** texture;
+    int displayW, displayH;
+    Mix_Chunk** sound;
+};
+
+struct LoadedAsset {
+    size_t task;
+    SDL_Surface* surface;
+    Mix_Chunk* sound;
+    std::vector<AtlasEntry> entries;
+    int frameWidth, frameHeight;
+};
+
+// Giải mã PNG/WAV trên các luồng nạp riêng; luồng chính nhận kết quả trong pump() và chỉ ở đó mới
+// tạo texture, gán con trỏ tài nguyên, xếp từng frame vào atlas và upload từng dải trang, trong giới hạn
+// thời gian mỗi frame.
+// pump() chạy khi luồng mô phỏng đang chờ nên việc gán con trỏ âm thanh không bị đua với mô phỏng.
+struct AssetLoader {
+    std::vector<AssetTask> tasks;
+    std::vector<std::thread> threads;
+    std::atomic<size_t> nextTask{ 0 };
+    std::atomic<bool> cancelled{ false };
+    std::mutex mutex;
+    std::vector<LoadedAsset> ready;
+    std::vector<LoadedAsset> received;
+    size_t delivered = 0;
+    size_t packed = 0;
+    size_t framesReceived = 0;
+    bool finished = true;
+    Uint64 startCounter = 0;
+
+    void start(int threadCount) {
+        finished = tasks.empty();
+        startCounter = SDL_GetPerformanceCounter();
+        threadCount = std::max(1, std::min(threadCount, MAX_ASSET_THREADS));
+        for (int i = 0; i < threadCount; i++) threads.emplace_back(&AssetLoader::workerLoop, this);
+    }
+
+    void workerLoop() {
+        PROFILE_THREAD("Asset loader");
+        trackAllocations = false;
+        while (!cancelled.load()) {
+            size_t index = nextTask.fetch_add(1);
+            if (index >= tasks.size()) return;
+            LoadedAsset result = decode(index);
+            std::lock_guard<std::mutex> lock(mutex);
+            ready.push_back(std::move(result));
+        }
+    }
+
+    LoadedAsset decode(size_t index) {
+        PROFILE_ZONE("decodeAsset");
+        const AssetTask& task = tasks[index];
+        LoadedAsset result = { index, nullptr, nullptr, {}, 0, 0 };
+        switch (task.kind) {
+        case ASSET_SHEET: {
+            SDL_Surface* sheet = loadSurface(task.path);
+            if (!sheet) break;
+            int sourceWidth = sheet->w / task.frameCount;
+            int sourceHeight = sheet->h;
+            result.frameWidth = scaledSize(sourceWidth, task.displayW);
+            result.frameHeight = scaledSize(sourceHeight, task.displayH);
+            for (int i = 0; i < task.frameCount; i++) {
+                prepareAtlasFrame(*task.anim, i, result.frameWidth, result.frameHeight, sheet, { i * sourceWidth, 0, sourceWidth, sourceHeight }, result.entries);
+            }
+            SDL_FreeSurface(sheet);
+            break;
+        }
+        case ASSET_FRAME: {
+            SDL_Surface* frameSurface = loadSurface(task.path);
+            if (!frameSurface) break;
+            result.frameWidth = scaledSize(frameSurface->w, task.displayW);
+            result.frameHeight = scaledSize(frameSurface->h, task.displayH);
+            prepareAtlasFrame(*task.anim, task.frame, result.frameWidth, result.frameHeight, frameSurface, { 0, 0, frameSurface->w, frameSurface->h }, result.entries);
+            SDL_FreeSurface(frameSurface);
+            break;
+        }
+        case ASSET_TEXTURE:
+            result.surface = loadScaledSurface(task.path, task.displayW, task.displayH);
+            break;
+        case ASSET_SOUND:
+            result.sound = loadSound(task.path);
+            break;
+        case ASSET_MUSIC:
+        case ASSET_FONT:
+            // nạp đồng bộ trong init()
+            break;
+        }
+        return result;
+    }
+
+    // Luồng chính: mỗi bước nhận một kết quả giải mã, xếp một frame vào atlas hoặc upload một dải trang,
+    // kiểm tra budget trước mỗi bước. Luôn làm ít nhất một bước.
+    void pump(double budget) {
+        if (finished) return;
+        PROFILE_ZONE("uploadAssets");
+        const Uint64 frequency = SDL_GetPerformanceFrequency();
+        const Uint64 begin = SDL_GetPerformanceCounter();
+        auto overBudget = [&]() { return static_cast<double>(SDL_GetPerformanceCounter() - begin) / frequency > budget; };
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (LoadedAsset& asset : ready) received.push_back(std::move(asset));
+            ready.clear();
+        }
+        size_t consumed = 0;
+        for (bool first = true; first || !overBudget(); first = false) {
+            if (consumed < received.size()) {
+                apply(received[consumed++]);
+            }
+            else if (packed < atlasEntries.size()) {
+                packAtlasEntry(atlasEntries[packed++]);
+            }
+            else if (!uploadAtlasRows()) {
+                // Hết file chờ giải mã thì đóng trang đang mở để upload nốt kệ cuối.
+                PendingAtlasPage* page = delivered == tasks.size() ? openAtlasPage() : nullptr;
+                if (!page) break;
+                page->closed = true;
+            }
+        }
+        received.erase(received.begin(), received.begin() + consumed);
+        if (packed == atlasEntries.size()) {
+            atlasEntries.clear();
+            packed = 0;
+        }
+
+        if (delivered == tasks.size() && atlasEntries.empty() && pendingAtlasPages.empty()) {
+            finished = true;
+            join();
+            double seconds = static_cast<double>(SDL_GetPerformanceCounter() - startCounter) / frequency;
+            std::cout << "Assets loaded in " << seconds * 1000.0 << " ms. Texture memory: " << textureMemoryBytes / (1024.0 * 1024.0)
+                << " MB (decoded sources: " << sourceImageBytes / (1024.0 * 1024.0) << " MB)" << std::endl;
+        }
+    }
+
+    void apply(LoadedAsset& asset) {
+        const AssetTask& task = tasks[asset.task];
+        delivered++;
+        if (task.anim) {
+            if (asset.frameWidth > 0) {
+                task.anim->frameWidth = asset.frameWidth;
+                task.anim->frameHeight = asset.frameHeight;
+            }
+            for (const AtlasEntry& entry : asset.entries) {
+                entry.anim->trims[entry.frame] = entry.trim;
+                entry.anim->pendingFrames++;
+                atlasEntries.push_back(entry);
+            }
+            framesReceived += asset.entries.size();
+            // Frame trong suốt hoàn toàn không vào atlas, clip có thể xong ngay ở đây.
+            if (--task.anim->pendingTasks == 0 && task.anim->pendingFrames == 0) task.anim->loaded = true;
+        }
+        if (asset.surface) {
+            *task.texture = createTexture(asset.surface);
+            if (!*task.texture) std::cout << "ERROR: Failed to create texture: " << task.path << " - " << SDL_GetError() << std::endl;
+            SDL_FreeSurface(asset.surface);
+        }
+        if (asset.sound) {
+            Mix_VolumeChunk(asset.sound, sfxVolume);
+            *task.sound = asset.sound;
+        }
+    }
+
+    // Mỗi file giải mã xong và mỗi frame atlas đã upload là một bước.
+    float progress() const {
+        size_t framesWaiting = 0;
+        for (const AnimationSpec& spec : animationSpecs) framesWaiting += spec.anim->pendingFrames;
+        return static_cast<float>(delivered + framesReceived - framesWaiting) / std::max<size_t>(1, tasks.size() + framesReceived);
+    }
+
+    void join() {
+        for (std::thread& thread : threads) thread.join();
+        threads.clear();
+    }
+
+    // Hủy khi thoát giữa chừng: chờ các luồng xong file đang giải mã rồi giải phóng kết quả chưa dùng.
+    void stop() {
+        cancelled = true;
+        join();
+        for (LoadedAsset& asset : ready) received.push_back(std::move(asset));
+        ready.clear();
+        for (LoadedAsset& asset : received) {
+            if (asset.surface) SDL_FreeSurface(asset.surface);
+            if (asset.sound) Mix_FreeChunk(asset.sound);
+            for (AtlasEntry& entry : asset.entries) SDL_FreeSurface(entry.surface);
+        }
+        received.clear();
+        for (size_t i = packed; i < atlasEntries.size(); i++) SDL_FreeSurface(atlasEntries[i].surface);
+        atlasEntries.clear();
+        packed = 0;
+        for (PendingAtlasPage& page : pendingAtlasPages) SDL_FreeSurface(page.surface);
+        pendingAtlasPages.clear();
+        finished = true;
+    }
+
+    // Sheet là một task; clip gồm các file frame rời thì mỗi file một task.
+    void addClip(const AnimationSpec& spec) {
+        const ManifestEntry& entry = ASSET_MANIFEST[spec.asset];
+        spec.anim->pendingTasks = entry.kind == ASSET_SHEET ? 1 : entry.frameCount;
+        if (entry.kind == ASSET_SHEET) {
+            tasks.push_back({ ASSET_SHEET, entry.path, spec.anim, 0, entry.frameCount, nullptr, entry.displayW, entry.displayH, nullptr });
+            return;
+        }
+        for (int i = 0; i < entry.frameCount; i++) {
+            tasks.push_back({ ASSET_FRAME, manifestFilePath(entry, i), spec.anim, i, entry.frameCount, nullptr, entry.displayW, entry.displayH, nullptr });
+        }
+    }
+
+    void addTexture(SDL_Texture** texture, ManifestId asset) {
+        const ManifestEntry& entry = ASSET_MANIFEST[asset];
+        tasks.push_back({ ASSET_TEXTURE, entry.path, nullptr, 0, 0, texture, entry.displayW, entry.displayH, nullptr });
+    }
+
+    void addSound(Mix_Chunk** sound, ManifestId asset) {
+        tasks.push_back({ ASSET_SOUND, ASSET_MANIFEST[asset].path, nullptr, 0, 0, nullptr, 0, 0, sound });
+    }
+};
+
+AssetLoader assets;
+
+// Nền map được nạp theo nhu cầu: chỉ giữ map đang chơi và map kế tiếp, map khác bị giải phóng.
+// Một luồng nền giải mã, luồng chính chỉ tạo texture trong update().
+struct MapStreamer {
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::vector<int> requests;
+    std::vector<std::pair<int, SDL_Surface*>> decoded;
+    bool quit = false;
+    // chỉ luồng chính dùng
+    bool pending[NUM_MAPS] = {};
+    bool failed[NUM_MAPS] = {};
+
+    void start() {
+        quit = false;
+        thread = std::thread(&MapStreamer::workerLoop, this);
+    }
+
+    void workerLoop() {
+        PROFILE_THREAD("Map streamer");
+        trackAllocations = false;
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            wake.wait(lock, [this] { return quit || !requests.empty(); });
+            if (quit) return;
+            int map = requests.front();
+            requests.erase(requests.begin());
+            lock.unlock();
+            const ManifestEntry& entry = ASSET_MANIFEST[MANIFEST_MAP1 + map];
+            PROFILE_ZONE("decodeMap");
+            SDL_Surface* surface = loadScaledSurface(entry.path, entry.displayW, entry.displayH);
+            lock.lock();
+            decoded.push_back({ map, surface });
+        }
+    }
+
+    void update(int current, int next) {
+        PROFILE_ZONE("streamMaps");
+        bool wanted[NUM_MAPS] = {};
+        if (current >= 0 && current < NUM_MAPS) wanted[current] = true;
+        if (next >= 0 && next < NUM_MAPS) wanted[next] = true;
+
+        std::vector<std::pair<int, SDL_Surface*>> ready;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            ready.swap(decoded);
+        }
+        for (auto& item : ready) {
+            int map = item.first;
+            pending[map] = false;
+            if (!item.second) {
+                failed[map] = true;
+                continue;
+            }
+            if (wanted[map] && !maps[map]) maps[map] = createTexture(item.second);
+            SDL_FreeSurface(item.second);
+        }
+
+        for (int i = 0; i < NUM_MAPS; i++) {
+            if (!wanted[i] && maps[i]) {
+                int w = 0, h = 0;
+                SDL_QueryTexture(maps[i], nullptr, nullptr, &w, &h);
+                textureMemoryBytes -= static_cast<size_t>(w) * h * 4;
+                SDL_DestroyTexture(maps[i]);
+                maps[i] = nullptr;
+            }
+        }
+
+        // Map đang chơi xin nạp trước map kế tiếp.
+        const int order[2] = { current, next };
+        for (int map : order) {
+            if (map < 0 || map >= NUM_MAPS || maps[map] || pending[map] || failed[map]) continue;
+            pending[map] = true;
+            std::lock_guard<std::mutex> lock(mutex);
+            requests.push_back(map);
+            wake.notify_one();
+        }
+    }
+
+    void stop() {
+        if (!thread.joinable()) return;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            quit = true;
+            requests.clear();
+        }
+        wake.notify_one();
+        thread.join();
+        for (auto& item : decoded) if (item.second) SDL_FreeSurface(item.second);
+        decoded.clear();
+    }
+};
+
+MapStreamer mapStreamer;
+
+// Frame của clip sau elapsed giây, tính trực tiếp từ thời gian thay vì cộng dồn.
+size_t clipFrame(const Animation& clip, float elapsed, bool loop) {
+    if (clip.frames.empty() || clip.frameTime <= 0.0f) return 0;
+    size_t frame = static_cast<size_t>(std::max(elapsed, 0.0f) / clip.frameTime);
+    if (loop) return frame % clip.frames.size();
+    return std::min(frame, clip.frames.size() - 1);
+}
+
+// Thời gian để clip không lặp chạy tới frame cuối.
+float clipDuration(const Animation& clip) {
+    if (clip.frames.empty()) return 0.0f;
+    return (clip.frames.size() - 1) * clip.frameTime;
+}
+
+void updateAnimation(Animation& anim, float deltaTime, bool loop = true) {
+    anim.elapsedTime += deltaTime;
+    while (anim.elapsedTime >= anim.frameTime) {
+        anim.elapsedTime -= anim.frameTime;
+        anim.currentFrame++;
+        if (loop) {
+            anim.currentFrame %= anim.frames.size();
+        }
+        else if (anim.currentFrame >= anim.frames.size()) {
+            anim.currentFrame = anim.frames.size() - 1;
+        }
+    }
+}
+
+// Xếp các glyph theo hàng (shelf) vào một surface rồi tải lên một lần.
+bool buildGlyphAtlas(GlyphAtlas& atlas, TTF_Font* ttf) {
+    atlas.font = ttf;
+    SDL_Surface* rendered[LAST_GLYPH - FIRST_GLYPH + 1] = {};
+    int penX = 0, penY = 0, rowHeight = 0;
+    for (int ch = FIRST_GLYPH; ch <= LAST_GLYPH; ch++) {
+        Glyph& glyph = atlas.glyphs[ch - FIRST_GLYPH];
+        glyph = { { 0, 0, 0, 0 }, 0 };
+        int minX, maxX, minY, maxY;
+        TTF_GlyphMetrics(ttf, static_cast<Uint16>(ch), &minX, &maxX, &minY, &maxY, &glyph.advance);
+        SDL_Surface* surface = TTF_RenderGlyph_Blended(ttf, static_cast<Uint16>(ch), { 255, 255, 255, 255 });
+        if (!surface) continue;
+        if (penX + surface->w > GLYPH_ATLAS_WIDTH) {
+            penX = 0;
+            penY += rowHeight + ATLAS_PADDING;
+            rowHeight = 0;
+        }
+        glyph.src = { penX, penY, surface->w, surface->h };
+        penX += surface->w + ATLAS_PADDING;
+        rowHeight = std::max(rowHeight, surface->h);
+        rendered[ch - FIRST_GLYPH] = surface;
+    }
+
+    atlas.width = GLYPH_ATLAS_WIDTH;
+    atlas.height = penY + rowHeight;
+    SDL_Surface* page = SDL_CreateRGBSurfaceWithFormat(0, atlas.width, std::max(atlas.height, 1), 32, SDL_PIXELFORMAT_ARGB8888);
+    if (page) {
+        SDL_FillRect(page, nullptr, 0);
+        for (int i = 0; i <= LAST_GLYPH - FIRST_GLYPH; i++) {
+            if (!rendered[i]) continue;
+            SDL_SetSurfaceBlendMode(rendered[i], SDL_BLENDMODE_NONE);
+            SDL_BlitSurface(rendered[i], nullptr, page, &atlas.glyphs[i].src);
+        }
+        atlas.texture = createTexture(page);
+        if (atlas.texture) SDL_SetTextureBlendMode(atlas.texture, SDL_BLENDMODE_BLEND);
+        SDL_FreeSurface(page);
+    }
+    for (auto surface : rendered) if (surface) SDL_FreeSurface(surface);
+
+    if (!atlas.texture) {
+        std::cout << "ERROR: Failed to build glyph atlas - " << SDL_GetError() << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Dựng quad cho từng ký tự (ký tự ngoài ASCII in được hiển thị là '?'), có tính kerning giữa các cặp glyph.
+void layoutText(const GlyphAtlas& atlas, const char* text, TextLayout& layout) {
+    layout.vertices.clear();
+    layout.indices.clear();
+    layout.width = 0;
+    layout.height = TTF_FontHeight(atlas.font);
+    const float invW = 1.0f / atlas.width;
+    const float invH = 1.0f / atlas.height;
+    int penX = 0;
+    int previous = 0;
+    for (const char* c = text; *c; c++) {
+        int ch = static_cast<unsigned char>(*c);
+        if (ch < FIRST_GLYPH || ch > LAST_GLYPH) ch = '?';
+        if (previous) penX += TTF_GetFontKerningSizeGlyphs(atlas.font, static_cast<Uint16>(previous), static_cast<Uint16>(ch));
+        previous = ch;
+
+        const Glyph& glyph = atlas.glyphs[ch - FIRST_GLYPH];
+        if (glyph.src.w > 0) {
+            float x0 = static_cast<float>(penX), x1 = x0 + glyph.src.w;
+            float y0 = 0.0f, y1 = static_cast<float>(glyph.src.h);
+            float u0 = glyph.src.x * invW, u1 = (glyph.src.x + glyph.src.w) * invW;
+            float v0 = glyph.src.y * invH, v1 = (glyph.src.y + glyph.src.h) * invH;
+            int base = static_cast<int>(layout.vertices.size());
+            SDL_Color white = { 255, 255, 255, 255 };
+            layout.vertices.push_back({ { x0, y0 }, white, { u0, v0 } });
+            layout.vertices.push_back({ { x1, y0 }, white, { u1, v0 } });
+            layout.vertices.push_back({ { x1, y1 }, white, { u1, v1 } });
+            layout.vertices.push_back({ { x0, y1 }, white, { u0, v1 } });
+            const int quad[6] = { 0, 1, 2, 0, 2, 3 };
+            for (int k : quad) layout.indices.push_back(base + k);
+        }
+        penX += glyph.advance;
+        layout.width = std::max(layout.width, penX);
+    }
+}
+
+// Vẽ layout tại (x, y) bằng một lệnh SDL_RenderGeometry; đỉnh được chép vào bộ đệm dùng lại nên không cấp phát.
+void drawTextLayout(const GlyphAtlas& atlas, const TextLayout& layout, int x, int y, SDL_Color color) {
+    if (!atlas.texture || layout.indices.empty()) return;
+    std::vector<SDL_Vertex>& out = textVertices;
+    out.assign(layout.vertices.begin(), layout.vertices.end());
+    for (auto& v : out) {
+        v.position.x += x;
+        v.position.y += y;
+        v.color = color;
+    }
+    renderGeometry(atlas.texture, out.data(), static_cast<int>(out.size()),
+        layout.indices.data(), static_cast<int>(layout.indices.size()));
+}
+
+// Chuỗi thay đổi theo khung hình (điểm, combo...): layout lại vào bộ đệm tạm; chuỗi thường lấy từ frameArena.
+void renderText(const char* text, int x, int y, SDL_Color color = { 255, 255, 255 }, bool useTitleFont = false) {
+    PROFILE_ZONE("renderText");
+    const GlyphAtlas& atlas = useTitleFont ? titleAtlas : textAtlas;
+    layoutText(atlas, text, dynamicText);
+    drawTextLayout(atlas, dynamicText, x, y, color);
+}
+
+// Khóa tra cache dùng lại giữa các lần gọi để không tạo std::string mới mỗi frame.
+std::string staticTextKey;
+
+// Chuỗi cố định (nhãn nút, tiêu đề): layout một lần rồi lấy lại từ cache.
+void renderStaticText(const char* text, int x, int y, SDL_Color color = { 255, 255, 255 }, bool useTitleFont = false) {
+    PROFILE_ZONE("renderText");
+    const GlyphAtlas& atlas = useTitleFont ? titleAtlas : textAtlas;
+    auto& cache = useTitleFont ? titleTextCache : textCache;
+    staticTextKey.assign(text);
+    auto it = cache.find(staticTextKey);
+    if (it == cache.end()) {
+        it = cache.emplace(staticTextKey, TextLayout()).first;
+        layoutText(atlas, text, it->second);
+    }
+    drawTextLayout(atlas, it->second, x, y, color);
+}
+
+// offscreen != nullptr: không mở cửa sổ và âm thanh, vẽ bằng renderer phần mềm vào surface (benchmark render).
+bool init(bool useArchive, SDL_Surface* offscreen = nullptr) {
+    PROFILE_ZONE("init");
+    if (SDL_Init(offscreen ? 0 : SDL_INIT_VIDEO | SDL_INIT_AUDIO) < 0) return false;
+    if ((IMG_Init(IMG_INIT_PNG | IMG_INIT_JPG) & (IMG_INIT_PNG | IMG_INIT_JPG)) != (IMG_INIT_PNG | IMG_INIT_JPG)) return false;
+    if (TTF_Init() == -1) return false;
+    if (offscreen) {
+        renderer = SDL_CreateSoftwareRenderer(offscreen);
+        if (!renderer) return false;
+    }
+    else {
+        if (Mix_OpenAudio(AUDIO_FREQUENCY, AUDIO_SAMPLE_FORMAT, AUDIO_CHANNELS, 512) < 0) return false;
+        audioEnabled = true;
+
+        window = SDL_CreateWindow("DodgeAndQ", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, SCREEN_WIDTH, SCREEN_HEIGHT, SDL_WINDOW_SHOWN);
+        if (!window) return false;
+
+        renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
+        if (!renderer) return false;
+    }
+
+    PROFILE_ZONE("initAssets");
+    if (useArchive && archive.open(DEFAULT_ARCHIVE_PATH)) {
+        std::cout << "Asset archive: " << DEFAULT_ARCHIVE_PATH << " (" << archive.entries.size() << " entries)" << std::endl;
+        if (qualityScale(archive.quality) < qualityScale(textureQuality)) {
+            std::cout << "WARNING: Asset archive was packed at a lower texture quality than requested" << std::endl;
+        }
+    }
+
+    font = TTF_OpenFontRW(openAssetStream(ASSET_MANIFEST[MANIFEST_FONT].path), 1, 24);
+    if (!font) return false;
+
+    titleFont = TTF_OpenFontRW(openAssetStream(ASSET_MANIFEST[MANIFEST_FONT].path), 1, 48); // Font lớn hơn cho tiêu đề
+    if (!titleFont) return false;
+
+    if (!buildGlyphAtlas(textAtlas, font) || !buildGlyphAtlas(titleAtlas, titleFont)) return false;
+
+    if (audioEnabled) {
+        gameMusic = Mix_LoadMUS_RW(openAssetStream(ASSET_MANIFEST[MANIFEST_MUSIC].path), 1);
+        if (gameMusic) Mix_VolumeMusic(musicVolume);
+    }
+
+    // Ảnh và âm thanh được nạp nền (xem AssetLoader); menu hiện ngay, thứ chưa nạp xong dùng placeholder.
+    assets.addTexture(&menuBackground, MANIFEST_MENU_BACKGROUND);
+    if (audioEnabled) {
+        assets.addSound(&clickSound, MANIFEST_SOUND_CLICK);
+        assets.addSound(&shootSound, MANIFEST_SOUND_SHOOT);
+        assets.addSound(&hurtSound, MANIFEST_SOUND_HURT);
+        assets.addSound(&deathSound, MANIFEST_SOUND_DEATH);
+        assets.addSound(&enemyAttackSound, MANIFEST_SOUND_ENEMY_ATTACK);
+        assets.addSound(&enemyDeathSound, MANIFEST_SOUND_ENEMY_DEATH);
+        assets.addSound(&spawnSound, MANIFEST_SOUND_SPAWN);
+        assets.addSound(&levelUpSound, MANIFEST_SOUND_LEVEL_UP);
+        assets.addSound(&upgradeSound, MANIFEST_SOUND_UPGRADE);
+    }
+    for (const AnimationSpec& spec : animationSpecs) {
+        defineAnimation(*spec.anim, ASSET_MANIFEST[spec.asset].frameCount, spec.frameTime);
+        assets.addClip(spec);
+    }
+    assets.addTexture(&projectileTexture, MANIFEST_PROJECTILE);
+    assets.start(SDL_GetCPUCount());
+    mapStreamer.start();
+
+    SDL_ShowCursor(SDL_ENABLE);
+    return true;
+}
+
+// Mô phỏng chỉ ghi lại âm thanh vào audioEvents (nó có thể chạy trên luồng khác); playAudioEvents
+// phát chúng trên luồng chính. Khi không mở thiết bị âm thanh (headless), mọi âm thanh bị bỏ qua.
+void playSound(Mix_Chunk* chunk) {
+    if (audioEnabled && chunk) audioEvents.sounds.push_back(chunk);
+}
+
+void keepMusicPlaying() {
+    if (audioEnabled) audioEvents.keepMusic = true;
+}
+
+void restartMusic() {
+    if (audioEnabled) audioEvents.restartMusic = true;
+}
+
+// Âm thanh giao diện phát ngay trên luồng chính.
+void playUiSound(Mix_Chunk* chunk) {
+    if (audioEnabled && chunk) Mix_PlayChannel(-1, chunk, 0);
+}
+
+void playAudioEvents(const AudioEvents& events) {
+    if (!audioEnabled) return;
+    if (events.restartMusic) {
+        Mix_HaltMusic();
+        if (gameMusic) Mix_PlayMusic(gameMusic, -1);
+    }
+    if (events.keepMusic && gameMusic && !Mix_PlayingMusic()) Mix_PlayMusic(gameMusic, -1);
+    for (Mix_Chunk* chunk : events.sounds) Mix_PlayChannel(-1, chunk, 0);
+}
+
+float randomUnit() {
+    return spawnRng.unit();
+}
+
+// Vùng spawn hợp lệ = khung spawn trừ hình vuông cạnh 2*MIN_SPAWN_DISTANCE quanh người chơi,
+// tách thành tối đa 4 dải chữ nhật. Chọn dải theo diện tích rồi lấy điểm đều trong dải,
+// nên mọi điểm đều cách người chơi >= MIN_SPAWN_DISTANCE và không cần vòng lặp thử lại.
+SDL_FPoint sampleSpawnPoint(float playerCenterX, float playerCenterY) {
+    const float areaW = static_cast<float>(SCREEN_WIDTH - PLAYER_SIZE);
+    const float areaH = static_cast<float>(SCREEN_HEIGHT - PLAYER_SIZE);
+    float ex0 = std::min(std::max(playerCenterX - MIN_SPAWN_DISTANCE, 0.0f), areaW);
+    float ex1 = std::min(std::max(playerCenterX + MIN_SPAWN_DISTANCE, 0.0f), areaW);
+    float ey0 = std::min(std::max(playerCenterY - MIN_SPAWN_DISTANCE, 0.0f), areaH);
+    float ey1 = std::min(std::max(playerCenterY + MIN_SPAWN_DISTANCE, 0.0f), areaH);
+
+    const SDL_FRect strips[4] = {
+        { 0.0f, 0.0f, ex0, areaH },
+        { ex1, 0.0f, areaW - ex1, areaH },
+        { ex0, 0.0f, ex1 - ex0, ey0 },
+        { ex0, ey1, ex1 - ex0, areaH - ey1 },
+    };
+    float total = 0.0f;
+    for (const SDL_FRect& strip : strips) total += strip.w * strip.h;
+    if (total <= 0.0f) {
+        return { playerCenterX < areaW / 2 ? areaW : 0.0f, playerCenterY < areaH / 2 ? areaH : 0.0f };
+    }
+
+    float pick = randomUnit() * total;
+    const SDL_FRect* chosen = &strips[3];
+    for (const SDL_FRect& strip : strips) {
+        float area = strip.w * strip.h;
+        if (area <= 0.0f) continue;
+        chosen = &strip;
+        if (pick < area) break;
+        pick -= area;
+    }
+    return { chosen->x + randomUnit() * chosen->w, chosen->y + randomUnit() * chosen->h };
+}
+
+void spawnEnemyMarker() {
+    SDL_FPoint spawnPos = sampleSpawnPoint(player.rect.x + player.rect.w / 2, player.rect.y + player.rect.h / 2);
+    markers.spawn({ spawnPos, SPAWN_DELAY, true });
+}
+
+// Spawn theo tiến trình Poisson: spawnRate cũ là "1/spawnRate mỗi frame ở 60 FPS",
+// quy đổi ra số enemy mỗi giây để không phụ thuộc vào tốc độ khung hình.
+float nextSpawnInterval() {
+    float spawnsPerSecond = SPAWN_REFERENCE_FPS / spawnRate;
+    return -std::log(randomUnit()) / spawnsPerSecond;
+}
+
+void updateSpawnDirector(float deltaTime) {
+    nextSpawnTimer -= deltaTime;
+    while (nextSpawnTimer <= 0.0f) {
+        if (enemies.size() + markers.size() < static_cast<size_t>(MAX_CONCURRENT_ENEMIES)) spawnEnemyMarker();
+        nextSpawnTimer += nextSpawnInterval();
+    }
+}
+
+void spawnEnemyAtMarker(const SDL_FPoint& pos) {
+    playSound(spawnSound);
+    EnemyType type = static_cast<EnemyType>(spawnRng.below(3));
+    int i = enemies.add(type, pos.x - PLAYER_SIZE / 2, pos.y - PLAYER_SIZE / 2, gameTime);
+    if (i < 0) return;
+    enemies.health[i] = (type == CHASER) ? 2 : 1;
+    switch (type) {
+    case BASIC: enemies.attackCooldown[i] = 1.0f; break;
+    case FAST: enemies.attackCooldown[i] = 0.5f; break;
+    case CHASER: enemies.attackCooldown[i] = 0.8f; break;
+    }
+}
+
+// Trả về handle của enemy gần nhất còn sống, INVALID_HANDLE nếu không có.
+Handle findNearestEnemy(float x, float y) {
+    int nearest = -1;
+    float minDist = FLT_MAX;
+    for (size_t i = 0; i < enemies.size(); i++) {
+        if (!enemies.active[i] || enemies.state[i] == DYING) continue;
+        float dx = enemies.centerX(i) - x;
+        float dy = enemies.centerY(i) - y;
+        float dist = std::sqrt(dx * dx + dy * dy);
+        if (dist < minDist) {
+            minDist = dist;
+            nearest = static_cast<int>(i);
+        }
+    }
+    return (nearest >= 0) ? enemies.handleAt(nearest) : INVALID_HANDLE;
+}
+
+void shootProjectile() {
+    if (!qReady) return;
+    playSound(shootSound);
+    GameObject proj;
+    proj.rect = { player.rect.x + player.rect.w - PROJECTILE_SIZE, player.rect.y + player.rect.h / 2 - PROJECTILE_SIZE / 2, PROJECTILE_SIZE, PROJECTILE_SIZE };
+    proj.prevX = proj.rect.x;
+    proj.prevY = proj.rect.y;
+    proj.updateHitbox();
+
+    int target = enemies.indexOf(findNearestEnemy(player.rect.x + player.rect.w / 2, player.rect.y + player.rect.h / 2));
+    if (target >= 0) {
+        float targetCenterX = enemies.centerX(target);
+        float targetCenterY = enemies.centerY(target);
+        float dx = targetCenterX - (player.rect.x + player.rect.w / 2);
+        float dy = targetCenterY - (player.rect.y + player.rect.h / 2);
+        float length = std::sqrt(dx * dx + dy * dy);
+        if (length > 0) {
+            proj.vx = (dx / length) * PROJECTILE_SPEED;
+            proj.vy = (dy / length) * PROJECTILE_SPEED;
+            proj.angle = std::atan2(dy, dx) * 180 / M_PI;
+            playerAnim.attack.flip = (dx < 0) ? SDL_FLIP_HORIZONTAL : SDL_FLIP_NONE;
+            playerAnim.idle.flip = playerAnim.attack.flip;
+            playerAnim.walk.flip = playerAnim.attack.flip;
+        }
+    }
+    else {
+        proj.vx = PROJECTILE_SPEED;
+        proj.vy = 0;
+        proj.angle = 0;
+        playerAnim.attack.flip = SDL_FLIP_NONE;
+        playerAnim.idle.flip = SDL_FLIP_NONE;
+        playerAnim.walk.flip = SDL_FLIP_NONE;
+    }
+    proj.active = true;
+    projectiles.spawn(proj);
+    qReady = false;
+    qCooldown = qCooldownMax;
+}
+
+void shootShotgun() {
+    if (!qReady) return;
+    playSound(shootSound);
+    float baseX = player.rect.x + player.rect.w - PROJECTILE_SIZE;
+    float baseY = player.rect.y + player.rect.h / 2 - PROJECTILE_SIZE / 2;
+    int target = enemies.indexOf(findNearestEnemy(player.rect.x + player.rect.w / 2, player.rect.y + player.rect.h / 2));
+
+    for (int i = -2; i <= 2; i++) {
+        GameObject proj;
+        proj.rect = { baseX, baseY, PROJECTILE_SIZE, PROJECTILE_SIZE };
+        proj.prevX = baseX;
+        proj.prevY = baseY;
+        proj.updateHitbox();
+        if (target >= 0) {
+            float targetCenterX = enemies.centerX(target);
+            float targetCenterY = enemies.centerY(target);
+            float dx = targetCenterX - (player.rect.x + player.rect.w / 2);
+            float dy = targetCenterY - (player.rect.y + player.rect.h / 2);
+            float length = std::sqrt(dx * dx + dy * dy);
+            float angleOffset = i * 15.0f;
+            float rad = std::atan2(dy, dx) + angleOffset * M_PI / 180.0f;
+            if (length > 0) {
+                proj.vx = std::cos(rad) * PROJECTILE_SPEED;
+                proj.vy = std::sin(rad) * PROJECTILE_SPEED;
+                proj.angle = rad * 180 / M_PI;
+                playerAnim.attack.flip = (dx < 0) ? SDL_FLIP_HORIZONTAL : SDL_FLIP_NONE;
+                playerAnim.idle.flip = playerAnim.attack.flip;
+                playerAnim.walk.flip = playerAnim.attack.flip;
+            }
+        }
+        else {
+            proj.vx = PROJECTILE_SPEED + i * 100.0f;
+            proj.vy = 0;
+            proj.angle = 0;
+            playerAnim.attack.flip = SDL_FLIP_NONE;
+            playerAnim.idle.flip = SDL_FLIP_NONE;
+            playerAnim.walk.flip = SDL_FLIP_NONE;
+        }
+        proj.active = true;
+        projectiles.spawn(proj);
+    }
+    qReady = false;
+    qCooldown = qCooldownMax * 1.5f;
+}
+
+void tryShoot() {
+    if (!qReady || player.playerState == HURT || player.playerState == DEAD) return;
+    player.playerState = ATTACK;
+    playerAnim.attack.currentFrame = 0;
+    playerAnim.attack.elapsedTime = 0.0f;
+    if (currentWeapon == SINGLE) shootProjectile();
+    else if (currentWeapon == SHOTGUN) shootShotgun();
+}
+
+bool checkCollision(const SDL_FRect& a, const SDL_FRect& b) {
+    return (a.x < b.x + b.w && a.x + a.w > b.x && a.y < b.y + b.h && a.y + a.h > b.y);
+}
+
+int gridCol(float x) {
+    int col = static_cast<int>(std::floor(x / GRID_CELL_SIZE));
+    return std::min(std::max(col, 0), GRID_COLS - 1);
+}
+
+int gridRow(float y) {
+    int row = static_cast<int>(std::floor(y / GRID_CELL_SIZE));
+    return std::min(std::max(row, 0), GRID_ROWS - 1);
+}
+
+// Counting sort song song: mỗi chunk đếm histogram riêng, prefix sum theo thứ tự (ô, chunk) cho ra
+// vị trí ghi của từng chunk, nên thứ tự index trong mỗi ô giống hệt bản tuần tự.
+void buildEnemyGrid() {
+    PROFILE_ZONE("buildEnemyGrid");
+    const int cellCount = GRID_COLS * GRID_ROWS;
+    const size_t count = enemies.size();
+    const size_t chunks = JobSystem::chunkCount(count, ENEMY_GRAIN);
+    enemyGrid.cellStart.assign(cellCount + 1, 0);
+    enemyGrid.cellItems.resize(enemies.capacity());
+    enemyGrid.itemCell.resize(enemies.capacity());
+    enemyGrid.maxHalfW = ENEMY_HITBOX_SIZE / 2;
+    enemyGrid.maxHalfH = ENEMY_HITBOX_SIZE / 2;
+    gridChunkCounts.assign(chunks * cellCount, 0);
+
+    const float half = ENEMY_HITBOX_SIZE / 2;
+    jobs.parallelFor(count, ENEMY_GRAIN, [&](size_t begin, size_t end, size_t chunk) {
+        int* counts = &gridChunkCounts[chunk * cellCount];
+        for (size_t i = begin; i < end; i++) {
+            int cell = -1;
+            if (enemies.active[i]) {
+                cell = gridRow(enemies.hitY[i] + half) * GRID_COLS + gridCol(enemies.hitX[i] + half);
+                counts[cell]++;
+            }
+            enemyGrid.itemCell[i] = cell;
+        }
+    });
+
+    int total = 0;
+    for (int c = 0; c < cellCount; c++) {
+        enemyGrid.cellStart[c] = total;
+        for (size_t chunk = 0; chunk < chunks; chunk++) {
+            int& slot = gridChunkCounts[chunk * cellCount + c];
+            int n = slot;
+            slot = total;
+            total += n;
+        }
+    }
+    enemyGrid.cellStart[cellCount] = total;
+
+    jobs.parallelFor(count, ENEMY_GRAIN, [&](size_t begin, size_t end, size_t chunk) {
+        int* offsets = &gridChunkCounts[chunk * cellCount];
+        for (size_t i = begin; i < end; i++) {
+            int cell = enemyGrid.itemCell[i];
+            if (cell >= 0) enemyGrid.cellItems[offsets[cell]++] = static_cast<int>(i);
+        }
+    });
+}
+
+// Gọi visit(index) cho mọi enemy có hitbox có thể giao với area.
+template <typename Visit>
+void queryEnemyGrid(const SDL_FRect& area, Visit&& visit) {
+    if (enemyGrid.cellStart.empty()) return;
+    int col0 = gridCol(area.x - enemyGrid.maxHalfW);
+    int col1 = gridCol(area.x + area.w + enemyGrid.maxHalfW);
+    int row0 = gridRow(area.y - enemyGrid.maxHalfH);
+    int row1 = gridRow(area.y + area.h + enemyGrid.maxHalfH);
+    for (int row = row0; row <= row1; row++) {
+        for (int col = col0; col <= col1; col++) {
+            int cell = row * GRID_COLS + col;
+            for (int k = enemyGrid.cellStart[cell]; k < enemyGrid.cellStart[cell + 1]; k++) {
+                visit(enemyGrid.cellItems[k]);
+            }
+        }
+    }
+}
+
+void applyUpgrade(int choice) {
+    if (upgradePoints < 1) return;
+    playSound(upgradeSound);
+    switch (choice) {
+    case 1: playerSpeed += 50.0f; break;
+    case 2: qCooldownMax *= 0.8f; break;
+    case 3: projectileDamage += 1; break;
+    case 4: if (!shotgunUnlocked) { currentWeapon = SHOTGUN; shotgunUnlocked = true; } break;
+    }
+    upgradePoints -= 1;
+    gameState = PLAYING;
+}
+
+void resetGame() {
+    enemies.clear();
+    projectiles.clear();
+    markers.clear();
+    for (ParticleRing& ring : particles) ring.clear();
+
+    player.rect = { SCREEN_WIDTH / 2.0f - PLAYER_SIZE / 2.0f, SCREEN_HEIGHT / 2.0f - PLAYER_SIZE / 2.0f, (float)PLAYER_SIZE, (float)PLAYER_SIZE };
+    player.prevX = player.rect.x;
+    player.prevY = player.rect.y;
+    player.updateHitbox();
+    player.active = true;
+    player.health = MAX_HEALTH;
+    player.playerState = IDLE;
+    player.animTime = 0.0f;
+    player.angle = 0.0f;
+    player.hurtTimer = 0.0f;
+    player.vx = 0.0f;
+    player.vy = 0.0f;
+
+    score = 0;
+    combo = 0;
+    comboTime = 0.0f;
+    qCooldown = 0.0f;
+    qReady = true;
+    gameTime = 0.0f;
+    level = 1;
+    spawnRate = SPAWN_RATE_BASE;
+    nextSpawnTimer = nextSpawnInterval();
+    upgradePoints = 0;
+    projectileDamage = 1;
+    playerSpeed = PLAYER_SPEED;
+    qCooldownMax = Q_COOLDOWN;
+    currentWeapon = SINGLE;
+    gameState = PLAYING;
+    levelUpTimer = 0.0f;
+    preLevelUpTimer = 0.0f;
+    deathTimer = 0.0f;
+    lastDamageTime = 0.0f;
+    currentMap = (nextMap >= 0) ? nextMap : mapRng.below(NUM_MAPS);
+    nextMap = -1;
+    shotgunUnlocked = false;
+
+    playerAnim.idle.currentFrame = 0;
+    playerAnim.idle.elapsedTime = 0.0f;
+    playerAnim.idle.flip = SDL_FLIP_NONE;
+
+    for (int i = 0; i < 2; i++) spawnEnemyMarker();
+
+    restartMusic();
+}
+
+void spawnParticles(ParticleEmitter emitter, float x, float y) {
+    const ParticleEmitterDef& def = PARTICLE_EMITTERS[emitter];
+    for (int i = 0; i < def.count; i++) {
+        float vx = (particleRng.below(200) - 100) / 100.0f * def.speed;
+        float vy = (particleRng.below(200) - 100) / 100.0f * def.speed;
+        particles[emitter].push(x + PLAYER_SIZE / 2, y + PLAYER_SIZE / 2, vx, vy, particleClock);
+    }
+}
+
+// p[i] += v[i] * dt trên một đoạn liên tục.
+void integrateParticles(float* p, const float* v, size_t n, float dt) {
+    size_t i = 0;
+#ifdef STEERING_SIMD
+    __m128 step = _mm_set1_ps(dt);
+    for (; i + 4 <= n; i += 4) {
+        __m128 pos = _mm_loadu_ps(p + i);
+        _mm_storeu_ps(p + i, _mm_add_ps(pos, _mm_mul_ps(_mm_loadu_ps(v + i), step)));
+    }
+#endif
+    for (; i < n; i++) p[i] += v[i] * dt;
+}
+
+void updateParticles(float deltaTime) {
+    PROFILE_ZONE("updateParticles");
+    particleClock += deltaTime;
+    for (int e = 0; e < NUM_PARTICLE_EMITTERS; e++) {
+        ParticleRing& ring = particles[e];
+        ring.expire(particleClock, PARTICLE_EMITTERS[e].lifetime);
+        jobs.parallelFor(ring.size(), PARTICLE_GRAIN, [&](size_t begin, size_t end, size_t) {
+            ring.forSegments(begin, end, [&](size_t first, size_t last) {
+                integrateParticles(ring.x.data() + first, ring.vx.data() + first, last - first, deltaTime);
+                integrateParticles(ring.y.data() + first, ring.vy.data() + first, last - first, deltaTime);
+            });
+        });
+    }
+}
+
+void updatePlayer(float deltaTime) {
+    PROFILE_ZONE("updatePlayer");
+    if (gameState != PLAYING || player.playerState == DEAD) return;
+
+    float speed = playerSpeed * deltaTime;
+    bool moving = false;
+
+    player.vx = 0;
+    player.vy = 0;
+    if (input.up && player.rect.y > 0) { player.vy = -speed; moving = true; }
+    if (input.down && player.rect.y + player.rect.h < SCREEN_HEIGHT) { player.vy = speed; moving = true; }
+    if (input.left && player.rect.x > 0) {
+        player.vx = -speed;
+        moving = true;
+        if (player.playerState != ATTACK && player.playerState != HURT) playerAnim.walk.flip = SDL_FLIP_HORIZONTAL;
+    }
+    if (input.right && player.rect.x + player.rect.w < SCREEN_WIDTH) {
+        player.vx = speed;
+        moving = true;
+        if (player.playerState != ATTACK && player.playerState != HURT) playerAnim.walk.flip = SDL_FLIP_NONE;
+    }
+
+    if (moving && player.playerState != ATTACK && player.playerState != HURT) {
+        float length = std::sqrt(player.vx * player.vx + player.vy * player.vy);
+        if (length > 0) {
+            player.vx = (player.vx / length) * speed;
+            player.vy = (player.vy / length) * speed;
+        }
+        player.rect.x += player.vx;
+        player.rect.y += player.vy;
+        player.updateHitbox();
+        player.playerState = WALK;
+    }
+    else if (player.playerState != ATTACK && player.playerState != HURT) {
+        player.playerState = IDLE;
+    }
+
+    Animation* currentPlayerAnim = nullptr;
+    switch (player.playerState) {
+    case IDLE: currentPlayerAnim = &playerAnim.idle; break;
+    case WALK: currentPlayerAnim = &playerAnim.walk; break;
+    case ATTACK: currentPlayerAnim = &playerAnim.attack; break;
+    case HURT: currentPlayerAnim = &playerAnim.hurt; break;
+    case DEAD: currentPlayerAnim = &playerAnim.dead; break;
+    }
+    if (currentPlayerAnim) {
+        updateAnimation(*currentPlayerAnim, deltaTime, player.playerState != DEAD && player.playerState != HURT);
+        if ((player.playerState == ATTACK || player.playerState == HURT) &&
+            currentPlayerAnim->currentFrame == currentPlayerAnim->frames.size() - 1) {
+            player.playerState = IDLE;
+        }
+    }
+
+    if (player.hurtTimer > 0) {
+        player.hurtTimer -= deltaTime;
+        if (player.hurtTimer <= 0) player.hurtTimer = 0.0f;
+    }
+}
+
+// Steering: với mỗi enemy còn sống và chưa DYING, tính cờ vào tầm chém (inRange), vận tốc hướng về
+// target và vị trí mới. targetX/targetY là toạ độ góc trên trái mà enemy cần tới để tâm trùng tâm player.
+void steerScalar(size_t begin, size_t end, float targetX, float targetY, float speed, float deltaTime) {
+    const float slashSq = SLASHING_DISTANCE * SLASHING_DISTANCE;
+    for (size_t i = begin; i < end; i++) {
+        if (!enemies.active[i] || enemies.state[i] == DYING) {
+            enemies.inRange[i] = 0;
+            continue;
+        }
+        float dx = targetX - enemies.x[i];
+        float dy = targetY - enemies.y[i];
+        float lengthSq = dx * dx + dy * dy;
+        enemies.inRange[i] = lengthSq <= slashSq;
+        if (enemies.inRange[i]) {
+            enemies.vx[i] = 0;
+            enemies.vy[i] = 0;
+            continue;
+        }
+        float scale = speed * enemies.speedScale[i] / std::sqrt(lengthSq);
+        enemies.vx[i] = dx * scale;
+        enemies.vy[i] = dy * scale;
+        enemies.x[i] += enemies.vx[i] * deltaTime;
+        enemies.y[i] += enemies.vy[i] * deltaTime;
+    }
+}
+
+#ifdef STEERING_SIMD
+// 4 enemy mỗi lượt, phần dư chạy scalar. Chuẩn hoá bằng sqrt/div đúng thứ tự phép tính của steerScalar
+// (không dùng rsqrt, vốn khác bit giữa các CPU) để mọi kernel cho kết quả giống hệt từng bit, replay không lệch.
+void steerSSE2(size_t begin, size_t end, float targetX, float targetY, float speed, float deltaTime) {
+    const __m128 tx = _mm_set1_ps(targetX), ty = _mm_set1_ps(targetY);
+    const __m128 slashSq = _mm_set1_ps(SLASHING_DISTANCE * SLASHING_DISTANCE);
+    const __m128 speedV = _mm_set1_ps(speed), dt = _mm_set1_ps(deltaTime);
+    const __m128i zero = _mm_setzero_si128(), dying = _mm_set1_epi32(DYING);
+    size_t i = begin;
+    for (; i + 4 <= end; i += 4) {
+        int activeBytes, stateBytes;
+        std::memcpy(&activeBytes, &enemies.active[i], 4);
+        std::memcpy(&stateBytes, &enemies.state[i], 4);
+        __m128i act = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(activeBytes), zero), zero);
+        __m128i st = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(stateBytes), zero), zero);
+        __m128i dead = _mm_or_si128(_mm_cmpeq_epi32(act, zero), _mm_cmpeq_epi32(st, dying));
+        __m128 live = _mm_castsi128_ps(_mm_xor_si128(dead, _mm_set1_epi32(-1)));
+
+        __m128 px = _mm_loadu_ps(&enemies.x[i]), py = _mm_loadu_ps(&enemies.y[i]);
+        __m128 dx = _mm_sub_ps(tx, px), dy = _mm_sub_ps(ty, py);
+        __m128 lengthSq = _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy));
+        __m128 inRange = _mm_and_ps(_mm_cmple_ps(lengthSq, slashSq), live);
+        __m128 walking = _mm_andnot_ps(inRange, live);
+
+        __m128 scale = _mm_div_ps(_mm_mul_ps(speedV, _mm_loadu_ps(&enemies.speedScale[i])), _mm_sqrt_ps(lengthSq));
+        __m128 vx = _mm_and_ps(_mm_mul_ps(dx, scale), walking);
+        __m128 vy = _mm_and_ps(_mm_mul_ps(dy, scale), walking);
+
+        __m128 oldVx = _mm_loadu_ps(&enemies.vx[i]), oldVy = _mm_loadu_ps(&enemies.vy[i]);
+        _mm_storeu_ps(&enemies.vx[i], _mm_or_ps(_mm_and_ps(live, vx), _mm_andnot_ps(live, oldVx)));
+        _mm_storeu_ps(&enemies.vy[i], _mm_or_ps(_mm_and_ps(live, vy), _mm_andnot_ps(live, oldVy)));
+        // Enemy đứng yên giữ nguyên vị trí như bản scalar (px + 0 sẽ đổi -0.0f thành +0.0f).
+        __m128 nx = _mm_add_ps(px, _mm_mul_ps(vx, dt)), ny = _mm_add_ps(py, _mm_mul_ps(vy, dt));
+        _mm_storeu_ps(&enemies.x[i], _mm_or_ps(_mm_and_ps(walking, nx), _mm_andnot_ps(walking, px)));
+        _mm_storeu_ps(&enemies.y[i], _mm_or_ps(_mm_and_ps(walking, ny), _mm_andnot_ps(walking, py)));
+
+        int mask = _mm_movemask_ps(inRange);
+        for (int k = 0; k < 4; k++) enemies.inRange[i + k] = (mask >> k) & 1;
+    }
+    steerScalar(i, end, targetX, targetY, speed, deltaTime);
+}
+
+// Giống steerSSE2 nhưng 8 enemy mỗi lượt; chỉ gọi khi SDL_HasAVX2().
+TARGET_AVX2 void steerAVX2(size_t begin, size_t end, float targetX, float targetY, float speed, float deltaTime) {
+    const __m256 tx = _mm256_set1_ps(targetX), ty = _mm256_set1_ps(targetY);
+    const __m256 slashSq = _mm256_set1_ps(SLASHING_DISTANCE * SLASHING_DISTANCE);
+    const __m256 speedV = _mm256_set1_ps(speed), dt = _mm256_set1_ps(deltaTime);
+    const __m256i zero = _mm256_setzero_si256(), dying = _mm256_set1_epi32(DYING);
+    size_t i = begin;
+    for (; i + 8 <= end; i += 8) {
+        __m256i act = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(&enemies.active[i])));
+        __m256i st = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(&enemies.state[i])));
+        __m256i dead = _mm256_or_si256(_mm256_cmpeq_epi32(act, zero), _mm256_cmpeq_epi32(st, dying));
+        __m256 live = _mm256_castsi256_ps(_mm256_xor_si256(dead, _mm256_set1_epi32(-1)));
+
+        __m256 px = _mm256_loadu_ps(&enemies.x[i]), py = _mm256_loadu_ps(&enemies.y[i]);
+        __m256 dx = _mm256_sub_ps(tx, px), dy = _mm256_sub_ps(ty, py);
+        __m256 lengthSq = _mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy));
+        __m256 inRange = _mm256_and_ps(_mm256_cmp_ps(lengthSq, slashSq, _CMP_LE_OQ), live);
+        __m256 walking = _mm256_andnot_ps(inRange, live);
+
+        __m256 scale = _mm256_div_ps(_mm256_mul_ps(speedV, _mm256_loadu_ps(&enemies.speedScale[i])), _mm256_sqrt_ps(lengthSq));
+        __m256 vx = _mm256_and_ps(_mm256_mul_ps(dx, scale), walking);
+        __m256 vy = _mm256_and_ps(_mm256_mul_ps(dy, scale), walking);
+
+        __m256 oldVx = _mm256_loadu_ps(&enemies.vx[i]), oldVy = _mm256_loadu_ps(&enemies.vy[i]);
+        _mm256_storeu_ps(&enemies.vx[i], _mm256_blendv_ps(oldVx, vx, live));
+        _mm256_storeu_ps(&enemies.vy[i], _mm256_blendv_ps(oldVy, vy, live));
+        _mm256_storeu_ps(&enemies.x[i], _mm256_blendv_ps(px, _mm256_add_ps(px, _mm256_mul_ps(vx, dt)), walking));
+        _mm256_storeu_ps(&enemies.y[i], _mm256_blendv_ps(py, _mm256_add_ps(py, _mm256_mul_ps(vy, dt)), walking));
+
+        int mask = _mm256_movemask_ps(inRange);
+        for (int k = 0; k < 8; k++) enemies.inRange[i + k] = (mask >> k) & 1;
+    }
+    steerScalar(i, end, targetX, targetY, speed, deltaTime);
+}
+#endif
+
+bool steeringKernelSupported(SteeringKernelType kernel) {
+#ifdef STEERING_SIMD
+    if (kernel == STEER_AVX2) return SDL_HasAVX2() == SDL_TRUE;
+    if (kernel == STEER_SSE2) return SDL_HasSSE2() == SDL_TRUE;
+#else
+    if (kernel != STEER_SCALAR) return false;
+#endif
+    return true;
+}
+
+SteeringKernelType bestSteeringKernel() {
+    if (steeringKernelSupported(STEER_AVX2)) return STEER_AVX2;
+    if (steeringKernelSupported(STEER_SSE2)) return STEER_SSE2;
+    return STEER_SCALAR;
+}
+
+void runSteering(SteeringKernelType kernel, size_t begin, size_t end, float targetX, float targetY, float speed, float deltaTime) {
+    switch (kernel) {
+#ifdef STEERING_SIMD
+    case STEER_AVX2: steerAVX2(begin, end, targetX, targetY, speed, deltaTime); return;
+    case STEER_SSE2: steerSSE2(begin, end, targetX, targetY, speed, deltaTime); return;
+#endif
+    default: steerScalar(begin, end, targetX, targetY, speed, deltaTime); return;
+    }
+}
+
+void steerEnemies(SteeringKernelType kernel, size_t count, float targetX, float targetY, float speed, float deltaTime) {
+    jobs.parallelFor(count, ENEMY_GRAIN, [&](size_t begin, size_t end, size_t) {
+        runSteering(kernel, begin, end, targetX, targetY, speed, deltaTime);
+    });
+}
+
+void updateEnemies(float deltaTime) {
+    PROFILE_ZONE("updateEnemies");
+    float currentEnemySpeed = ENEMY_SPEED + (level - 1) * ENEMY_SPEED_INCREASE;
+    float targetX = player.rect.x + player.rect.w / 2 - PLAYER_SIZE / 2.0f;
+    float targetY = player.rect.y + player.rect.h / 2 - PLAYER_SIZE / 2.0f;
+    size_t count = enemies.size();
+    steerEnemies(steeringKernel, count, targetX, targetY, currentEnemySpeed, deltaTime);
+
+    // Chuyển trạng thái chạy song song theo chunk; enemy chết và tiếng chém được ghi lại rồi gộp
+    // theo thứ tự chunk bên dưới nên điểm, combo và particle giống hệt khi chạy một luồng.
+    size_t chunks = JobSystem::chunkCount(count, ENEMY_GRAIN);
+    if (chunkKills.size() < chunks) chunkKills.resize(chunks);
+    chunkAttackStarts.assign(chunks, 0);
+    jobs.parallelFor(count, ENEMY_GRAIN, [&](size_t begin, size_t end, size_t chunk) {
+        std::vector<Uint32>& kills = chunkKills[chunk];
+        kills.clear();
+        for (size_t i = begin; i < end; i++) {
+            if (enemies.hitEffectTimer[i] > 0) {
+                enemies.hitEffectTimer[i] -= deltaTime;
+                if (enemies.hitEffectTimer[i] <= 0) enemies.hitEffectTimer[i] = 0.0f;
+            }
+            if (enemies.attackCooldown[i] > 0) {
+                enemies.attackCooldown[i] -= deltaTime;
+            }
+            if (!enemies.active[i]) continue;
+
+            if (enemies.state[i] == DYING) {
+                if (gameTime - enemies.animStart[i] >= clipDuration(*enemyClips[enemies.animClip[i]])) {
+                    enemies.active[i] = 0;
+                    kills.push_back(static_cast<Uint32>(i));
+                }
+            }
+            else if (enemies.inRange[i]) {
+                if (enemies.state[i] != SLASHING) {
+                    enemies.setState(i, SLASHING, gameTime);
+                    chunkAttackStarts[chunk]++;
+                }
+            }
+            else {
+                enemies.setState(i, WALKING, gameTime);
+                enemies.updateHitbox(i);
+            }
+        }
+    });
+
+    for (size_t chunk = 0; chunk < chunks; chunk++) {
+        for (int k = 0; k < chunkAttackStarts[chunk]; k++) playSound(enemyAttackSound);
+        for (Uint32 i : chunkKills[chunk]) {
+            playSound(enemyDeathSound);
+            score += SCORE_PER_KILL * (combo + 1);
+            combo++;
+            comboTime = COMBO_TIMEOUT;
+            spawnParticles(EMIT_ENEMY_DEATH, enemies.x[i], enemies.y[i]);
+        }
+    }
+}
+
+// Va chạm ghi vào máu enemy dùng chung nên giữ tuần tự.
+void resolveProjectileHits() {
+    PROFILE_ZONE("collision");
+    for (auto& proj : projectiles) {
+        if (!proj.active) continue;
+        // Chọn enemy có index nhỏ nhất để giữ đúng thứ tự như khi duyệt tuần tự.
+        int hit = -1;
+        queryEnemyGrid(proj.hitbox, [&](int i) {
+            if (!enemies.active[i] || enemies.state[i] == DYING) return;
+            if ((hit < 0 || i < hit) && checkCollision(proj.hitbox, enemies.hitbox(i))) hit = i;
+        });
+        if (hit < 0) continue;
+
+        proj.active = false;
+        enemies.health[hit] -= projectileDamage;
+        enemies.hitEffectTimer[hit] = 0.2f;
+        qReady = true;
+        qCooldown = 0;
+        if (enemies.health[hit] <= 0 && enemies.state[hit] != DYING) {
+            enemies.setState(hit, DYING, gameTime);
+            enemies.vx[hit] = 0;
+            enemies.vy[hit] = 0;
+        }
+    }
+}
+
+void updateProjectiles(float deltaTime) {
+    PROFILE_ZONE("updateProjectiles");
+    jobs.parallelFor(projectiles.size(), PROJECTILE_GRAIN, [&](size_t begin, size_t end, size_t) {
+        for (size_t i = begin; i < end; i++) {
+            GameObject& proj = projectiles[i];
+            if (!proj.active) continue;
+            proj.rect.x += proj.vx * deltaTime;
+            proj.rect.y += proj.vy * deltaTime;
+            proj.updateHitbox();
+            if (proj.rect.x + proj.rect.w < 0 || proj.rect.x > SCREEN_WIDTH ||
+                proj.rect.y + proj.rect.h < 0 || proj.rect.y > SCREEN_HEIGHT) {
+                proj.active = false;
+            }
+        }
+    });
+
+    resolveProjectileHits();
+}
+
+// Lưu vị trí trước mỗi tick để render nội suy giữa hai tick mô phỏng.
+void savePreviousPositions() {
+    player.prevX = player.rect.x;
+    player.prevY = player.rect.y;
+    enemies.savePreviousPositions();
+    for (auto& proj : projectiles) {
+        proj.prevX = proj.rect.x;
+        proj.prevY = proj.rect.y;
+    }
+}
+
+void update(float deltaTime) {
+    PROFILE_ZONE("update");
+    switch (gameState) {
+    case MENU: {
+        keepMusicPlaying();
+        break;
+    }
+    case SETTINGS: {
+        keepMusicPlaying();
+        break;
+    }
+    case PAUSED: {
+        break;
+    }
+    case PRE_LEVEL_UP: {
+        preLevelUpTimer -= deltaTime;
+        for (size_t i = 0; i < enemies.size(); i++) {
+            if (enemies.active[i] && enemies.state[i] != DYING) {
+                enemies.setState(i, DYING, gameTime);
+                enemies.health[i] = 0;
+                enemies.vx[i] = 0;
+                enemies.vy[i] = 0;
+            }
+        }
+        if (preLevelUpTimer <= 0) {
+            playSound(levelUpSound);
+            gameState = LEVEL_UP;
+            levelUpTimer = 2.0f;
+        }
+        break;
+    }
+    case LEVEL_UP: {
+        levelUpTimer -= deltaTime;
+        if (player.health < MAX_HEALTH) player.health = MAX_HEALTH;
+        if (levelUpTimer <= 0) {
+            PROFILE_ZONE("levelTransition");
+            level++;
+            upgradePoints++;
+            spawnRate = std::max(SPAWN_RATE_BASE - (level - 1) * SPAWN_RATE_DECREASE, SPAWN_RATE_MIN);
+            enemies.clear();
+            currentMap = nextMap;
+            nextMap = -1;
+            gameState = (upgradePoints >= 1) ? UPGRADE_MENU : PLAYING;
+        }
+        break;
+    }
+    case UPGRADE_MENU: {
+        break;
+    }
+    case PLAYING: {
+        keepMusicPlaying();
+        gameTime += deltaTime;
+
+        if (gameTime > LEVEL_DURATION * level) {
+            gameState = PRE_LEVEL_UP;
+            preLevelUpTimer = PRE_LEVEL_UP_DELAY;
+            // Chọn map màn sau ngay bây giờ để nó được nạp nền trong lúc PRE_LEVEL_UP và LEVEL_UP.
+            do { nextMap = mapRng.below(NUM_MAPS); } while (nextMap == currentMap);
+            break;
+        }
+
+        updateSpawnDirector(deltaTime);
+        updatePlayer(deltaTime);
+        updateEnemies(deltaTime);
+        buildEnemyGrid();
+        updateProjectiles(deltaTime);
+        updateParticles(deltaTime);
+
+        queryEnemyGrid(player.hitbox, [&](int i) {
+            if (!enemies.active[i] || enemies.state[i] != SLASHING) return;
+            if (checkCollision(player.hitbox, enemies.hitbox(i)) && enemies.attackCooldown[i] <= 0) {
+                player.health -= 20;
+                switch (enemies.type[i]) {
+                case BASIC: enemies.attackCooldown[i] = 1.0f; break;
+                case FAST: enemies.attackCooldown[i] = 0.5f; break;
+                case CHASER: enemies.attackCooldown[i] = 0.8f; break;
+                }
+                lastDamageTime = gameTime;
+                if (player.health > 0 && player.playerState != DEAD && player.playerState != HURT) {
+                    playSound(hurtSound);
+                    player.playerState = HURT;
+                    player.animTime = 0.0f;
+                    player.hurtTimer = 0.3f;
+                    playerAnim.hurt.currentFrame = 0;
+                    playerAnim.hurt.elapsedTime = 0.0f;
+                }
+                if (player.health <= 0 && player.playerState != DEAD) {
+                    playSound(deathSound);
+                    player.playerState = DEAD;
+                    player.animTime = 0.0f;
+                    playerAnim.dead.currentFrame = 0;
+                    playerAnim.dead.elapsedTime = 0.0f;
+                    deathTimer = playerAnim.dead.frames.size() * playerAnim.dead.frameTime + 1.0f;
+                }
+            }
+        });
+
+        if (player.playerState == DEAD && deathTimer > 0) {
+            updateAnimation(playerAnim.dead, deltaTime, false);
+            deathTimer -= deltaTime;
+            if (deathTimer <= 0) {
+                gameState = GAME_OVER;
+                nextMap = mapRng.below(NUM_MAPS);
+            }
+        }
+
+        if (comboTime > 0) comboTime -= deltaTime;
+        else combo = 0;
+
+        if (!qReady) {
+            qCooldown -= deltaTime;
+            if (qCooldown <= 0) qReady = true;
+        }
+
+        for (auto& marker : markers) {
+            marker.timer -= deltaTime;
+            if (marker.isSpawnMarker && marker.timer <= 0) spawnEnemyAtMarker(marker.position);
+        }
+        markers.removeIf([](const Marker& m) { return m.timer <= 0; });
+
+        enemies.removeInactive();
+        projectiles.removeIf([](const GameObject& p) { return !p.active; });
+
+        break;
+    }
+    case GAME_OVER: {
+        keepMusicPlaying();
+        std::fill(enemies.vx.begin(), enemies.vx.begin() + enemies.size(), 0.0f);
+        std::fill(enemies.vy.begin(), enemies.vy.begin() + enemies.size(), 0.0f);
+        break;
+    }
+    }
+}
+
+void renderButton(const Button& button) {
+    setDrawColor(0, 0, 0, 100);
+    SDL_Rect shadowRect = { button.rect.x + 5, button.rect.y + 5, button.rect.w, button.rect.h };
+    renderFillRect(&shadowRect);
+
+    setDrawColor(button.hovered ? 150 : 100, button.hovered ? 150 : 100, 50, 255);
+    renderFillRect(&button.rect);
+
+    setDrawColor(button.hovered ? 255 : 200, button.hovered ? 255 : 200, 100, 255);
+    renderDrawRect(&button.rect);
+
+    renderStaticText(button.text, button.rect.x + 10, button.rect.y + 10, button.color);
+}
+
+void renderMenu() {
+    if (menuBackground) renderCopy(menuBackground, nullptr, nullptr);
+
+    Uint8 alpha = static_cast<Uint8>(128 + 127 * sin(SDL_GetTicks() / 500.0f));
+    SDL_Color titleColor = { 255, 215, 0, alpha };
+    renderStaticText("Dodge And Q", SCREEN_WIDTH / 2 - 140, SCREEN_HEIGHT / 2 - 200, titleColor, true);
+
+    Button startButton = { {SCREEN_WIDTH / 2 - 100, SCREEN_HEIGHT / 2 - 60, 200, 40}, "Start Game", {0, 255, 127}, false };
+    Button settingsButton = { {SCREEN_WIDTH / 2 - 100, SCREEN_HEIGHT / 2, 200, 40}, "Settings", {255, 215, 0}, false };
+    Button quitButton = { {SCREEN_WIDTH / 2 - 100, SCREEN_HEIGHT / 2 + 60, 200, 40}, "Quit", {255, 69, 0}, false };
+
+    int mouseX, mouseY;
+    SDL_GetMouseState(&mouseX, &mouseY);
     startButton.hovered = (mouseX >= startButton.rect.x && mouseX <= startButton.rect.x + startButton.rect.w &&
                           mouseY >= startButton.rect.y && mouseY <= startButton.rect.y + startButton.rect.h);
     settingsButton.hovered = (mouseX >= settingsButton.rect.x && mouseX <= settingsButton.rect.x + settingsButton.rect.w &&
@@ -837,328 +3210,1609 @@ void renderMenu() {
     quitButton.hovered = (mouseX >= quitButton.rect.x && mouseX <= quitButton.rect.x + quitButton.rect.w &&
                          mouseY >= quitButton.rect.y && mouseY <= quitButton.rect.y + quitButton.rect.h);
 
-    renderButton(startButton);
-    renderButton(settingsButton);
-    renderButton(quitButton);
+    renderButton(startButton);
+    renderButton(settingsButton);
+    renderButton(quitButton);
+}
+
+void renderLoadingBar(float progress) {
+    SDL_Rect bar = { SCREEN_WIDTH / 2 - 200, SCREEN_HEIGHT - 60, 400, 12 };
+    setDrawColor(50, 50, 50, 255);
+    renderFillRect(&bar);
+    SDL_Rect fill = { bar.x, bar.y, static_cast<int>(bar.w * std::min(progress, 1.0f)), bar.h };
+    setDrawColor(255, 215, 0, 255);
+    renderFillRect(&fill);
+    renderText(frameArena.format("Loading %d%%", static_cast<int>(progress * 100)), bar.x, bar.y - 32, { 255, 255, 255, 255 });
+}
+
+void renderUI(const RenderSnapshot& snap) {
+    PROFILE_ZONE("renderUI");
+    int healthBarX = 10, healthBarY = 10, healthBarWidth = 200, healthBarHeight = 20;
+    float healthRatio = static_cast<float>(snap.health) / MAX_HEALTH;
+    if (healthRatio < 0) healthRatio = 0.0f;
+    SDL_Rect healthBg = { healthBarX, healthBarY, healthBarWidth, healthBarHeight };
+    setDrawColor(255, 0, 0, 255);
+    renderFillRect(&healthBg);
+    SDL_Rect healthFill = { healthBarX, healthBarY, static_cast<int>(healthBarWidth * healthRatio), healthBarHeight };
+    setDrawColor(0, 255, 0, 255);
+    renderFillRect(&healthFill);
+    SDL_Rect healthBorder = { healthBarX - 2, healthBarY - 2, healthBarWidth + 4, healthBarHeight + 4 };
+    setDrawColor(255, 255, 255, 255);
+    renderDrawRect(&healthBorder);
+
+    int levelBarX = 10, levelBarY = 40, levelBarWidth = 200, levelBarHeight = 15;
+    float levelProgress = snap.levelProgress;
+    SDL_Rect levelBg = { levelBarX, levelBarY, levelBarWidth, levelBarHeight };
+    setDrawColor(50, 50, 50, 255);
+    renderFillRect(&levelBg);
+    SDL_Rect levelFill = { levelBarX, levelBarY, static_cast<int>(levelBarWidth * levelProgress), levelBarHeight };
+    setDrawColor(0, 255, 0, 255);
+    renderFillRect(&levelFill);
+    SDL_Rect levelBorder = { levelBarX - 2, levelBarY - 2, levelBarWidth + 4, levelBarHeight + 4 };
+    setDrawColor(255, 255, 255, 255);
+    renderDrawRect(&levelBorder);
+
+    renderText(frameArena.format("Score: %d", snap.score), 10, 70);
+    renderText(frameArena.format("Level: %d", snap.level), 10, 100);
+    renderText(frameArena.format("Combo: %d", snap.combo), 10, 280);
+
+    const int barWidth = 200;
+    const int barHeight = 15;
+    float cooldownRatio = snap.cooldownRatio;
+    SDL_Rect cooldownBg = { 10, SCREEN_HEIGHT - 30, barWidth, barHeight };
+    setDrawColor(50, 50, 50, 255);
+    renderFillRect(&cooldownBg);
+    SDL_Rect cooldownFill = { 10, SCREEN_HEIGHT - 30, static_cast<int>(barWidth * (1 - cooldownRatio)), barHeight };
+    setDrawColor(0, 150, 255, 255);
+    renderFillRect(&cooldownFill);
+    SDL_Color qColor = snap.qReady ? SDL_Color{ 0, 255, 0, 255 } : SDL_Color{ 255, 0, 0, 255 };
+    renderStaticText("[Q] Shoot", SCREEN_WIDTH - 120, SCREEN_HEIGHT - 30, qColor);
+}
+
+float lerp(float a, float b, float t) {
+    return a + (b - a) * t;
+}
+
+Animation* currentPlayerAnimation() {
+    switch (player.playerState) {
+    case IDLE: return &playerAnim.idle;
+    case WALK: return &playerAnim.walk;
+    case ATTACK: return &playerAnim.attack;
+    case HURT: return &playerAnim.hurt;
+    case DEAD: return &playerAnim.dead;
+    }
+    return nullptr;
+}
+
+enum RenderLayer {
+    LAYER_ACTORS = 1,
+    LAYER_PROJECTILES
+};
+
+// Một quad đã tính sẵn 4 đỉnh (TL, TR, BR, BL) và UV, texture null = quad tô màu.
+struct QueuedQuad {
+    SDL_Texture* texture;
+    SDL_FPoint corners[4];
+    float u0, v0, u1, v1;
+    SDL_Color color;
+};
+
+// Gom sprite trong frame, sắp theo (layer, texture, y) rồi vẽ mỗi dãy cùng texture bằng một lần SDL_RenderGeometry.
+struct RenderQueue {
+    struct TextureInfo { SDL_Texture* texture; int w, h; };
+
+    std::vector<QueuedQuad> quads;
+    std::vector<std::pair<Uint64, Uint32>> order;
+    std::vector<TextureInfo> textures;
+    std::vector<SDL_Vertex> vertices;
+    std::vector<int> indices;
+    int drawCalls = 0;
+    int spriteCount = 0;
+
+    void clear() {
+        quads.clear();
+        order.clear();
+        textures.clear();
+    }
+
+    // Chỉ số nhỏ của texture trong frame (0 = không texture), số texture mỗi frame rất ít nên tìm tuyến tính.
+    int textureIndex(SDL_Texture* texture) {
+        if (!texture) return 0;
+        for (size_t i = 0; i < textures.size(); i++) {
+            if (textures[i].texture == texture) return (int)i + 1;
+        }
+        TextureInfo info = { texture, 1, 1 };
+        SDL_QueryTexture(texture, nullptr, nullptr, &info.w, &info.h);
+        textures.push_back(info);
+        return (int)textures.size();
+    }
+
+    void push(RenderLayer layer, int texIndex, float depthY, const QueuedQuad& quad) {
+        Uint64 depth = (Uint64)std::max(0.0f, std::min(depthY + 4096.0f, 16383.0f) * 1024.0f);
+        Uint64 key = ((Uint64)layer << 56) | ((Uint64)(texIndex & 0xFFFF) << 40) | (depth & 0xFFFFFF) << 16;
+        order.push_back({ key | (quads.size() & 0xFFFF), (Uint32)quads.size() });
+        quads.push_back(quad);
+    }
+
+    // rect: vùng vẽ trên màn hình, src: vùng pixel trong texture (null = cả texture), angle: độ, quay quanh tâm.
+    void pushSprite(RenderLayer layer, SDL_Texture* texture, const SDL_Rect* src, const SDL_FRect& rect, float angle, SDL_RendererFlip flip, SDL_Color color, float depthY) {
+        int texIndex = textureIndex(texture);
+        QueuedQuad quad;
+        quad.texture = texture;
+        quad.color = color;
+        quad.u0 = 0; quad.v0 = 0; quad.u1 = 1; quad.v1 = 1;
+        if (texture && src) {
+            const TextureInfo& info = textures[texIndex - 1];
+            quad.u0 = (float)src->x / info.w;
+            quad.v0 = (float)src->y / info.h;
+            quad.u1 = (float)(src->x + src->w) / info.w;
+            quad.v1 = (float)(src->y + src->h) / info.h;
+        }
+        if (flip & SDL_FLIP_HORIZONTAL) std::swap(quad.u0, quad.u1);
+        if (flip & SDL_FLIP_VERTICAL) std::swap(quad.v0, quad.v1);
+
+        if (angle == 0) {
+            quad.corners[0] = { rect.x, rect.y };
+            quad.corners[1] = { rect.x + rect.w, rect.y };
+            quad.corners[2] = { rect.x + rect.w, rect.y + rect.h };
+            quad.corners[3] = { rect.x, rect.y + rect.h };
+        }
+        else {
+            // Quay theo chiều kim đồng hồ như SDL_RenderCopyEx (trục y hướng xuống)
+            float radians = angle * (float)M_PI / 180.0f;
+            float c = std::cos(radians), s = std::sin(radians);
+            float cx = rect.x + rect.w * 0.5f, cy = rect.y + rect.h * 0.5f;
+            float hw = rect.w * 0.5f, hh = rect.h * 0.5f;
+            const float offsets[4][2] = { { -hw, -hh }, { hw, -hh }, { hw, hh }, { -hw, hh } };
+            for (int i = 0; i < 4; i++) {
+                quad.corners[i] = { cx + offsets[i][0] * c - offsets[i][1] * s, cy + offsets[i][0] * s + offsets[i][1] * c };
+            }
+        }
+        push(layer, texIndex, depthY, quad);
+    }
+
+    void flushBatch(SDL_Texture* texture) {
+        if (indices.empty()) return;
+        renderGeometry(texture, vertices.data(), (int)vertices.size(), indices.data(), (int)indices.size());
+        drawCalls++;
+        vertices.clear();
+        indices.clear();
+    }
+
+    void flush() {
+        PROFILE_ZONE("submitRenderQueue");
+        drawCalls = 0;
+        spriteCount = (int)quads.size();
+        std::sort(order.begin(), order.end());
+
+        vertices.clear();
+        indices.clear();
+        SDL_Texture* batchTexture = nullptr;
+        for (const auto& entry : order) {
+            const QueuedQuad& quad = quads[entry.second];
+            if (quad.texture != batchTexture) {
+                flushBatch(batchTexture);
+                batchTexture = quad.texture;
+            }
+            int base = (int)vertices.size();
+            const float us[4] = { quad.u0, quad.u1, quad.u1, quad.u0 };
+            const float vs[4] = { quad.v0, quad.v0, quad.v1, quad.v1 };
+            for (int i = 0; i < 4; i++) {
+                vertices.push_back({ quad.corners[i], quad.color, { us[i], vs[i] } });
+            }
+            const int quadIndices[6] = { 0, 1, 2, 0, 2, 3 };
+            for (int index : quadIndices) indices.push_back(base + index);
+        }
+        flushBatch(batchTexture);
+        clear();
+    }
+};
+
+RenderQueue renderQueue;
+long long totalQueueDrawCalls = 0;
+long long totalQueueSprites = 0;
+long long renderedFrames = 0;
+
+// Đưa frame của clip vào hàng đợi, dst là kích thước khung gốc, bù lại phần viền đã bị cắt khi đóng gói atlas.
+void queueClipFrame(const Animation& clip, size_t frameIndex, const SDL_FRect& dst, SDL_RendererFlip flip, SDL_Color tint) {
+    if (frameIndex >= clip.textures.size()) return;
+    if (!clip.loaded) {
+        // Placeholder: khung mờ theo màu tint cho tới khi atlas của clip được upload.
+        SDL_FRect rect = { dst.x + dst.w * 0.25f, dst.y + dst.h * 0.15f, dst.w * 0.5f, dst.h * 0.7f };
+        renderQueue.pushSprite(LAYER_ACTORS, nullptr, nullptr, rect, 0, SDL_FLIP_NONE, { tint.r, tint.g, tint.b, 96 }, dst.y + dst.h);
+        return;
+    }
+    SDL_Texture* texture = clip.textures[frameIndex];
+    const SDL_Rect& trim = clip.trims[frameIndex];
+    if (!texture || trim.w == 0 || clip.frameWidth == 0 || clip.frameHeight == 0) return;
+
+    float scaleX = dst.w / clip.frameWidth;
+    float scaleY = dst.h / clip.frameHeight;
+    int offsetX = (flip & SDL_FLIP_HORIZONTAL) ? clip.frameWidth - trim.x - trim.w : trim.x;
+    int offsetY = (flip & SDL_FLIP_VERTICAL) ? clip.frameHeight - trim.y - trim.h : trim.y;
+    SDL_FRect rect = { dst.x + offsetX * scaleX, dst.y + offsetY * scaleY, trim.w * scaleX, trim.h * scaleY };
+    renderQueue.pushSprite(LAYER_ACTORS, texture, &clip.frames[frameIndex], rect, 0, flip, tint, dst.y + dst.h);
 }
 
-void renderUI() {
-    int healthBarX = 10, healthBarY = 10, healthBarWidth = 200, healthBarHeight = 20;
-    float healthRatio = static_cast<float>(player.health) / MAX_HEALTH;
-    if (healthRatio < 0) healthRatio = 0.0f;
-    SDL_Rect healthBg = { healthBarX, healthBarY, healthBarWidth, healthBarHeight };
-    SDL_SetRenderDrawColor(renderer, 255, 0, 0, 255);
-    SDL_RenderFillRect(renderer, &healthBg);
-    SDL_Rect healthFill = { healthBarX, healthBarY, static_cast<int>(healthBarWidth * healthRatio), healthBarHeight };
-    SDL_SetRenderDrawColor(renderer, 0, 255, 0, 255);
-    SDL_RenderFillRect(renderer, &healthFill);
-    SDL_Rect healthBorder = { healthBarX - 2, healthBarY - 2, healthBarWidth + 4, healthBarHeight + 4 };
-    SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
-    SDL_RenderDrawRect(renderer, &healthBorder);
+void queueSprite(const SpriteDraw& sprite, float alpha) {
+    SDL_FRect rect = { lerp(sprite.prevX, sprite.x, alpha), lerp(sprite.prevY, sprite.y, alpha), sprite.w, sprite.h };
+    if (sprite.clip) queueClipFrame(*sprite.clip, sprite.frame, rect, sprite.flip, sprite.tint);
+    else if (projectileTexture) renderQueue.pushSprite(LAYER_PROJECTILES, projectileTexture, nullptr, rect, sprite.angle, SDL_FLIP_NONE, { 255, 255, 255, 255 }, 0);
+}
 
-    int levelBarX = 10, levelBarY = 40, levelBarWidth = 200, levelBarHeight = 15;
-    float levelProgress = gameTime / (LEVEL_DURATION * level);
-    SDL_Rect levelBg = { levelBarX, levelBarY, levelBarWidth, levelBarHeight };
-    SDL_SetRenderDrawColor(renderer, 50, 50, 50, 255);
-    SDL_RenderFillRect(renderer, &levelBg);
-    SDL_Rect levelFill = { levelBarX, levelBarY, static_cast<int>(levelBarWidth * levelProgress), levelBarHeight };
-    SDL_SetRenderDrawColor(renderer, 0, 255, 0, 255);
-    SDL_RenderFillRect(renderer, &levelFill);
-    SDL_Rect levelBorder = { levelBarX - 2, levelBarY - 2, levelBarWidth + 4, levelBarHeight + 4 };
-    SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
-    SDL_RenderDrawRect(renderer, &levelBorder);
+// Mọi particle của mọi emitter là quad tô màu, vẽ bằng một lần SDL_RenderGeometry.
+// Buffer đỉnh/chỉ số chỉ lớn lên, không cấp phát lại mỗi frame.
+std::vector<SDL_Vertex> particleVertices;
+std::vector<int> particleIndices;
+
+void drawParticles(const RenderSnapshot& snap) {
+    size_t total = 0;
+    for (int e = 0; e < NUM_PARTICLE_EMITTERS; e++) total += snap.particles[e].size();
+    if (total == 0) return;
+
+    if (particleIndices.size() < total * 6) {
+        size_t first = particleIndices.size() / 6;
+        particleIndices.resize(total * 6);
+        for (size_t q = first; q < total; q++) {
+            int base = (int)(q * 4);
+            const int quadIndices[6] = { 0, 1, 2, 0, 2, 3 };
+            for (int k = 0; k < 6; k++) particleIndices[q * 6 + k] = base + quadIndices[k];
+        }
+    }
+    particleVertices.resize(total * 4);
+
+    SDL_Vertex* v = particleVertices.data();
+    for (int e = 0; e < NUM_PARTICLE_EMITTERS; e++) {
+        const ParticleEmitterDef& def = PARTICLE_EMITTERS[e];
+        for (const SDL_FPoint& p : snap.particles[e]) {
+            v[0] = { { p.x, p.y }, def.color, { 0, 0 } };
+            v[1] = { { p.x + def.size, p.y }, def.color, { 0, 0 } };
+            v[2] = { { p.x + def.size, p.y + def.size }, def.color, { 0, 0 } };
+            v[3] = { { p.x, p.y + def.size }, def.color, { 0, 0 } };
+            v += 4;
+        }
+    }
+    renderGeometry(nullptr, particleVertices.data(), (int)(total * 4), particleIndices.data(), (int)(total * 6));
+    renderQueue.drawCalls++;
+    renderQueue.spriteCount += (int)total;
+}
 
-    renderText("Score: " + std::to_string(score), 10, 70);
-    renderText("Level: " + std::to_string(level), 10, 100);
-    renderText("Combo: " + std::to_string(combo), 10, 280);
+void renderEntities(const RenderSnapshot& snap) {
+    PROFILE_ZONE("renderEntities");
+    if (maps[snap.currentMap]) renderCopy(maps[snap.currentMap], nullptr, nullptr);
 
-    const int barWidth = 200;
-    const int barHeight = 15;
-    float cooldownRatio = qCooldown / qCooldownMax;
-    SDL_Rect cooldownBg = { 10, SCREEN_HEIGHT - 30, barWidth, barHeight };
-    SDL_SetRenderDrawColor(renderer, 50, 50, 50, 255);
-    SDL_RenderFillRect(renderer, &cooldownBg);
-    SDL_Rect cooldownFill = { 10, SCREEN_HEIGHT - 30, static_cast<int>(barWidth * (1 - cooldownRatio)), barHeight };
-    SDL_SetRenderDrawColor(renderer, 0, 150, 255, 255);
-    SDL_RenderFillRect(renderer, &cooldownFill);
-    SDL_Color qColor = qReady ? SDL_Color{ 0, 255, 0, 255 } : SDL_Color{ 255, 0, 0, 255 };
-    renderText("[Q] Shoot", SCREEN_WIDTH - 120, SCREEN_HEIGHT - 30, qColor);
+    setDrawColor(255, 0, 0, 255);
+    SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_BLEND);
+    const int size = 40;
+    for (const SDL_FPoint& marker : snap.markers) {
+        renderDrawLine(marker.x - size, marker.y - size, marker.x + size, marker.y + size);
+        renderDrawLine(marker.x + size, marker.y - size, marker.x - size, marker.y + size);
+    }
+
+    if (snap.hasPlayer) queueSprite(snap.player, snap.alpha);
+    for (const SpriteDraw& sprite : snap.enemies) queueSprite(sprite, snap.alpha);
+    for (const SpriteDraw& sprite : snap.projectiles) queueSprite(sprite, snap.alpha);
+
+    renderQueue.flush();
+    drawParticles(snap);
+    totalQueueDrawCalls += renderQueue.drawCalls;
+    totalQueueSprites += renderQueue.spriteCount;
+    renderedFrames++;
+}
+
+#ifndef DODGE_NO_PROFILER
+// Overlay F3: đồ thị thời gian frame (vạch 16.7 ms = 60 FPS), trung bình/tối đa theo zone trong
+// PROFILE_WINDOW frame gần nhất, số entity và draw call của frame đang vẽ.
+void renderProfilerOverlay(const RenderSnapshot& snap) {
+    const int x = SCREEN_WIDTH - 520, y = 10, width = 510, graphHeight = 80;
+    const float graphMaxMs = 50.0f;
+    int height = graphHeight + 158 + 24 * static_cast<int>(profiler.zones.size());
+    SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_BLEND);
+    SDL_Rect box = { x, y, width, height };
+    setDrawColor(0, 0, 0, 180);
+    renderFillRect(&box);
+
+    SDL_Rect bars[PROFILE_HISTORY];
+    const int barWidth = 2;
+    for (int i = 0; i < PROFILE_HISTORY; i++) {
+        float ms = profiler.frameMs[(profiler.frameCursor + i) % PROFILE_HISTORY];
+        int h = static_cast<int>(std::min(ms, graphMaxMs) / graphMaxMs * graphHeight);
+        bars[i] = { x + 10 + i * barWidth, y + 10 + graphHeight - h, barWidth, h };
+    }
+    setDrawColor(0, 200, 255, 255);
+    renderFillRects(bars, PROFILE_HISTORY);
+    int targetY = y + 10 + graphHeight - static_cast<int>(1000.0f / 60.0f / graphMaxMs * graphHeight);
+    setDrawColor(255, 255, 0, 255);
+    renderDrawLine(x + 10, targetY, x + 10 + PROFILE_HISTORY * barWidth, targetY);
+
+    char line[128];
+    int textY = y + graphHeight + 20;
+    double fps = profiler.frameAvgMs > 0.0 ? 1000.0 / profiler.frameAvgMs : 0.0;
+    std::snprintf(line, sizeof(line), "Frame %.2f ms avg, %.2f ms max (%.0f FPS)", profiler.frameAvgMs, profiler.frameMaxMs, fps);
+    renderText(line, x + 10, textY);
+    textY += 24;
+    size_t particleCount = 0;
+    for (int e = 0; e < NUM_PARTICLE_EMITTERS; e++) particleCount += snap.particles[e].size();
+    std::snprintf(line, sizeof(line), "Enemies %zu  Projectiles %zu  Particles %zu", snap.enemies.size(), snap.projectiles.size(), particleCount);
+    renderText(line, x + 10, textY);
+    textY += 24;
+    std::snprintf(line, sizeof(line), "Batched draw calls %d  Sprites %d", renderQueue.drawCalls, renderQueue.spriteCount);
+    renderText(line, x + 10, textY);
+    textY += 24;
+    std::snprintf(line, sizeof(line), "Draw calls %d  Texture binds %d  Color changes %d", lastRenderStats.drawCalls, lastRenderStats.textureBinds, lastRenderStats.colorChanges);
+    renderText(line, x + 10, textY);
+    textY += 24;
+    std::snprintf(line, sizeof(line), "Heap allocations %llu", static_cast<unsigned long long>(frameAllocations));
+    renderText(line, x + 10, textY);
+    textY += 30;
+    for (const ZoneStats& stats : profiler.zones) {
+        std::snprintf(line, sizeof(line), "%-20s %7.3f avg %7.3f max", stats.name, stats.avgMs, stats.maxMs);
+        renderText(line, x + 10, textY, { 200, 200, 200, 255 });
+        textY += 24;
+    }
+}
+#endif
+
+// Đặt trước chỗ cho mọi bộ đệm dùng lại mỗi frame theo giới hạn của gameplay (tổng enemy và marker
+// không quá MAX_CONCURRENT_ENEMIES, đạn không quá MAX_PROJECTILES) để frame PLAYING không cấp phát.
+void reserveFrameBuffers() {
+    const size_t sprites = MAX_CONCURRENT_ENEMIES + MAX_PROJECTILES + 1;
+    for (RenderSnapshot& snap : snapshots) {
+        snap.enemies.reserve(MAX_CONCURRENT_ENEMIES);
+        snap.projectiles.reserve(MAX_PROJECTILES);
+        snap.markers.reserve(MAX_CONCURRENT_ENEMIES);
+        for (auto& points : snap.particles) points.reserve(FRAME_PARTICLE_RESERVE);
+        snap.audio.sounds.reserve(64);
+    }
+    audioEvents.sounds.reserve(64);
+    pendingCommands.reserve(64);
+    tickCommands.reserve(16);
+    // MAX_CONCURRENT_ENEMIES enemy chỉ chiếm một chunk ENEMY_GRAIN.
+    if (chunkKills.empty()) chunkKills.resize(1);
+    chunkKills[0].reserve(MAX_CONCURRENT_ENEMIES);
+    renderQueue.quads.reserve(sprites);
+    renderQueue.order.reserve(sprites);
+    renderQueue.vertices.reserve(sprites * 4);
+    renderQueue.indices.reserve(sprites * 6);
+    renderQueue.textures.reserve(32);
+    particleVertices.reserve(FRAME_PARTICLE_RESERVE * NUM_PARTICLE_EMITTERS * 4);
+    particleIndices.reserve(FRAME_PARTICLE_RESERVE * NUM_PARTICLE_EMITTERS * 6);
+    staticTextKey.reserve(64);
+    const size_t textGlyphs = 128;
+    dynamicText.vertices.reserve(textGlyphs * 4);
+    dynamicText.indices.reserve(textGlyphs * 6);
+    textVertices.reserve(textGlyphs * 4);
+}
+
+// Chỉ đọc snapshot (và các giá trị chỉ luồng chính sửa như âm lượng), không đọc trạng thái mô phỏng.
+// snap.alpha: phần tick chưa mô phỏng (0..1), dùng để nội suy vị trí giữa tick trước và tick hiện tại.
+void render(const RenderSnapshot& snap) {
+    PROFILE_ZONE("render");
+    frameArena.reset();
+    beginRenderStats();
+    renderQueue.drawCalls = 0;
+    renderQueue.spriteCount = 0;
+    setDrawColor(0, 0, 0, 255);
+    renderClear();
+
+    switch (snap.gameState) {
+    case MENU: {
+        renderMenu();
+        break;
+    }
+    case SETTINGS: {
+        if (menuBackground) renderCopy(menuBackground, nullptr, nullptr);
+        renderStaticText("Settings", SCREEN_WIDTH / 2 - 50, SCREEN_HEIGHT / 2 - 200, { 255, 215, 0, 255 });
+
+        SDL_Rect musicBar = { SCREEN_WIDTH / 2 - 100, SCREEN_HEIGHT / 2 - 100, 200, 20 };
+        setDrawColor(50, 50, 50, 255);
+        renderFillRect(&musicBar);
+        int musicFillWidth = (musicVolume * 200) / 128;
+        SDL_Rect musicFill = { SCREEN_WIDTH / 2 - 100, SCREEN_HEIGHT / 2 - 100, musicFillWidth, 20 };
+        setDrawColor(0, 255, 0, 255);
+        renderFillRect(&musicFill);
+        SDL_Rect musicKnob = { SCREEN_WIDTH / 2 - 100 + musicFillWidth - 5, SCREEN_HEIGHT / 2 - 105, 10, 30 };
+        setDrawColor(255, 255, 255, 255);
+        renderFillRect(&musicKnob);
+        renderText(frameArena.format("Music: %d", musicVolume), SCREEN_WIDTH / 2 - 50, SCREEN_HEIGHT / 2 - 130, { 255, 255, 255, 255 });
+
+        SDL_Rect sfxBar = { SCREEN_WIDTH / 2 - 100, SCREEN_HEIGHT / 2 - 40, 200, 20 };
+        setDrawColor(50, 50, 50, 255);
+        renderFillRect(&sfxBar);
+        int sfxFillWidth = (sfxVolume * 200) / 128;
+        SDL_Rect sfxFill = { SCREEN_WIDTH / 2 - 100, SCREEN_HEIGHT / 2 - 40, sfxFillWidth, 20 };
+        setDrawColor(0, 255, 0, 255);
+        renderFillRect(&sfxFill);
+        SDL_Rect sfxKnob = { SCREEN_WIDTH / 2 - 100 + sfxFillWidth - 5, SCREEN_HEIGHT / 2 - 45, 10, 30 };
+        setDrawColor(255, 255, 255, 255);
+        renderFillRect(&sfxKnob);
+        renderText(frameArena.format("SFX: %d", sfxVolume), SCREEN_WIDTH / 2 - 50, SCREEN_HEIGHT / 2 - 70, { 255, 255, 255, 255 });
+
+        Button backButton = { {SCREEN_WIDTH / 2 - 100, SCREEN_HEIGHT / 2 + 60, 200, 40}, "Back", {255, 255, 255, 255}, false };
+        int mouseX, mouseY;
+        SDL_GetMouseState(&mouseX, &mouseY);
+        backButton.hovered = (mouseX >= backButton.rect.x && mouseX <= backButton.rect.x + backButton.rect.w &&
+                             mouseY >= backButton.rect.y && mouseY <= backButton.rect.y + backButton.rect.h);
+        renderButton(backButton);
+        break;
+    }
+    case PLAYING:
+    case PRE_LEVEL_UP:
+    case LEVEL_UP: {
+        renderEntities(snap);
+        renderUI(snap);
+        if (snap.gameState == PRE_LEVEL_UP) {
+            renderText(frameArena.format("Level Up in %ds", (int)snap.preLevelUpTimer + 1), SCREEN_WIDTH / 2 - 100, SCREEN_HEIGHT / 2, { 255, 255, 0 });
+        }
+        else if (snap.gameState == LEVEL_UP) {
+            renderText(frameArena.format("Level Up! Level %d", snap.level + 1), SCREEN_WIDTH / 2 - 100, SCREEN_HEIGHT / 2, { 255, 255, 0 });
+        }
+        break;
+    }
+    case UPGRADE_MENU: {
+        if (maps[snap.currentMap]) renderCopy(maps[snap.currentMap], nullptr, nullptr);
+        setDrawColor(0, 0, 0, 128);
+        renderFillRect(nullptr);
+
+        SDL_Rect upgradeBox = { SCREEN_WIDTH / 2 - 200, SCREEN_HEIGHT / 2 - 200, 400, 400 };
+        setDrawColor(50, 50, 50, 255);
+        renderFillRect(&upgradeBox);
+        setDrawColor(255, 255, 255, 255);
+        renderDrawRect(&upgradeBox);
+
+        Button speedButton = { {SCREEN_WIDTH / 2 - 150, SCREEN_HEIGHT / 2 - 120, 300, 40}, "1: Increase Speed", {0, 255, 0}, false };
+        Button cooldownButton = { {SCREEN_WIDTH / 2 - 150, SCREEN_HEIGHT / 2 - 60, 300, 40}, "2: Reduce Cooldown", {0, 255, 0}, false };
+        Button damageButton = { {SCREEN_WIDTH / 2 - 150, SCREEN_HEIGHT / 2, 300, 40}, "3: Increase Damage", {0, 255, 0}, false };
+        Button shotgunButton = { {SCREEN_WIDTH / 2 - 150, SCREEN_HEIGHT / 2 + 60, 300, 40}, snap.shotgunUnlocked ? "4: Shotgun (Taken)" : "4: Shotgun", snap.shotgunUnlocked ? SDL_Color{100, 100, 100} : SDL_Color{0, 255, 0}, false };
+
+        int mouseX, mouseY;
+        SDL_GetMouseState(&mouseX, &mouseY);
+        speedButton.hovered = (mouseX >= speedButton.rect.x && mouseX <= speedButton.rect.x + speedButton.rect.w &&
+                              mouseY >= speedButton.rect.y && mouseY <= speedButton.rect.y + speedButton.rect.h);
+        cooldownButton.hovered = (mouseX >= cooldownButton.rect.x && mouseX <= cooldownButton.rect.x + cooldownButton.rect.w &&
+                                 mouseY >= cooldownButton.rect.y && mouseY <= cooldownButton.rect.y + cooldownButton.rect.h);
+        damageButton.hovered = (mouseX >= damageButton.rect.x && mouseX <= damageButton.rect.x + damageButton.rect.w &&
+                               mouseY >= damageButton.rect.y && mouseY <= damageButton.rect.y + damageButton.rect.h);
+        shotgunButton.hovered = (!snap.shotgunUnlocked && mouseX >= shotgunButton.rect.x && mouseX <= shotgunButton.rect.x + shotgunButton.rect.w &&
+                                mouseY >= shotgunButton.rect.y && mouseY <= shotgunButton.rect.y + shotgunButton.rect.h);
+
+        renderStaticText("Choose an Upgrade", SCREEN_WIDTH / 2 - 80, SCREEN_HEIGHT / 2 - 160, { 255, 215, 0 });
+        renderButton(speedButton);
+        renderButton(cooldownButton);
+        renderButton(damageButton);
+        renderButton(shotgunButton);
+        break;
+    }
+    case PAUSED: {
+        setDrawColor(0, 0, 0, 128);
+        renderFillRect(nullptr);
+
+        SDL_Rect pauseBox = { SCREEN_WIDTH / 2 - 150, SCREEN_HEIGHT / 2 - 150, 300, 300 };
+        setDrawColor(50, 50, 50, 255);
+        renderFillRect(&pauseBox);
+        setDrawColor(255, 255, 255, 255);
+        renderDrawRect(&pauseBox);
+
+        Button resumeButton = { {SCREEN_WIDTH / 2 - 100, SCREEN_HEIGHT / 2 - 60, 200, 40}, "Resume", {0, 255, 0}, false };
+        Button settingsButton = { {SCREEN_WIDTH / 2 - 100, SCREEN_HEIGHT / 2, 200, 40}, "Settings", {255, 215, 0}, false };
+        Button quitButton = { {SCREEN_WIDTH / 2 - 100, SCREEN_HEIGHT / 2 + 60, 200, 40}, "Quit", {255, 0, 0}, false };
+
+        int mouseX, mouseY;
+        SDL_GetMouseState(&mouseX, &mouseY);
+        resumeButton.hovered = (mouseX >= resumeButton.rect.x && mouseX <= resumeButton.rect.x + resumeButton.rect.w &&
+                               mouseY >= resumeButton.rect.y && mouseY <= resumeButton.rect.y + resumeButton.rect.h);
+        settingsButton.hovered = (mouseX >= settingsButton.rect.x && mouseX <= settingsButton.rect.x + settingsButton.rect.w &&
+                                 mouseY >= settingsButton.rect.y && mouseY <= settingsButton.rect.y + settingsButton.rect.h);
+        quitButton.hovered = (mouseX >= quitButton.rect.x && mouseX <= quitButton.rect.x + quitButton.rect.w &&
+                             mouseY >= quitButton.rect.y && mouseY <= quitButton.rect.y + quitButton.rect.h);
+
+        renderStaticText("Paused", SCREEN_WIDTH / 2 - 40, SCREEN_HEIGHT / 2 - 120, { 255, 255, 0 });
+        renderButton(resumeButton);
+        renderButton(settingsButton);
+        renderButton(quitButton);
+        break;
+    }
+    case GAME_OVER: {
+        if (maps[snap.currentMap]) renderCopy(maps[snap.currentMap], nullptr, nullptr);
+        if (snap.hasPlayer) queueSprite(snap.player, 1.0f);
+        for (const SpriteDraw& sprite : snap.enemies) queueSprite(sprite, snap.alpha);
+        renderQueue.flush();
+
+        if (snap.deathTimer <= 0) {
+            setDrawColor(0, 0, 0, 128);
+            renderFillRect(nullptr);
+
+            SDL_Rect deathBox = { SCREEN_WIDTH / 2 - 200, SCREEN_HEIGHT / 2 - 200, 400, 400 };
+            setDrawColor(50, 50, 50, 255);
+            renderFillRect(&deathBox);
+            setDrawColor(255, 255, 255, 255);
+            renderDrawRect(&deathBox);
+
+            Button restartButton = { {SCREEN_WIDTH / 2 - 150, SCREEN_HEIGHT / 2 - 60, 300, 40}, "Restart", {0, 255, 0, 255}, false };
+            Button settingsButton = { {SCREEN_WIDTH / 2 - 150, SCREEN_HEIGHT / 2 + 20, 300, 40}, "Settings", {255, 215, 0, 255}, false };
+            Button quitButton = { {SCREEN_WIDTH / 2 - 150, SCREEN_HEIGHT / 2 + 100, 300, 40}, "Quit", {255, 0, 0, 255}, false };
+
+            int mouseX, mouseY;
+            SDL_GetMouseState(&mouseX, &mouseY);
+            restartButton.hovered = (mouseX >= restartButton.rect.x && mouseX <= restartButton.rect.x + restartButton.rect.w &&
+                                    mouseY >= restartButton.rect.y && mouseY <= restartButton.rect.y + restartButton.rect.h);
+            settingsButton.hovered = (mouseX >= settingsButton.rect.x && mouseX <= settingsButton.rect.x + settingsButton.rect.w &&
+                                     mouseY >= settingsButton.rect.y && mouseY <= settingsButton.rect.y + settingsButton.rect.h);
+            quitButton.hovered = (mouseX >= quitButton.rect.x && mouseX <= quitButton.rect.x + quitButton.rect.w &&
+                                 mouseY >= quitButton.rect.y && mouseY <= quitButton.rect.y + quitButton.rect.h);
+
+            renderStaticText("Game Over", SCREEN_WIDTH / 2 - 80, SCREEN_HEIGHT / 2 - 160, { 255, 0, 0, 255 });
+            renderText(frameArena.format("Score: %d", snap.score), SCREEN_WIDTH / 2 - 80, SCREEN_HEIGHT / 2 - 120, { 255, 255, 255, 255 });
+            renderButton(restartButton);
+            renderButton(settingsButton);
+            renderButton(quitButton);
+        }
+        break;
+    }
+    }
+
+    if (!assets.finished) renderLoadingBar(assets.progress());
+#ifndef DODGE_NO_PROFILER
+    if (profiler.overlay) renderProfilerOverlay(snap);
+#endif
+
+    PROFILE_ZONE("SDL_RenderPresent");
+    Uint64 presentStart = SDL_GetPerformanceCounter();
+    SDL_RenderPresent(renderer);
+    presentMs = (SDL_GetPerformanceCounter() - presentStart) * 1000.0 / SDL_GetPerformanceFrequency();
+}
+
+// So sánh mọi kernel SIMD khả dụng với bản scalar trên count enemy ngẫu nhiên rồi đo thời gian.
+// Trả về false nếu có kernel cho kết quả khác bản scalar dù chỉ một bit.
+bool runSteeringBench(size_t count) {
+    count = std::min(count, MAX_ENEMIES);
+    const int iterations = 200;
+    const float deltaTime = 1.0f / DEFAULT_TICK_RATE;
+    const float speed = ENEMY_SPEED;
+    const float targetX = SCREEN_WIDTH / 2.0f - PLAYER_SIZE / 2.0f;
+    const float targetY = SCREEN_HEIGHT / 2.0f - PLAYER_SIZE / 2.0f;
+
+    Rng rng;
+    rng.seed(12345, 0);
+    enemies.clear();
+    for (size_t i = 0; i < count; i++) {
+        int index = enemies.add(static_cast<EnemyType>(rng.below(3)), rng.unit() * SCREEN_WIDTH, rng.unit() * SCREEN_HEIGHT, 0.0f);
+        int roll = rng.below(10);
+        if (roll == 0) enemies.active[index] = 0;
+        else if (roll == 1) enemies.state[index] = DYING;
+    }
+    const std::vector<float> startX(enemies.x.begin(), enemies.x.begin() + count);
+    const std::vector<float> startY(enemies.y.begin(), enemies.y.begin() + count);
+
+    std::vector<float> refVx, refVy, refX, refY;
+    std::vector<Uint8> refInRange;
+    bool ok = true;
+    for (int k = STEER_SCALAR; k <= STEER_AVX2; k++) {
+        SteeringKernelType kernel = static_cast<SteeringKernelType>(k);
+        if (!steeringKernelSupported(kernel)) {
+            std::cout << STEERING_KERNEL_NAMES[k] << ": not supported" << std::endl;
+            continue;
+        }
+        std::copy(startX.begin(), startX.end(), enemies.x.begin());
+        std::copy(startY.begin(), startY.end(), enemies.y.begin());
+        std::fill(enemies.vx.begin(), enemies.vx.begin() + count, 0.0f);
+        std::fill(enemies.vy.begin(), enemies.vy.begin() + count, 0.0f);
+        runSteering(kernel, 0, count, targetX, targetY, speed, deltaTime);
+
+        size_t valueMismatches = 0;
+        size_t maskMismatches = 0;
+        if (kernel == STEER_SCALAR) {
+            refVx.assign(enemies.vx.begin(), enemies.vx.begin() + count);
+            refVy.assign(enemies.vy.begin(), enemies.vy.begin() + count);
+            refX.assign(enemies.x.begin(), enemies.x.begin() + count);
+            refY.assign(enemies.y.begin(), enemies.y.begin() + count);
+            refInRange.assign(enemies.inRange.begin(), enemies.inRange.begin() + count);
+        }
+        else {
+            for (size_t i = 0; i < count; i++) {
+                // So từng bit: replay chỉ đúng khi mọi kernel cho kết quả giống hệt nhau.
+                if (std::memcmp(&enemies.vx[i], &refVx[i], sizeof(float)) != 0 || std::memcmp(&enemies.vy[i], &refVy[i], sizeof(float)) != 0 ||
+                    std::memcmp(&enemies.x[i], &refX[i], sizeof(float)) != 0 || std::memcmp(&enemies.y[i], &refY[i], sizeof(float)) != 0) {
+                    valueMismatches++;
+                }
+                if (enemies.inRange[i] != refInRange[i]) maskMismatches++;
+            }
+        }
+        bool equivalent = valueMismatches == 0 && maskMismatches == 0;
+        ok = ok && equivalent;
+
+        Uint64 start = SDL_GetPerformanceCounter();
+        for (int it = 0; it < iterations; it++) {
+            runSteering(kernel, 0, count, targetX, targetY, speed, deltaTime);
+        }
+        double seconds = static_cast<double>(SDL_GetPerformanceCounter() - start) / SDL_GetPerformanceFrequency();
+        std::cout << STEERING_KERNEL_NAMES[k] << ": " << seconds * 1e6 / iterations << " us/tick for " << count
+            << " enemies, value mismatches " << valueMismatches << ", mask mismatches " << maskMismatches
+            << (equivalent ? "" : " (MISMATCH)") << std::endl;
+    }
+    if (jobs.participants > 1) {
+        Uint64 start = SDL_GetPerformanceCounter();
+        for (int it = 0; it < iterations; it++) {
+            steerEnemies(steeringKernel, count, targetX, targetY, speed, deltaTime);
+        }
+        double seconds = static_cast<double>(SDL_GetPerformanceCounter() - start) / SDL_GetPerformanceFrequency();
+        std::cout << STEERING_KERNEL_NAMES[steeringKernel] << " x " << jobs.participants << " threads: "
+            << seconds * 1e6 / iterations << " us/tick for " << count << " enemies" << std::endl;
+    }
+    enemies.clear();
+    return ok;
+}
+
+void queueCommand(Uint8 command) {
+    if (!replayFile.is_open()) pendingCommands.push_back(command);
+}
+
+void applyCommand(Uint8 command) {
+    switch (command) {
+    case CMD_SHOOT: if (gameState == PLAYING) tryShoot(); break;
+    case CMD_START_GAME: resetGame(); break;
+    case CMD_PAUSE: if (gameState == PLAYING) gameState = PAUSED; break;
+    case CMD_RESUME: if (gameState == PAUSED) gameState = PLAYING; break;
+    case CMD_OPEN_SETTINGS: previousState = gameState; gameState = SETTINGS; break;
+    case CMD_CLOSE_SETTINGS: if (gameState == SETTINGS) gameState = previousState; break;
+    default:
+        if (command <= CMD_UPGRADE_4 && gameState == UPGRADE_MENU) applyUpgrade(command - CMD_UPGRADE_1 + 1);
+        break;
+    }
+}
+
+void seedRandomStreams(Uint64 seed) {
+    spawnRng.seed(seed, 1);
+    particleRng.seed(seed, 2);
+    mapRng.seed(seed, 3);
+    nextMap = mapRng.below(NUM_MAPS);
+}
+
+// FNV-1a trên toàn bộ trạng thái ảnh hưởng tới mô phỏng.
+struct StateHasher {
+    Uint32 hash = 2166136261u;
+
+    void bytes(const void* data, size_t size) {
+        const Uint8* p = static_cast<const Uint8*>(data);
+        for (size_t i = 0; i < size; i++) {
+            hash ^= p[i];
+            hash *= 16777619u;
+        }
+    }
+
+    template <typename T>
+    void value(const T& v) { bytes(&v, sizeof(v)); }
+
+    template <typename T>
+    void array(const std::vector<T>& v, size_t count) { if (count) bytes(v.data(), count * sizeof(T)); }
+};
+
+Uint32 stateChecksum() {
+    StateHasher h;
+    h.value(gameState);
+    h.value(score);
+    h.value(combo);
+    h.value(level);
+    h.value(gameTime);
+    h.value(upgradePoints);
+    h.value(qCooldown);
+    h.value(player.rect);
+    h.value(player.health);
+    h.value(player.playerState);
+    h.value(spawnRng.state);
+    h.value(mapRng.state);
+    h.value(currentMap);
+    h.value(nextMap);
+    size_t count = enemies.size();
+    h.value(count);
+    h.array(enemies.x, count);
+    h.array(enemies.y, count);
+    h.array(enemies.state, count);
+    h.array(enemies.health, count);
+    h.value(projectiles.size());
+    for (const auto& proj : projectiles) h.value(proj.rect);
+    h.value(markers.size());
+    return h.hash;
+}
+
+// Tick rate hỗ trợ cho --tick-rate và file replay.
+bool supportedTickRate(int rate) {
+    return rate == 60 || rate == 120 || rate == 240;
+}
+
+bool openRecording(const std::string& path, Uint64 seed) {
+    recordFile.open(path, std::ios::binary);
+    if (!recordFile) {
+        std::cout << "ERROR: Failed to open recording file: " << path << std::endl;
+        return false;
+    }
+    Uint32 rate = static_cast<Uint32>(tickRate);
+    Uint32 kernel = static_cast<Uint32>(steeringKernel);
+    recordFile.write(reinterpret_cast<const char*>(&REPLAY_MAGIC), sizeof(REPLAY_MAGIC));
+    recordFile.write(reinterpret_cast<const char*>(&REPLAY_VERSION), sizeof(REPLAY_VERSION));
+    recordFile.write(reinterpret_cast<const char*>(&seed), sizeof(seed));
+    recordFile.write(reinterpret_cast<const char*>(&rate), sizeof(rate));
+    recordFile.write(reinterpret_cast<const char*>(&kernel), sizeof(kernel));
+    return true;
+}
+
+// Đọc header replay; seed và tick rate của phiên ghi được dùng lại. Mọi kernel steering cho kết quả
+// giống hệt từng bit nên kernel ghi trong file chỉ để tham khảo, CPU thiếu kernel đó vẫn replay đúng.
+bool openReplay(const std::string& path, Uint64& seed) {
+    replayFile.open(path, std::ios::binary);
+    Uint32 magic = 0, version = 0, rate = 0, kernel = 0;
+    replayFile.read(reinterpret_cast<char*>(&magic), sizeof(magic));
+    replayFile.read(reinterpret_cast<char*>(&version), sizeof(version));
+    replayFile.read(reinterpret_cast<char*>(&seed), sizeof(seed));
+    replayFile.read(reinterpret_cast<char*>(&rate), sizeof(rate));
+    replayFile.read(reinterpret_cast<char*>(&kernel), sizeof(kernel));
+    if (!replayFile || magic != REPLAY_MAGIC || version != REPLAY_VERSION || !supportedTickRate(static_cast<int>(rate)) || kernel > STEER_AVX2) {
+        std::cout << "ERROR: Invalid replay file: " << path << std::endl;
+        replayFile.close();
+        return false;
+    }
+    tickRate = static_cast<int>(rate);
+    return true;
+}
+
+// Mỗi tick: 1 byte (4 bit phím + số lệnh), theo sau là các lệnh; mỗi CHECKSUM_INTERVAL tick thêm 4 byte checksum.
+void writeReplayTick() {
+    Uint8 header = static_cast<Uint8>((input.up ? KEY_UP : 0) | (input.down ? KEY_DOWN : 0) |
+        (input.left ? KEY_LEFT : 0) | (input.right ? KEY_RIGHT : 0) | (tickCommands.size() << 4));
+    recordFile.put(static_cast<char>(header));
+    if (!tickCommands.empty()) recordFile.write(reinterpret_cast<const char*>(tickCommands.data()), tickCommands.size());
+}
+
+bool readReplayTick() {
+    int header = replayFile.get();
+    if (header == EOF) return false;
+    input.up = (header & KEY_UP) != 0;
+    input.down = (header & KEY_DOWN) != 0;
+    input.left = (header & KEY_LEFT) != 0;
+    input.right = (header & KEY_RIGHT) != 0;
+    tickCommands.resize(header >> 4);
+    if (!tickCommands.empty()) replayFile.read(reinterpret_cast<char*>(tickCommands.data()), tickCommands.size());
+    return static_cast<bool>(replayFile);
+}
+
+// Một tick mô phỏng: lấy input của tick (người chơi/bot hoặc file replay), ghi lại nếu đang record,
+// áp dụng lệnh rồi update. Trả về false khi replay kết thúc hoặc bị lệch.
+bool simulateTick(float deltaTime) {
+    if (replayFile.is_open()) {
+        if (!readReplayTick()) {
+            std::cout << "Replay finished at tick " << simTick << std::endl;
+            replayFile.close();
+            return false;
+        }
+    }
+    else {
+        // Tối đa 15 lệnh mỗi tick (4 bit trong header); phần dư dời sang tick sau.
+        size_t count = std::min<size_t>(pendingCommands.size(), 15);
+        tickCommands.assign(pendingCommands.begin(), pendingCommands.begin() + count);
+        pendingCommands.erase(pendingCommands.begin(), pendingCommands.begin() + count);
+        if (recordFile.is_open()) writeReplayTick();
+    }
+
+    for (Uint8 command : tickCommands) applyCommand(command);
+    savePreviousPositions();
+    update(deltaTime);
+    simTick++;
+
+    if (simTick % CHECKSUM_INTERVAL == 0) {
+        Uint32 checksum = stateChecksum();
+        if (recordFile.is_open()) recordFile.write(reinterpret_cast<const char*>(&checksum), sizeof(checksum));
+        if (replayFile.is_open()) {
+            Uint32 expected = 0;
+            replayFile.read(reinterpret_cast<char*>(&expected), sizeof(expected));
+            if (replayFile && expected != checksum) {
+                std::cout << "ERROR: Replay diverged at tick " << simTick << " (expected " << std::hex << expected
+                    << ", got " << checksum << std::dec << ")" << std::endl;
+                replayFile.close();
+                return false;
+            }
+        }
+    }
+    return true;
 }
 
-void renderEntities() {
-    if (maps[currentMap]) SDL_RenderCopy(renderer, maps[currentMap], nullptr, nullptr);
+// Chụp trạng thái sau tick cuối của frame vào snap; chạy trên luồng mô phỏng.
+void captureSnapshot(RenderSnapshot& snap, float alpha) {
+    PROFILE_ZONE("captureSnapshot");
+    snap.gameState = gameState;
+    snap.alpha = alpha;
+    snap.currentMap = currentMap;
+    snap.nextMap = nextMap;
+
+    const Animation* playerClip = currentPlayerAnimation();
+    snap.hasPlayer = playerClip != nullptr;
+    if (playerClip) {
+        SDL_Color tint = (player.hurtTimer > 0 && gameState != GAME_OVER) ? SDL_Color{ 255, 100, 100, 255 } : SDL_Color{ 255, 255, 255, 255 };
+        snap.player = { playerClip, static_cast<Uint32>(playerClip->currentFrame), player.prevX, player.prevY,
+            player.rect.x, player.rect.y, PLAYER_SIZE, PLAYER_SIZE, 0.0f, playerClip->flip, tint };
+    }
+
+    snap.enemies.clear();
+    float playerCenterX = player.rect.x + player.rect.w / 2;
+    for (size_t i = 0; i < enemies.size(); i++) {
+        if (!enemies.active[i]) continue;
+        const Animation* clip = enemyClips[enemies.animClip[i]];
+        size_t frame = clipFrame(*clip, gameTime - enemies.animStart[i], enemies.state[i] != DYING);
+        SDL_RendererFlip flip = (playerCenterX < enemies.centerX(i)) ? SDL_FLIP_HORIZONTAL : SDL_FLIP_NONE;
+        SDL_Color tint = (enemies.hitEffectTimer[i] > 0) ? SDL_Color{ 255, 0, 0, 255 } : SDL_Color{ 255, 255, 255, 255 };
+        snap.enemies.push_back({ clip, static_cast<Uint32>(frame), enemies.prevX[i], enemies.prevY[i],
+            enemies.x[i], enemies.y[i], PLAYER_SIZE, PLAYER_SIZE, 0.0f, flip, tint });
+    }
+
+    snap.projectiles.clear();
+    for (const auto& proj : projectiles) {
+        if (!proj.active) continue;
+        snap.projectiles.push_back({ nullptr, 0, proj.prevX, proj.prevY, proj.rect.x, proj.rect.y,
+            proj.rect.w, proj.rect.h, proj.angle, SDL_FLIP_NONE, { 255, 255, 255, 255 } });
+    }
 
+    snap.markers.clear();
     for (const auto& marker : markers) {
-        if (marker.isSpawnMarker) {
-            SDL_SetRenderDrawColor(renderer, 255, 0, 0, 255);
-            int size = 40;
-            SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_BLEND);
-            SDL_RenderDrawLine(renderer, marker.position.x - size, marker.position.y - size,
-                marker.position.x + size, marker.position.y + size);
-            SDL_RenderDrawLine(renderer, marker.position.x + size, marker.position.y - size,
-                marker.position.x - size, marker.position.y + size);
+        if (marker.isSpawnMarker) snap.markers.push_back(marker.position);
+    }
+    for (int e = 0; e < NUM_PARTICLE_EMITTERS; e++) {
+        const ParticleRing& ring = particles[e];
+        std::vector<SDL_FPoint>& out = snap.particles[e];
+        out.resize(ring.size());
+        size_t n = 0;
+        ring.forSegments(0, ring.size(), [&](size_t first, size_t last) {
+            for (size_t i = first; i < last; i++) out[n++] = { ring.x[i], ring.y[i] };
+        });
+    }
+
+    snap.health = player.health;
+    snap.score = score;
+    snap.level = level;
+    snap.combo = combo;
+    snap.levelProgress = gameTime / (LEVEL_DURATION * level);
+    snap.cooldownRatio = qCooldown / qCooldownMax;
+    snap.qReady = qReady;
+    snap.preLevelUpTimer = preLevelUpTimer;
+    snap.deathTimer = deathTimer;
+    snap.shotgunUnlocked = shotgunUnlocked;
+
+    // Đổi chỗ để giữ dung lượng đã cấp phát của cả hai vector.
+    std::swap(snap.audio, audioEvents);
+    audioEvents.sounds.clear();
+    audioEvents.keepMusic = false;
+    audioEvents.restartMusic = false;
+}
+
+// Chạy ticks tick rồi chụp snapshot; finished báo replay đã hết hoặc bị lệch.
+void simulateFrame(int ticks, float fixedStep, float alpha, RenderSnapshot& out) {
+    PROFILE_ZONE("simulateFrame");
+    Uint64 start = SDL_GetPerformanceCounter();
+    out.finished = false;
+    for (int t = 0; t < ticks; t++) {
+        if (!simulateTick(fixedStep)) {
+            out.finished = true;
+            break;
+        }
+    }
+    captureSnapshot(out, alpha);
+    out.simMs = static_cast<float>((SDL_GetPerformanceCounter() - start) * 1000.0 / SDL_GetPerformanceFrequency());
+}
+
+// Luồng mô phỏng: frame N+1 được mô phỏng trong lúc luồng chính vẽ snapshot của frame N.
+// Luồng chính chỉ chạm vào trạng thái game (input, lệnh, menu) sau wait(), khi luồng này đang rảnh.
+struct SimulationPipeline {
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool threaded = false;
+    bool quitting = false;
+    bool hasJob = false;
+    bool busy = false;
+    int jobTicks = 0;
+    float jobStep = 0.0f;
+    float jobAlpha = 0.0f;
+    RenderSnapshot* jobTarget = nullptr;
+
+    void start(bool useThread) {
+        threaded = useThread;
+        if (threaded) thread = std::thread(&SimulationPipeline::threadLoop, this);
+    }
+
+    void stop() {
+        if (!threaded) return;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            quitting = true;
+        }
+        cv.notify_all();
+        thread.join();
+        threaded = false;
+    }
+
+    void threadLoop() {
+        PROFILE_THREAD("Simulation");
+        for (;;) {
+            std::unique_lock<std::mutex> lock(mutex);
+            cv.wait(lock, [&] { return quitting || hasJob; });
+            if (quitting) return;
+            hasJob = false;
+            lock.unlock();
+            simulateFrame(jobTicks, jobStep, jobAlpha, *jobTarget);
+            lock.lock();
+            busy = false;
+            cv.notify_all();
+        }
+    }
+
+    void submit(int ticks, float fixedStep, float alpha, RenderSnapshot& target) {
+        if (!threaded) {
+            simulateFrame(ticks, fixedStep, alpha, target);
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            jobTicks = ticks;
+            jobStep = fixedStep;
+            jobAlpha = alpha;
+            jobTarget = &target;
+            hasJob = true;
+            busy = true;
+        }
+        cv.notify_all();
+    }
+
+    void wait() {
+        if (!threaded) return;
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [&] { return !busy; });
+    }
+};
+
+SimulationPipeline simulation;
+
+// Một frame trong file telemetry (32 byte, little-endian).
+struct TelemetryFrame {
+    Uint32 frame;
+    float frameMs;
+    float simMs;
+    float renderMs;
+    float presentMs;
+    Uint16 enemies;
+    Uint16 projectiles;
+    Uint32 particles;
+    Uint8 level;
+    Uint8 state;
+    Uint16 reserved;
+};
+
+// Đầu file telemetry, sau đó là TELEMETRY_RING_FRAMES ô TelemetryFrame; frame thứ i (tính từ 0,
+// tổng cộng written frame) nằm ở ô i % capacity.
+struct TelemetryHeader {
+    Uint32 magic;
+    Uint32 version;
+    Uint32 capacity;
+    Uint32 recordSize;
+    Uint64 written;
+};
+
+// Thống kê các frame đang chơi của một level: histogram thời gian frame để tính phân vị.
+struct LevelTelemetry {
+    Uint32 bins[TELEMETRY_BINS];
+    Uint64 frames;
+    double maxMs;
+    double simSum, renderSum, presentSum;
+    int peakEnemies;
+};
+
+// Ghi thời gian từng frame vào file ring nhị phân dung lượng cố định. Luồng chính chỉ chép record vào
+// hàng đợi vòng (không khóa, không cấp phát), đầy thì bỏ frame; luồng riêng ghi xuống đĩa mỗi
+// 250 ms hoặc khi hàng đợi đầy một nửa. Thống kê theo level nằm ở luồng chính, tính riêng từng ván (số frame
+// trong record cũng đếm lại từ 0 mỗi ván), lưu summary khi game over và khi thoát.
+struct TelemetryLog {
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool closing = false;
+    TelemetryFrame queue[TELEMETRY_QUEUE_SIZE];
+    std::atomic<Uint32> head{ 0 };
+    std::atomic<Uint32> tail{ 0 };
+    // chỉ luồng ghi dùng
+    std::ofstream file;
+    Uint64 written = 0;
+    // chỉ luồng chính dùng
+    bool active = false;
+    bool dirty = false;
+    Uint32 run = 0;
+    Uint32 frameIndex = 0;
+    Uint32 dropped = 0;
+    GameState lastState = MENU;
+    std::string summaryPath;
+    LevelTelemetry levels[TELEMETRY_MAX_LEVEL] = {};
+
+    // Không tạo được file ring thì vẫn thống kê và lưu summary.
+    bool open(const std::string& ringPath, const std::string& summary) {
+        active = true;
+        summaryPath = summary;
+        file.open(ringPath, std::ios::binary | std::ios::trunc);
+        if (!file) {
+            std::cout << "ERROR: Failed to create telemetry log: " << ringPath << std::endl;
+            return false;
+        }
+        TelemetryHeader header = { TELEMETRY_MAGIC, TELEMETRY_VERSION, TELEMETRY_RING_FRAMES, sizeof(TelemetryFrame), 0 };
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        written = 0;
+        closing = false;
+        thread = std::thread(&TelemetryLog::writerLoop, this);
+        return true;
+    }
+
+    void record(const RenderSnapshot& snap, double frameMs, double renderMs, double presentMs) {
+        if (!active) return;
+        // Ván mới (từ menu hoặc sau game over): số frame và thống kê level tính lại từ đầu cho ván này,
+        // ván trước bỏ dở chưa lưu thì lưu trước.
+        if (snap.gameState == PLAYING && (lastState == MENU || lastState == GAME_OVER)) {
+            writeSummary();
+            run++;
+            frameIndex = 0;
+            dropped = 0;
+            std::fill(std::begin(levels), std::end(levels), LevelTelemetry{});
+        }
+        size_t particleCount = 0;
+        for (int e = 0; e < NUM_PARTICLE_EMITTERS; e++) particleCount += snap.particles[e].size();
+        TelemetryFrame frame = { frameIndex++, static_cast<float>(frameMs), snap.simMs, static_cast<float>(renderMs),
+            static_cast<float>(presentMs), static_cast<Uint16>(std::min<size_t>(snap.enemies.size(), 0xFFFF)),
+            static_cast<Uint16>(std::min<size_t>(snap.projectiles.size(), 0xFFFF)), static_cast<Uint32>(particleCount),
+            static_cast<Uint8>(std::min(snap.level, 255)), static_cast<Uint8>(snap.gameState), 0 };
+        if (thread.joinable()) {
+            Uint32 h = head.load(std::memory_order_relaxed);
+            Uint32 queued = h - tail.load(std::memory_order_acquire);
+            if (queued < TELEMETRY_QUEUE_SIZE) {
+                queue[h & (TELEMETRY_QUEUE_SIZE - 1)] = frame;
+                head.store(h + 1, std::memory_order_release);
+                // FPS cao (tắt vsync): đánh thức luồng ghi sớm thay vì chờ hết 250 ms.
+                if (queued + 1 == TELEMETRY_QUEUE_SIZE / 2) wake.notify_one();
+            }
+            else dropped++;
+        }
+
+        if (snap.gameState == PLAYING || snap.gameState == PRE_LEVEL_UP || snap.gameState == LEVEL_UP) {
+            LevelTelemetry& stats = levels[std::max(1, std::min(snap.level, TELEMETRY_MAX_LEVEL)) - 1];
+            int bin = std::min(static_cast<int>(frameMs / TELEMETRY_BIN_MS), TELEMETRY_BINS - 1);
+            stats.bins[bin]++;
+            stats.frames++;
+            stats.maxMs = std::max(stats.maxMs, frameMs);
+            stats.simSum += snap.simMs;
+            stats.renderSum += renderMs;
+            stats.presentSum += presentMs;
+            stats.peakEnemies = std::max(stats.peakEnemies, static_cast<int>(snap.enemies.size()));
+            dirty = true;
+        }
+        if (snap.gameState == GAME_OVER && lastState != GAME_OVER) writeSummary();
+        lastState = snap.gameState;
+    }
+
+    void writerLoop() {
+        PROFILE_THREAD("Telemetry writer");
+        trackAllocations = false;
+        for (;;) {
+            bool done;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait_for(lock, std::chrono::milliseconds(250), [this] {
+                    return closing || head.load(std::memory_order_acquire) - tail.load(std::memory_order_relaxed) >= TELEMETRY_QUEUE_SIZE / 2;
+                });
+                done = closing;
+            }
+            Uint32 t = tail.load(std::memory_order_relaxed);
+            Uint32 h = head.load(std::memory_order_acquire);
+            for (; t != h; t++) {
+                Uint64 slot = written % TELEMETRY_RING_FRAMES;
+                file.seekp(static_cast<std::streamoff>(sizeof(TelemetryHeader) + slot * sizeof(TelemetryFrame)));
+                file.write(reinterpret_cast<const char*>(&queue[t & (TELEMETRY_QUEUE_SIZE - 1)]), sizeof(TelemetryFrame));
+                written++;
+            }
+            tail.store(t, std::memory_order_release);
+            // Cập nhật written sau mỗi lần ghi để file vẫn đọc được nếu game bị tắt đột ngột.
+            file.seekp(static_cast<std::streamoff>(offsetof(TelemetryHeader, written)));
+            file.write(reinterpret_cast<const char*>(&written), sizeof(written));
+            file.flush();
+            if (done) return;
         }
     }
 
-    Animation* currentPlayerAnim = nullptr;
-    switch (player.playerState) {
-    case IDLE: currentPlayerAnim = &playerAnim.idle; break;
-    case WALK: currentPlayerAnim = &playerAnim.walk; break;
-    case ATTACK: currentPlayerAnim = &playerAnim.attack; break;
-    case HURT: currentPlayerAnim = &playerAnim.hurt; break;
-    case DEAD: currentPlayerAnim = &playerAnim.dead; break;
-    }
-    if (currentPlayerAnim && !currentPlayerAnim->textures.empty()) {
-        SDL_Texture* currentTexture = currentPlayerAnim->textures[0];
-        SDL_Rect* frame = &currentPlayerAnim->frames[currentPlayerAnim->currentFrame];
-        SDL_FRect renderRect = { player.rect.x, player.rect.y, PLAYER_SIZE, PLAYER_SIZE };
-        if (player.hurtTimer > 0) SDL_SetTextureColorMod(currentTexture, 255, 100, 100);
-        else SDL_SetTextureColorMod(currentTexture, 255, 255, 255);
-        SDL_RenderCopyExF(renderer, currentTexture, frame, &renderRect, 0, nullptr, currentPlayerAnim->flip);
+    // Cận trên của ô histogram chứa phân vị p (0..1), không vượt quá frame dài nhất.
+    static double percentile(const LevelTelemetry& stats, double p) {
+        Uint64 rank = std::max<Uint64>(1, static_cast<Uint64>(std::ceil(p * stats.frames)));
+        Uint64 seen = 0;
+        for (int b = 0; b < TELEMETRY_BINS; b++) {
+            seen += stats.bins[b];
+            if (seen >= rank) return std::min((b + 1) * TELEMETRY_BIN_MS, stats.maxMs);
+        }
+        return stats.maxMs;
     }
 
-    for (const auto& enemy : enemies) {
-        if (!enemy.active) continue;
-        Animation* currentAnim = nullptr;
-        switch (enemy.type) {
-        case BASIC: currentAnim = (enemy.enemyState == WALKING) ? &enemyBasicAnim.walking : (enemy.enemyState == SLASHING) ? &enemyBasicAnim.slashing : &enemyBasicAnim.dying; break;
-        case FAST: currentAnim = (enemy.enemyState == WALKING) ? &enemyFastAnim.walking : (enemy.enemyState == SLASHING) ? &enemyFastAnim.slashing : &enemyFastAnim.dying; break;
-        case CHASER: currentAnim = (enemy.enemyState == WALKING) ? &enemyChaserAnim.walking : (enemy.enemyState == SLASHING) ? &enemyChaserAnim.slashing : &enemyChaserAnim.dying; break;
+    // p50/p95/p99/max thời gian frame và thời gian trung bình sim/render/present theo level, dạng JSON.
+    bool writeSummary() {
+        if (!dirty) return true;
+        dirty = false;
+        std::ofstream out(summaryPath);
+        if (!out) {
+            std::cout << "ERROR: Failed to write telemetry summary: " << summaryPath << std::endl;
+            return false;
         }
-        if (currentAnim && !currentAnim->textures.empty()) {
-            SDL_Texture* currentTexture = currentAnim->textures[currentAnim->currentFrame];
-            SDL_Rect* frame = &currentAnim->frames[currentAnim->currentFrame];
-            SDL_FRect renderRect = { enemy.rect.x, enemy.rect.y, PLAYER_SIZE, PLAYER_SIZE };
-            if (enemy.hitEffectTimer > 0) SDL_SetTextureColorMod(currentTexture, 255, 0, 0);
-            else SDL_SetTextureColorMod(currentTexture, 255, 255, 255);
-            SDL_RenderCopyExF(renderer, currentTexture, frame, &renderRect, 0, nullptr, currentAnim->flip);
+        out << "{\n  \"run\": " << run << ",\n  \"frames\": " << frameIndex << ",\n  \"dropped_frames\": " << dropped << ",\n  \"levels\": [\n";
+        bool first = true;
+        for (int l = 0; l < TELEMETRY_MAX_LEVEL; l++) {
+            const LevelTelemetry& stats = levels[l];
+            if (stats.frames == 0) continue;
+            out << (first ? "" : ",\n") << "    { \"level\": " << l + 1 << ", \"frames\": " << stats.frames
+                << ", \"p50_ms\": " << percentile(stats, 0.50) << ", \"p95_ms\": " << percentile(stats, 0.95)
+                << ", \"p99_ms\": " << percentile(stats, 0.99) << ", \"max_ms\": " << stats.maxMs
+                << ", \"avg_sim_ms\": " << stats.simSum / stats.frames << ", \"avg_render_ms\": " << stats.renderSum / stats.frames
+                << ", \"avg_present_ms\": " << stats.presentSum / stats.frames << ", \"peak_enemies\": " << stats.peakEnemies << " }";
+            first = false;
         }
+        out << "\n  ]\n}\n";
+        std::cout << "Telemetry summary written to " << summaryPath << std::endl;
+        return true;
     }
 
-    for (const auto& proj : projectiles) {
-        if (!proj.active) continue;
-        if (projectileTexture) {
-            SDL_FRect projRect = { proj.rect.x, proj.rect.y, proj.rect.w, proj.rect.h };
-            SDL_RenderCopyExF(renderer, projectileTexture, nullptr, &projRect, proj.angle, nullptr, SDL_FLIP_NONE);
+    void close() {
+        if (thread.joinable()) {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                closing = true;
+            }
+            wake.notify_one();
+            thread.join();
+            file.close();
         }
+        if (active) writeSummary();
+        active = false;
     }
+};
 
-    SDL_SetRenderDrawColor(renderer, 255, 0, 0, 255);
-    for (const auto& p : particles) {
-        SDL_FRect rect = { p.pos.x, p.pos.y, 4, 4 };
-        SDL_RenderFillRectF(renderer, &rect);
-    }
+TelemetryLog telemetry;
+
+// Thư mục chứa file thực thi (có dấu phân cách ở cuối), rỗng nếu SDL không xác định được.
+std::string executableDir() {
+    char* base = SDL_GetBasePath();
+    if (!base) return "";
+    std::string dir = base;
+    SDL_free(base);
+    return dir;
 }
 
-void render() {
-    SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
-    SDL_RenderClear(renderer);
+void readKeyboardInput() {
+    const Uint8* keys = SDL_GetKeyboardState(nullptr);
+    input.up = keys[SDL_SCANCODE_W] != 0;
+    input.down = keys[SDL_SCANCODE_S] != 0;
+    input.left = keys[SDL_SCANCODE_A] != 0;
+    input.right = keys[SDL_SCANCODE_D] != 0;
+}
 
-    switch (gameState) {
-    case MENU: {
-        renderMenu();
-        break;
+// Nguồn input tổng hợp cho headless: né enemy gần nhất, bắn khi Q sẵn sàng, tự chọn nâng cấp.
+void updateBotInput() {
+    input = { false, false, false, false };
+    if (gameState == MENU || gameState == GAME_OVER) {
+        queueCommand(CMD_START_GAME);
+        return;
     }
-    case SETTINGS: {
-        if (menuBackground) SDL_RenderCopy(renderer, menuBackground, nullptr, nullptr);
-        renderText("Settings", SCREEN_WIDTH / 2 - 50, SCREEN_HEIGHT / 2 - 200, { 255, 215, 0, 255 });
+    if (gameState == UPGRADE_MENU) {
+        queueCommand(shotgunUnlocked ? CMD_UPGRADE_1 + level % 3 : CMD_UPGRADE_4);
+        return;
+    }
+    if (gameState != PLAYING || player.playerState == DEAD) return;
 
-        SDL_Rect musicBar = { SCREEN_WIDTH / 2 - 100, SCREEN_HEIGHT / 2 - 100, 200, 20 };
-        SDL_SetRenderDrawColor(renderer, 50, 50, 50, 255);
-        SDL_RenderFillRect(renderer, &musicBar);
-        int musicFillWidth = (musicVolume * 200) / 128;
-        SDL_Rect musicFill = { SCREEN_WIDTH / 2 - 100, SCREEN_HEIGHT / 2 - 100, musicFillWidth, 20 };
-        SDL_SetRenderDrawColor(renderer, 0, 255, 0, 255);
-        SDL_RenderFillRect(renderer, &musicFill);
-        SDL_Rect musicKnob = { SCREEN_WIDTH / 2 - 100 + musicFillWidth - 5, SCREEN_HEIGHT / 2 - 105, 10, 30 };
-        SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
-        SDL_RenderFillRect(renderer, &musicKnob);
-        renderText("Music: " + std::to_string(musicVolume), SCREEN_WIDTH / 2 - 50, SCREEN_HEIGHT / 2 - 130, { 255, 255, 255, 255 });
+    float playerCenterX = player.rect.x + player.rect.w / 2;
+    float playerCenterY = player.rect.y + player.rect.h / 2;
+    float targetX = SCREEN_WIDTH / 2.0f;
+    float targetY = SCREEN_HEIGHT / 2.0f;
+    Handle nearest = findNearestEnemy(playerCenterX, playerCenterY);
+    if (nearest.valid()) {
+        int i = enemies.indexOf(nearest);
+        float dx = playerCenterX - enemies.centerX(i);
+        float dy = playerCenterY - enemies.centerY(i);
+        if (dx * dx + dy * dy < 4.0f * SLASHING_DISTANCE * SLASHING_DISTANCE) {
+            targetX = playerCenterX + dx;
+            targetY = playerCenterY + dy;
+        }
+    }
+    const float deadZone = 10.0f;
+    input.left = targetX < playerCenterX - deadZone;
+    input.right = targetX > playerCenterX + deadZone;
+    input.up = targetY < playerCenterY - deadZone;
+    input.down = targetY > playerCenterY + deadZone;
 
-        SDL_Rect sfxBar = { SCREEN_WIDTH / 2 - 100, SCREEN_HEIGHT / 2 - 40, 200, 20 };
-        SDL_SetRenderDrawColor(renderer, 50, 50, 50, 255);
-        SDL_RenderFillRect(renderer, &sfxBar);
-        int sfxFillWidth = (sfxVolume * 200) / 128;
-        SDL_Rect sfxFill = { SCREEN_WIDTH / 2 - 100, SCREEN_HEIGHT / 2 - 40, sfxFillWidth, 20 };
-        SDL_SetRenderDrawColor(renderer, 0, 255, 0, 255);
-        SDL_RenderFillRect(renderer, &sfxFill);
-        SDL_Rect sfxKnob = { SCREEN_WIDTH / 2 - 100 + sfxFillWidth - 5, SCREEN_HEIGHT / 2 - 45, 10, 30 };
-        SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
-        SDL_RenderFillRect(renderer, &sfxKnob);
-        renderText("SFX: " + std::to_string(sfxVolume), SCREEN_WIDTH / 2 - 50, SCREEN_HEIGHT / 2 - 70, { 255, 255, 255, 255 });
+    if (qReady) queueCommand(CMD_SHOOT);
+}
 
-        Button backButton = { {SCREEN_WIDTH / 2 - 100, SCREEN_HEIGHT / 2 + 60, 200, 40}, "Back", {255, 255, 255, 255}, false };
-        int mouseX, mouseY;
-        SDL_GetMouseState(&mouseX, &mouseY);
-        backButton.hovered = (mouseX >= backButton.rect.x && mouseX <= backButton.rect.x + backButton.rect.w &&
-                             mouseY >= backButton.rect.y && mouseY <= backButton.rect.y + backButton.rect.h);
-        renderButton(backButton);
-        break;
-    }
-    case PLAYING:
-    case PRE_LEVEL_UP:
-    case LEVEL_UP: {
-        renderEntities();
-        renderUI();
-        if (gameState == PRE_LEVEL_UP) {
-            renderText("Level Up in " + std::to_string((int)preLevelUpTimer + 1) + "s", SCREEN_WIDTH / 2 - 100, SCREEN_HEIGHT / 2, { 255, 255, 0 });
-        }
-        else if (gameState == LEVEL_UP) {
-            renderText("Level Up! Level " + std::to_string(level + 1), SCREEN_WIDTH / 2 - 100, SCREEN_HEIGHT / 2, { 255, 255, 0 });
+// Chạy mô phỏng không cần cửa sổ, renderer hay thiết bị âm thanh, nhanh nhất CPU cho phép.
+// Khi chết bot chơi lại ván mới cho tới khi đủ tickCount tick; khi replay thì chạy tới hết file.
+HeadlessResult runHeadless(Uint64 tickCount) {
+    for (const AnimationSpec& spec : animationSpecs) defineAnimation(*spec.anim, ASSET_MANIFEST[spec.asset].frameCount, spec.frameTime);
+
+    HeadlessResult result = { 0, 0.0, 0.0, 0, 0, 0 };
+    const float fixedStep = 1.0f / tickRate;
+    Uint64 startCounter = SDL_GetPerformanceCounter();
+    while (replayFile.is_open() || result.ticks < tickCount) {
+        if (!replayFile.is_open()) {
+            if (gameState == MENU || gameState == GAME_OVER) result.runs++;
+            updateBotInput();
         }
-        break;
+        if (!simulateTick(fixedStep)) break;
+        result.ticks++;
+        result.bestScore = std::max(result.bestScore, score);
+        result.bestLevel = std::max(result.bestLevel, level);
     }
-    case UPGRADE_MENU: {
-        if (maps[currentMap]) SDL_RenderCopy(renderer, maps[currentMap], nullptr, nullptr);
-        SDL_SetRenderDrawColor(renderer, 0, 0, 0, 128);
-        SDL_RenderFillRect(renderer, nullptr);
+    result.simSeconds = static_cast<double>(result.ticks) / tickRate;
+    result.wallSeconds = static_cast<double>(SDL_GetPerformanceCounter() - startCounter) / SDL_GetPerformanceFrequency();
+    return result;
+}
 
-        SDL_Rect upgradeBox = { SCREEN_WIDTH / 2 - 200, SCREEN_HEIGHT / 2 - 200, 400, 400 };
-        SDL_SetRenderDrawColor(renderer, 50, 50, 50, 255);
-        SDL_RenderFillRect(renderer, &upgradeBox);
-        SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
-        SDL_RenderDrawRect(renderer, &upgradeBox);
+// Thời gian (ns) của samples lần chạy một benchmark; work là số phần tử được xử lý mỗi lần chạy.
+struct BenchResult {
+    std::string name;
+    size_t entities;
+    size_t work;
+    int samples;
+    double meanNs, medianNs, stddevNs, minNs, maxNs;
+};
 
-        Button speedButton = { {SCREEN_WIDTH / 2 - 150, SCREEN_HEIGHT / 2 - 120, 300, 40}, "1: Increase Speed", {0, 255, 0}, false };
-        Button cooldownButton = { {SCREEN_WIDTH / 2 - 150, SCREEN_HEIGHT / 2 - 60, 300, 40}, "2: Reduce Cooldown", {0, 255, 0}, false };
-        Button damageButton = { {SCREEN_WIDTH / 2 - 150, SCREEN_HEIGHT / 2, 300, 40}, "3: Increase Damage", {0, 255, 0}, false };
-        Button shotgunButton = { {SCREEN_WIDTH / 2 - 150, SCREEN_HEIGHT / 2 + 60, 300, 40}, shotgunUnlocked ? "4: Shotgun (Taken)" : "4: Shotgun", shotgunUnlocked ? SDL_Color{100, 100, 100} : SDL_Color{0, 255, 0}, false };
+// Gọi setup() rồi đo body() samples lần; setup không được tính giờ.
+template <typename Setup, typename Body>
+BenchResult measureBench(const char* name, size_t entities, size_t work, int samples, Setup&& setup, Body&& body) {
+    std::vector<double> times(samples);
+    const double nsPerCount = 1e9 / SDL_GetPerformanceFrequency();
+    for (int s = 0; s < samples; s++) {
+        setup();
+        Uint64 start = SDL_GetPerformanceCounter();
+        body();
+        times[s] = (SDL_GetPerformanceCounter() - start) * nsPerCount;
+    }
+    BenchResult result = { name, entities, std::max<size_t>(work, 1), samples, 0.0, 0.0, 0.0, 0.0, 0.0 };
+    for (double t : times) result.meanNs += t;
+    result.meanNs /= samples;
+    for (double t : times) result.stddevNs += (t - result.meanNs) * (t - result.meanNs);
+    result.stddevNs = std::sqrt(result.stddevNs / std::max(samples - 1, 1));
+    std::sort(times.begin(), times.end());
+    result.medianNs = times[samples / 2];
+    result.minNs = times.front();
+    result.maxNs = times.back();
+    std::cout << name << " n=" << entities << ": " << result.medianNs / result.work << " ns/entity (mean "
+        << result.meanNs / result.work << ", stddev " << result.stddevNs / result.work << "), "
+        << result.work / (result.medianNs * 1e-9) / 1e6 << " M entities/s" << std::endl;
+    return result;
+}
 
-        int mouseX, mouseY;
-        SDL_GetMouseState(&mouseX, &mouseY);
-        speedButton.hovered = (mouseX >= speedButton.rect.x && mouseX <= speedButton.rect.x + speedButton.rect.w &&
-                              mouseY >= speedButton.rect.y && mouseY <= speedButton.rect.y + speedButton.rect.h);
-        cooldownButton.hovered = (mouseX >= cooldownButton.rect.x && mouseX <= cooldownButton.rect.x + cooldownButton.rect.w &&
-                                 mouseY >= cooldownButton.rect.y && mouseY <= cooldownButton.rect.y + cooldownButton.rect.h);
-        damageButton.hovered = (mouseX >= damageButton.rect.x && mouseX <= damageButton.rect.x + damageButton.rect.w &&
-                               mouseY >= damageButton.rect.y && mouseY <= damageButton.rect.y + damageButton.rect.h);
-        shotgunButton.hovered = (!shotgunUnlocked && mouseX >= shotgunButton.rect.x && mouseX <= shotgunButton.rect.x + shotgunButton.rect.w &&
-                                mouseY >= shotgunButton.rect.y && mouseY <= shotgunButton.rect.y + shotgunButton.rect.h);
+// Cảnh tổng hợp: ván mới, người chơi giữa màn hình, count enemy ngẫu nhiên (10% đang chết).
+void buildBenchScene(size_t count, Uint64 seed) {
+    resetGame();
+    Rng rng;
+    rng.seed(seed, 0);
+    for (size_t i = 0; i < count; i++) {
+        EnemyType type = static_cast<EnemyType>(rng.below(3));
+        int index = enemies.add(type, rng.unit() * (SCREEN_WIDTH - PLAYER_SIZE), rng.unit() * (SCREEN_HEIGHT - PLAYER_SIZE), 0.0f);
+        if (index < 0) break;
+        enemies.health[index] = (type == CHASER) ? 2 : 1;
+        if (rng.below(10) == 0) enemies.setState(index, DYING, 0.0f);
+    }
+}
 
-        renderText("Choose an Upgrade", SCREEN_WIDTH / 2 - 80, SCREEN_HEIGHT / 2 - 160, { 255, 215, 0 });
-        renderButton(speedButton);
-        renderButton(cooldownButton);
-        renderButton(damageButton);
-        renderButton(shotgunButton);
-        break;
+bool writeBenchResults(const std::string& path, const std::vector<BenchResult>& results, int samples) {
+    std::ofstream out(path);
+    if (!out) {
+        std::cout << "ERROR: Failed to write benchmark results: " << path << std::endl;
+        return false;
     }
-    case PAUSED: {
-        SDL_SetRenderDrawColor(renderer, 0, 0, 0, 128);
-        SDL_RenderFillRect(renderer, nullptr);
+    out << "{\n  \"threads\": " << jobs.participants << ",\n  \"steering\": \"" << STEERING_KERNEL_NAMES[steeringKernel]
+        << "\",\n  \"samples\": " << samples << ",\n  \"results\": [\n";
+    for (size_t i = 0; i < results.size(); i++) {
+        const BenchResult& r = results[i];
+        double nsPerEntity = r.medianNs / r.work;
+        out << "    { \"name\": \"" << r.name << "\", \"entities\": " << r.entities << ", \"work\": " << r.work
+            << ", \"median_ns\": " << r.medianNs << ", \"mean_ns\": " << r.meanNs << ", \"stddev_ns\": " << r.stddevNs
+            << ", \"min_ns\": " << r.minNs << ", \"max_ns\": " << r.maxNs
+            << ", \"ns_per_entity\": " << nsPerEntity << ", \"entities_per_second\": " << 1e9 / nsPerEntity << " }"
+            << (i + 1 < results.size() ? ",\n" : "\n");
+    }
+    out << "  ]\n}\n";
+    std::cout << "Benchmark results written to " << path << std::endl;
+    return true;
+}
 
-        SDL_Rect pauseBox = { SCREEN_WIDTH / 2 - 150, SCREEN_HEIGHT / 2 - 150, 300, 300 };
-        SDL_SetRenderDrawColor(renderer, 50, 50, 50, 255);
-        SDL_RenderFillRect(renderer, &pauseBox);
-        SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
-        SDL_RenderDrawRect(renderer, &pauseBox);
+// Đo các hàm mô phỏng nóng trên cảnh tổng hợp (không cần cửa sổ) và ghi kết quả JSON vào outPath
+// để so sánh trước/sau khi đổi cấu trúc dữ liệu hay thuật toán của entity.
+bool runBenchmarks(const std::string& outPath, int samples) {
+    for (const AnimationSpec& spec : animationSpecs) defineAnimation(*spec.anim, ASSET_MANIFEST[spec.asset].frameCount, spec.frameTime);
+    seedRandomStreams(12345);
+    samples = std::max(samples, 1);
+    const float deltaTime = 1.0f / DEFAULT_TICK_RATE;
+    const size_t enemyCounts[] = { 100, 1000, 10000, 100000 };
+    std::vector<BenchResult> results;
+    // Pool gameplay chỉ có MAX_ENEMIES chỗ: cảnh lớn nhất dùng store riêng, trả lại pool cũ khi xong.
+    enemies = EnemyStore(enemyCounts[3]);
+
+    for (size_t count : enemyCounts) {
+        std::vector<SDL_FPoint> points(count);
+        Rng rng;
+        rng.seed(count, 1);
+        for (SDL_FPoint& p : points) p = { rng.unit() * SCREEN_WIDTH, rng.unit() * SCREEN_HEIGHT };
+        results.push_back(measureBench("spawnEnemyAtMarker", count, count, samples,
+            [&] { enemies.clear(); },
+            [&] { for (const SDL_FPoint& p : points) spawnEnemyAtMarker(p); }));
+    }
 
-        Button resumeButton = { {SCREEN_WIDTH / 2 - 100, SCREEN_HEIGHT / 2 - 60, 200, 40}, "Resume", {0, 255, 0}, false };
-        Button settingsButton = { {SCREEN_WIDTH / 2 - 100, SCREEN_HEIGHT / 2, 200, 40}, "Settings", {255, 215, 0}, false };
-        Button quitButton = { {SCREEN_WIDTH / 2 - 100, SCREEN_HEIGHT / 2 + 60, 200, 40}, "Quit", {255, 0, 0}, false };
+    for (size_t count : enemyCounts) {
+        results.push_back(measureBench("updateEnemies", count, count, samples,
+            [&] { buildBenchScene(count, count); },
+            [&] { updateEnemies(deltaTime); }));
+    }
 
-        int mouseX, mouseY;
-        SDL_GetMouseState(&mouseX, &mouseY);
-        resumeButton.hovered = (mouseX >= resumeButton.rect.x && mouseX <= resumeButton.rect.x + resumeButton.rect.w &&
-                               mouseY >= resumeButton.rect.y && mouseY <= resumeButton.rect.y + resumeButton.rect.h);
-        settingsButton.hovered = (mouseX >= settingsButton.rect.x && mouseX <= settingsButton.rect.x + settingsButton.rect.w &&
-                                 mouseY >= settingsButton.rect.y && mouseY <= settingsButton.rect.y + settingsButton.rect.h);
-        quitButton.hovered = (mouseX >= quitButton.rect.x && mouseX <= quitButton.rect.x + quitButton.rect.w &&
-                             mouseY >= quitButton.rect.y && mouseY <= quitButton.rect.y + quitButton.rect.h);
+    for (size_t count : enemyCounts) {
+        results.push_back(measureBench("buildEnemyGrid", count, count, samples,
+            [&] { buildBenchScene(count, count); },
+            [&] { buildEnemyGrid(); }));
+    }
 
-        renderText("Paused", SCREEN_WIDTH / 2 - 40, SCREEN_HEIGHT / 2 - 120, { 255, 255, 0 });
-        renderButton(resumeButton);
-        renderButton(settingsButton);
-        renderButton(quitButton);
-        break;
+    for (size_t count : enemyCounts) {
+        const int queries = 16;
+        buildBenchScene(count, count);
+        results.push_back(measureBench("findNearestEnemy", count, count * queries, samples,
+            [] {},
+            [&] {
+                for (int q = 0; q < queries; q++) {
+                    volatile Uint32 slot = findNearestEnemy(SCREEN_WIDTH * (q + 0.5f) / queries, SCREEN_HEIGHT / 2.0f).index;
+                    (void)slot;
+                }
+            }));
     }
-    case GAME_OVER: {
-        if (maps[currentMap]) SDL_RenderCopy(renderer, maps[currentMap], nullptr, nullptr);
-
-        Animation* currentPlayerAnim = nullptr;
-        switch (player.playerState) {
-        case IDLE: currentPlayerAnim = &playerAnim.idle; break;
-        case WALK: currentPlayerAnim = &playerAnim.walk; break;
-        case ATTACK: currentPlayerAnim = &playerAnim.attack; break;
-        case HURT: currentPlayerAnim = &playerAnim.hurt; break;
-        case DEAD: currentPlayerAnim = &playerAnim.dead; break;
-        }
-        if (currentPlayerAnim && !currentPlayerAnim->textures.empty()) {
-            SDL_Texture* currentTexture = currentPlayerAnim->textures[0];
-            SDL_Rect* frame = &currentPlayerAnim->frames[currentPlayerAnim->currentFrame];
-            SDL_FRect renderRect = { player.rect.x, player.rect.y, PLAYER_SIZE, PLAYER_SIZE };
-            SDL_RenderCopyExF(renderer, currentTexture, frame, &renderRect, 0, nullptr, currentPlayerAnim->flip);
-        }
-
-        for (const auto& enemy : enemies) {
-            if (!enemy.active) continue;
-            Animation* currentAnim = nullptr;
-            switch (enemy.type) {
-            case BASIC: currentAnim = (enemy.enemyState == WALKING) ? &enemyBasicAnim.walking : (enemy.enemyState == SLASHING) ? &enemyBasicAnim.slashing : &enemyBasicAnim.dying; break;
-            case FAST: currentAnim = (enemy.enemyState == WALKING) ? &enemyFastAnim.walking : (enemy.enemyState == SLASHING) ? &enemyFastAnim.slashing : &enemyFastAnim.dying; break;
-            case CHASER: currentAnim = (enemy.enemyState == WALKING) ? &enemyChaserAnim.walking : (enemy.enemyState == SLASHING) ? &enemyChaserAnim.slashing : &enemyChaserAnim.dying; break;
-            }
-            if (currentAnim && !currentAnim->textures.empty()) {
-                SDL_Texture* currentTexture = currentAnim->textures[currentAnim->currentFrame];
-                SDL_Rect* frame = &currentAnim->frames[currentAnim->currentFrame];
-                SDL_FRect renderRect = { enemy.rect.x, enemy.rect.y, PLAYER_SIZE, PLAYER_SIZE };
-                if (enemy.hitEffectTimer > 0) SDL_SetTextureColorMod(currentTexture, 255, 0, 0);
-                else SDL_SetTextureColorMod(currentTexture, 255, 255, 255);
-                SDL_RenderCopyExF(renderer, currentTexture, frame, &renderRect, 0, nullptr, currentAnim->flip);
+
+    // Loạt shotgun: mỗi loạt 5 viên từ một vị trí ngẫu nhiên nhắm enemy gần nhất, tới khi đầy pool.
+    const size_t volleyEnemyCounts[] = { 1000, 10000 };
+    for (size_t count : volleyEnemyCounts) {
+        auto setup = [&] {
+            buildBenchScene(count, count);
+            buildEnemyGrid();
+            Rng rng;
+            rng.seed(count, 2);
+            while (projectiles.size() + 5 <= MAX_PROJECTILES) {
+                player.rect.x = rng.unit() * (SCREEN_WIDTH - PLAYER_SIZE);
+                player.rect.y = rng.unit() * (SCREEN_HEIGHT - PLAYER_SIZE);
+                qReady = true;
+                shootShotgun();
             }
-        }
+        };
+        setup();
+        results.push_back(measureBench("updateProjectiles", count, projectiles.size(), samples, setup,
+            [&] { updateProjectiles(deltaTime); }));
+    }
 
-        if (deathTimer <= 0) {
-            SDL_SetRenderDrawColor(renderer, 0, 0, 0, 128);
-            SDL_RenderFillRect(renderer, nullptr);
+    const size_t particleCounts[] = { 10000, MAX_PARTICLES };
+    for (size_t count : particleCounts) {
+        auto setup = [&] {
+            for (ParticleRing& ring : particles) ring.clear();
+            particleClock = 0.0;
+            Rng rng;
+            rng.seed(count, 3);
+            size_t bursts = count / PARTICLE_EMITTERS[EMIT_ENEMY_DEATH].count;
+            for (size_t b = 0; b < bursts; b++) spawnParticles(EMIT_ENEMY_DEATH, rng.unit() * SCREEN_WIDTH, rng.unit() * SCREEN_HEIGHT);
+        };
+        results.push_back(measureBench("updateParticles", count, count, samples, setup,
+            [&] { updateParticles(deltaTime); }));
+    }
 
-            SDL_Rect deathBox = { SCREEN_WIDTH / 2 - 200, SCREEN_HEIGHT / 2 - 200, 400, 400 };
-            SDL_SetRenderDrawColor(renderer, 50, 50, 50, 255);
-            SDL_RenderFillRect(renderer, &deathBox);
-            SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
-            SDL_RenderDrawRect(renderer, &deathBox);
+    // Pass xóa/nén cuối tick: một nửa enemy và projectile không còn hoạt động.
+    for (size_t count : enemyCounts) {
+        auto setup = [&] {
+            buildBenchScene(count, count);
+            projectiles.clear();
+            GameObject proj;
+            for (size_t i = 0; i < MAX_PROJECTILES; i++) {
+                proj.active = (i % 2) == 0;
+                projectiles.spawn(proj);
+            }
+            Rng rng;
+            rng.seed(count, 4);
+            for (size_t i = 0; i < enemies.size(); i++) enemies.active[i] = rng.below(2);
+        };
+        results.push_back(measureBench("compact", count, count + MAX_PROJECTILES, samples, setup,
+            [&] {
+                enemies.removeInactive();
+                projectiles.removeIf([](const GameObject& p) { return !p.active; });
+            }));
+    }
 
-            Button restartButton = { {SCREEN_WIDTH / 2 - 150, SCREEN_HEIGHT / 2 - 60, 300, 40}, "Restart", {0, 255, 0, 255}, false };
-            Button settingsButton = { {SCREEN_WIDTH / 2 - 150, SCREEN_HEIGHT / 2 + 20, 300, 40}, "Settings", {255, 215, 0, 255}, false };
-            Button quitButton = { {SCREEN_WIDTH / 2 - 150, SCREEN_HEIGHT / 2 + 100, 300, 40}, "Quit", {255, 0, 0, 255}, false };
+    resetGame();
+    enemies = EnemyStore(MAX_ENEMIES);
+    projectiles.clear();
+    for (ParticleRing& ring : particles) ring.clear();
+    return writeBenchResults(outPath, results, samples);
+}
 
-            int mouseX, mouseY;
-            SDL_GetMouseState(&mouseX, &mouseY);
-            restartButton.hovered = (mouseX >= restartButton.rect.x && mouseX <= restartButton.rect.x + restartButton.rect.w &&
-                                    mouseY >= restartButton.rect.y && mouseY <= restartButton.rect.y + restartButton.rect.h);
-            settingsButton.hovered = (mouseX >= settingsButton.rect.x && mouseX <= settingsButton.rect.x + settingsButton.rect.w &&
-                                     mouseY >= settingsButton.rect.y && mouseY <= settingsButton.rect.y + settingsButton.rect.h);
-            quitButton.hovered = (mouseX >= quitButton.rect.x && mouseX <= quitButton.rect.x + quitButton.rect.w &&
-                                 mouseY >= quitButton.rect.y && mouseY <= quitButton.rect.y + quitButton.rect.h);
+// Chờ nạp xong mọi tài nguyên và map của cảnh (benchmark render không có vòng lặp chính để nạp dần).
+void finishLoading(int map) {
+    while (!assets.finished || !(maps[map] || mapStreamer.failed[map])) {
+        assets.pump(1.0);
+        mapStreamer.update(map, -1);
+        SDL_Delay(1);
+    }
+}
 
-            renderText("Game Over", SCREEN_WIDTH / 2 - 80, SCREEN_HEIGHT / 2 - 160, { 255, 0, 0, 255 });
-            renderText("Score: " + std::to_string(score), SCREEN_WIDTH / 2 - 80, SCREEN_HEIGHT / 2 - 120, { 255, 255, 255, 255 });
-            renderButton(restartButton);
-            renderButton(settingsButton);
-            renderButton(quitButton);
+struct RenderBenchScene {
+    const char* name;
+    void (*setup)();
+};
+
+void benchHordeScene() {
+    buildBenchScene(MAX_CONCURRENT_ENEMIES, 7);
+    for (int volley = 0; volley < 40; volley++) {
+        qReady = true;
+        shootShotgun();
+        for (GameObject& proj : projectiles) {
+            proj.rect.x += proj.vx * 0.01f;
+            proj.rect.y += proj.vy * 0.01f;
         }
-        break;
     }
+    for (size_t i = 0; i < enemies.size(); i++) {
+        if (enemies.state[i] == DYING) spawnParticles(EMIT_ENEMY_DEATH, enemies.x[i], enemies.y[i]);
     }
+}
 
-    SDL_RenderPresent(renderer);
+void benchParticleStormScene() {
+    buildBenchScene(0, 8);
+    Rng rng;
+    rng.seed(8, 3);
+    for (size_t b = 0; b < MAX_PARTICLES / PARTICLE_EMITTERS[EMIT_ENEMY_DEATH].count; b++) {
+        spawnParticles(EMIT_ENEMY_DEATH, rng.unit() * SCREEN_WIDTH - PLAYER_SIZE / 2, rng.unit() * SCREEN_HEIGHT - PLAYER_SIZE / 2);
+    }
+}
+
+void benchMenuScene() { buildBenchScene(0, 9); gameState = MENU; }
+void benchSettingsScene() { buildBenchScene(0, 9); gameState = SETTINGS; }
+void benchPausedScene() { buildBenchScene(MAX_CONCURRENT_ENEMIES, 9); gameState = PAUSED; }
+void benchUpgradeScene() { buildBenchScene(0, 9); gameState = UPGRADE_MENU; }
+void benchPreLevelUpScene() { buildBenchScene(MAX_CONCURRENT_ENEMIES, 9); gameState = PRE_LEVEL_UP; preLevelUpTimer = PRE_LEVEL_UP_DELAY; }
+void benchLevelUpScene() { buildBenchScene(0, 9); gameState = LEVEL_UP; levelUpTimer = 2.0f; }
+void benchGameOverScene() { buildBenchScene(MAX_CONCURRENT_ENEMIES, 9); player.playerState = DEAD; gameState = GAME_OVER; deathTimer = 0.0f; }
+
+const RenderBenchScene RENDER_BENCH_SCENES[] = {
+    { "horde", benchHordeScene },
+    { "particleStorm", benchParticleStormScene },
+    { "menu", benchMenuScene },
+    { "settings", benchSettingsScene },
+    { "paused", benchPausedScene },
+    { "upgradeMenu", benchUpgradeScene },
+    { "preLevelUp", benchPreLevelUpScene },
+    { "levelUp", benchLevelUpScene },
+    { "gameOver", benchGameOverScene },
+};
+
+// Vẽ từng cảnh frames lần bằng render() vào target (renderer phần mềm, không cần GPU) và ghi thời gian
+// frame, draw call, texture bind, số lần đổi màu, pixel tô mỗi frame ra JSON; dumpDir khác rỗng thì lưu PNG.
+bool runRenderBench(SDL_Surface* target, const std::string& outPath, int frames, const std::string& dumpDir) {
+    frames = std::max(frames, 1);
+    seedRandomStreams(12345);
+    countPixels = true;
+    std::ofstream out(outPath);
+    if (!out) {
+        std::cout << "ERROR: Failed to write benchmark results: " << outPath << std::endl;
+        return false;
+    }
+    out << "{\n  \"renderer\": \"software\",\n  \"width\": " << SCREEN_WIDTH << ",\n  \"height\": " << SCREEN_HEIGHT
+        << ",\n  \"frames\": " << frames << ",\n  \"scenes\": [\n";
+
+    bool ok = true;
+    const double msPerCount = 1000.0 / SDL_GetPerformanceFrequency();
+    const size_t sceneCount = sizeof(RENDER_BENCH_SCENES) / sizeof(RENDER_BENCH_SCENES[0]);
+    std::vector<double> times(frames);
+    for (size_t s = 0; s < sceneCount; s++) {
+        const RenderBenchScene& scene = RENDER_BENCH_SCENES[s];
+        scene.setup();
+        finishLoading(currentMap);
+        captureSnapshot(snapshots[0], 0.0f);
+        render(snapshots[0]);
+        for (int f = 0; f < frames; f++) {
+            Uint64 start = SDL_GetPerformanceCounter();
+            render(snapshots[0]);
+            times[f] = (SDL_GetPerformanceCounter() - start) * msPerCount;
+        }
+        double mean = 0.0, variance = 0.0;
+        for (double t : times) mean += t;
+        mean /= frames;
+        for (double t : times) variance += (t - mean) * (t - mean);
+        double stddev = std::sqrt(variance / std::max(frames - 1, 1));
+        std::vector<double> sorted = times;
+        std::sort(sorted.begin(), sorted.end());
+        double median = sorted[frames / 2];
+        const RenderStats& stats = renderStats;
+        double overdraw = stats.pixelsFilled / (static_cast<double>(SCREEN_WIDTH) * SCREEN_HEIGHT);
+
+        std::cout << scene.name << ": " << median << " ms/frame (mean " << mean << ", stddev " << stddev << "), "
+            << stats.drawCalls << " draw calls, " << stats.textureBinds << " texture binds, " << stats.colorChanges
+            << " color changes, " << stats.pixelsFilled / 1e6 << " Mpixels (" << overdraw << "x screen)" << std::endl;
+        out << "    { \"name\": \"" << scene.name << "\", \"median_ms\": " << median << ", \"mean_ms\": " << mean
+            << ", \"stddev_ms\": " << stddev << ", \"min_ms\": " << sorted.front() << ", \"max_ms\": " << sorted.back()
+            << ", \"draw_calls\": " << stats.drawCalls << ", \"texture_binds\": " << stats.textureBinds
+            << ", \"color_changes\": " << stats.colorChanges << ", \"pixels_filled\": " << static_cast<Uint64>(stats.pixelsFilled)
+            << ", \"overdraw\": " << overdraw << " }" << (s + 1 < sceneCount ? ",\n" : "\n");
+
+        if (!dumpDir.empty()) {
+            std::string path = dumpDir + "/" + scene.name + ".png";
+            if (IMG_SavePNG(target, path.c_str()) != 0) {
+                std::cout << "ERROR: Failed to save " << path << " - " << IMG_GetError() << std::endl;
+                ok = false;
+            }
+        }
+    }
+    out << "  ]\n}\n";
+    countPixels = false;
+    std::cout << "Render benchmark results written to " << outPath << std::endl;
+    return ok;
+}
+
+int steadyPlayingFrames = 0;
+
+// true nếu snap là frame PLAYING ổn định (tài nguyên và map đã nạp xong, đã qua ALLOCATION_WARMUP_FRAMES
+// frame như vậy liên tiếp) mà vẫn cấp phát heap.
+bool steadyFrameAllocated(const RenderSnapshot& snap, Uint64 allocations) {
+    bool steady = snap.gameState == PLAYING && assets.finished &&
+        (maps[snap.currentMap] || mapStreamer.failed[snap.currentMap]);
+#ifndef DODGE_NO_PROFILER
+    // Capture trace gom record vào bộ đệm lớn dần nên không tính.
+    steady = steady && !profiler.capturing;
+#endif
+    steadyPlayingFrames = steady ? steadyPlayingFrames + 1 : 0;
+    return steadyPlayingFrames > ALLOCATION_WARMUP_FRAMES && allocations > 0;
+}
+
+// Tự kiểm tra không cần cửa sổ: bot chơi frames frame, mỗi frame mô phỏng rồi vẽ bằng renderer phần mềm
+// như vòng lặp chính. Trả về false nếu có frame PLAYING ổn định cấp phát heap.
+bool runAllocationCheck(int frames) {
+    seedRandomStreams(12345);
+    finishLoading(currentMap);
+    reserveFrameBuffers();
+    const float fixedStep = 1.0f / tickRate;
+    const int ticksPerFrame = std::max(tickRate / 60, 1);
+    int playingFrames = 0, failedFrames = 0;
+    Uint64 worst = 0;
+    for (int f = 0; f < frames; f++) {
+        Uint64 before = heapAllocations.load(std::memory_order_relaxed);
+        updateBotInput();
+        simulateFrame(ticksPerFrame, fixedStep, 0.0f, snapshots[0]);
+        const RenderSnapshot& snap = snapshots[0];
+        assets.pump(ASSET_UPLOAD_BUDGET);
+        mapStreamer.update(snap.gameState == MENU ? -1 : snap.currentMap, snap.nextMap);
+        render(snap);
+        Uint64 allocations = heapAllocations.load(std::memory_order_relaxed) - before;
+        if (snap.gameState == PLAYING) playingFrames++;
+        if (steadyFrameAllocated(snap, allocations)) {
+            failedFrames++;
+            worst = std::max(worst, allocations);
+        }
+    }
+    std::cout << "Allocation check: " << frames << " frames, " << playingFrames << " playing, " << failedFrames
+        << " steady frames allocated (max " << worst << " allocations)" << std::endl;
+    return failedFrames == 0;
 }
 
 void clean() {
-    for (auto texture : playerAnim.idle.textures) if (texture) SDL_DestroyTexture(texture);
-    for (auto texture : playerAnim.walk.textures) if (texture) SDL_DestroyTexture(texture);
-    for (auto texture : playerAnim.attack.textures) if (texture) SDL_DestroyTexture(texture);
-    for (auto texture : playerAnim.hurt.textures) if (texture) SDL_DestroyTexture(texture);
-    for (auto texture : playerAnim.dead.textures) if (texture) SDL_DestroyTexture(texture);
-
-    for (auto texture : enemyBasicAnim.walking.textures) if (texture) SDL_DestroyTexture(texture);
-    for (auto texture : enemyBasicAnim.slashing.textures) if (texture) SDL_DestroyTexture(texture);
-    for (auto texture : enemyBasicAnim.dying.textures) if (texture) SDL_DestroyTexture(texture);
-    for (auto texture : enemyFastAnim.walking.textures) if (texture) SDL_DestroyTexture(texture);
-    for (auto texture : enemyFastAnim.slashing.textures) if (texture) SDL_DestroyTexture(texture);
-    for (auto texture : enemyFastAnim.dying.textures) if (texture) SDL_DestroyTexture(texture);
-    for (auto texture : enemyChaserAnim.walking.textures) if (texture) SDL_DestroyTexture(texture);
-    for (auto texture : enemyChaserAnim.slashing.textures) if (texture) SDL_DestroyTexture(texture);
-    for (auto texture : enemyChaserAnim.dying.textures) if (texture) SDL_DestroyTexture(texture);
+#ifndef DODGE_NO_PROFILER
+    profiler.stopCapture();
+#endif
+    telemetry.close();
+    jobs.stop();
+    assets.stop();
+    mapStreamer.stop();
+    if (renderedFrames > 0) {
+        std::cout << "Render queue: " << (double)totalQueueDrawCalls / renderedFrames << " draw calls, "
+                  << (double)totalQueueSprites / renderedFrames << " sprites per frame" << std::endl;
+    }
+    for (auto texture : atlasPages) if (texture) SDL_DestroyTexture(texture);
+    atlasPages.clear();
+    if (textAtlas.texture) SDL_DestroyTexture(textAtlas.texture);
+    if (titleAtlas.texture) SDL_DestroyTexture(titleAtlas.texture);
+    textCache.clear();
+    titleTextCache.clear();
 
     if (projectileTexture) SDL_DestroyTexture(projectileTexture);
     if (menuBackground) SDL_DestroyTexture(menuBackground);
@@ -1174,232 +4828,455 @@ void clean() {
     Mix_FreeChunk(levelUpSound);
     Mix_FreeChunk(upgradeSound);
     Mix_FreeChunk(clickSound);
-    Mix_CloseAudio();
+    if (audioEnabled) Mix_CloseAudio();
 
     SDL_DestroyRenderer(renderer);
-    SDL_DestroyWindow(window);
+    if (window) SDL_DestroyWindow(window);
     TTF_CloseFont(font);
     TTF_CloseFont(titleFont);
+    archive.close();
     TTF_Quit();
     IMG_Quit();
     SDL_Quit();
 }
 
-int main(int argc, char* argv[]) {
-    srand(time(nullptr));
-    if (!init()) return 1;
-
-    Uint32 lastTime = SDL_GetTicks();
-    bool running = true;
+// Xử lý sự kiện bàn phím/chuột của frame; các lệnh ảnh hưởng mô phỏng được đưa vào hàng đợi lệnh.
+void pollEvents(bool& running) {
+    PROFILE_ZONE("pollEvents");
     SDL_Event event;
-
-    if (gameMusic) Mix_PlayMusic(gameMusic, -1);
-
-    while (running) {
-        Uint32 currentTime = SDL_GetTicks();
-        float deltaTime = (currentTime - lastTime) / 1000.0f;
-        lastTime = currentTime;
-
-        while (SDL_PollEvent(&event)) {
-            if (event.type == SDL_QUIT) running = false;
-            if (event.type == SDL_KEYDOWN) {
-                switch (gameState) {
-                case MENU: {
-                    if (event.key.keysym.sym == SDLK_s) {
-                        if (clickSound) Mix_PlayChannel(-1, clickSound, 0);
-                        resetGame();
-                    }
-                    if (event.key.keysym.sym == SDLK_q) {
-                        if (clickSound) Mix_PlayChannel(-1, clickSound, 0);
-                        running = false;
-                    }
-                    break;
+    while (SDL_PollEvent(&event)) {
+        if (event.type == SDL_QUIT) running = false;
+#ifndef DODGE_NO_PROFILER
+        if (event.type == SDL_KEYDOWN && event.key.keysym.sym == SDLK_F3) profiler.toggleOverlay();
+        if (event.type == SDL_KEYDOWN && event.key.keysym.sym == SDLK_F4) profiler.startCapture(tracePath, traceSeconds);
+#endif
+        if (event.type == SDL_KEYDOWN) {
+            switch (gameState) {
+            case MENU: {
+                if (event.key.keysym.sym == SDLK_s) {
+                    playUiSound(clickSound);
+                    queueCommand(CMD_START_GAME);
                 }
-                case SETTINGS: {
-                    if (event.key.keysym.sym == SDLK_ESCAPE) {
-                        if (clickSound) Mix_PlayChannel(-1, clickSound, 0);
-                        gameState = previousState;
-                    }
-                    break;
+                if (event.key.keysym.sym == SDLK_q) {
+                    playUiSound(clickSound);
+                    running = false;
                 }
-                case PLAYING: {
-                    if (event.key.keysym.sym == SDLK_q && qReady && player.playerState != HURT && player.playerState != DEAD) {
-                        player.playerState = ATTACK;
-                        playerAnim.attack.currentFrame = 0;
-                        playerAnim.attack.elapsedTime = 0.0f;
-                        if (currentWeapon == SINGLE) shootProjectile();
-                        else if (currentWeapon == SHOTGUN) shootShotgun();
-                    }
-                    if (event.key.keysym.sym == SDLK_ESCAPE) {
-                        gameState = PAUSED;
-                    }
-                    break;
+                break;
+            }
+            case SETTINGS: {
+                if (event.key.keysym.sym == SDLK_ESCAPE) {
+                    playUiSound(clickSound);
+                    queueCommand(CMD_CLOSE_SETTINGS);
                 }
-                case UPGRADE_MENU: {
-                    if (event.key.keysym.sym == SDLK_1) applyUpgrade(1);
-                    if (event.key.keysym.sym == SDLK_2) applyUpgrade(2);
-                    if (event.key.keysym.sym == SDLK_3) applyUpgrade(3);
-                    if (event.key.keysym.sym == SDLK_4 && !shotgunUnlocked) applyUpgrade(4);
-                    break;
+                break;
+            }
+            case PLAYING: {
+                if (event.key.keysym.sym == SDLK_q) queueCommand(CMD_SHOOT);
+                if (event.key.keysym.sym == SDLK_ESCAPE) {
+                    queueCommand(CMD_PAUSE);
                 }
-                case PAUSED: {
-                    if (event.key.keysym.sym == SDLK_r) {
-                        if (clickSound) Mix_PlayChannel(-1, clickSound, 0);
-                        gameState = PLAYING;
-                    }
-                    if (event.key.keysym.sym == SDLK_q) {
-                        if (clickSound) Mix_PlayChannel(-1, clickSound, 0);
-                        running = false;
-                    }
-                    break;
+                break;
+            }
+            case UPGRADE_MENU: {
+                if (event.key.keysym.sym == SDLK_1) queueCommand(CMD_UPGRADE_1);
+                if (event.key.keysym.sym == SDLK_2) queueCommand(CMD_UPGRADE_2);
+                if (event.key.keysym.sym == SDLK_3) queueCommand(CMD_UPGRADE_3);
+                if (event.key.keysym.sym == SDLK_4 && !shotgunUnlocked) queueCommand(CMD_UPGRADE_4);
+                break;
+            }
+            case PAUSED: {
+                if (event.key.keysym.sym == SDLK_r) {
+                    playUiSound(clickSound);
+                    queueCommand(CMD_RESUME);
                 }
-                case GAME_OVER: {
-                    if (deathTimer <= 0 && event.key.keysym.sym == SDLK_r) {
-                        if (clickSound) Mix_PlayChannel(-1, clickSound, 0);
-                        resetGame();
+                if (event.key.keysym.sym == SDLK_q) {
+                    playUiSound(clickSound);
+                    running = false;
+                }
+                break;
+            }
+            case GAME_OVER: {
+                if (deathTimer <= 0 && event.key.keysym.sym == SDLK_r) {
+                    playUiSound(clickSound);
+                    queueCommand(CMD_START_GAME);
+                }
+                if (deathTimer <= 0 && event.key.keysym.sym == SDLK_q) {
+                    playUiSound(clickSound);
+                    running = false;
+                }
+                break;
+            }
+            }
+        }
+        if (event.type == SDL_MOUSEBUTTONDOWN && event.button.button == SDL_BUTTON_LEFT) {
+            int mouseX = event.button.x;
+            int mouseY = event.button.y;
+            switch (gameState) {
+            case MENU: {
+                if (mouseX >= SCREEN_WIDTH / 2 - 100 && mouseX <= SCREEN_WIDTH / 2 + 100) {
+                    if (mouseY >= SCREEN_HEIGHT / 2 - 60 && mouseY <= SCREEN_HEIGHT / 2 - 20) {
+                        playUiSound(clickSound);
+                        queueCommand(CMD_START_GAME);
+                    }
+                    if (mouseY >= SCREEN_HEIGHT / 2 && mouseY <= SCREEN_HEIGHT / 2 + 40) {
+                        playUiSound(clickSound);
+                        queueCommand(CMD_OPEN_SETTINGS);
                     }
-                    if (deathTimer <= 0 && event.key.keysym.sym == SDLK_q) {
-                        if (clickSound) Mix_PlayChannel(-1, clickSound, 0);
+                    if (mouseY >= SCREEN_HEIGHT / 2 + 60 && mouseY <= SCREEN_HEIGHT / 2 + 100) {
+                        playUiSound(clickSound);
                         running = false;
                     }
-                    break;
                 }
+                break;
+            }
+            case SETTINGS: {
+                int musicKnobX = SCREEN_WIDTH / 2 - 100 + (musicVolume * 200) / 128 - 5;
+                if (mouseX >= musicKnobX && mouseX <= musicKnobX + 10 &&
+                    mouseY >= SCREEN_HEIGHT / 2 - 105 && mouseY <= SCREEN_HEIGHT / 2 - 75) {
+                    draggingMusicSlider = true;
+                }
+                int sfxKnobX = SCREEN_WIDTH / 2 - 100 + (sfxVolume * 200) / 128 - 5;
+                if (mouseX >= sfxKnobX && mouseX <= sfxKnobX + 10 &&
+                    mouseY >= SCREEN_HEIGHT / 2 - 45 && mouseY <= SCREEN_HEIGHT / 2 - 15) {
+                    draggingSFXSlider = true;
+                }
+                if (mouseX >= SCREEN_WIDTH / 2 - 100 && mouseX <= SCREEN_WIDTH / 2 + 100 &&
+                    mouseY >= SCREEN_HEIGHT / 2 + 60 && mouseY <= SCREEN_HEIGHT / 2 + 100) {
+                    playUiSound(clickSound);
+                    queueCommand(CMD_CLOSE_SETTINGS);
                 }
+                break;
             }
-            if (event.type == SDL_MOUSEBUTTONDOWN && event.button.button == SDL_BUTTON_LEFT) {
-                int mouseX = event.button.x;
-                int mouseY = event.button.y;
-                switch (gameState) {
-                case MENU: {
-                    if (mouseX >= SCREEN_WIDTH / 2 - 100 && mouseX <= SCREEN_WIDTH / 2 + 100) {
-                        if (mouseY >= SCREEN_HEIGHT / 2 - 60 && mouseY <= SCREEN_HEIGHT / 2 - 20) {
-                            if (clickSound) Mix_PlayChannel(-1, clickSound, 0);
-                            resetGame();
-                        }
-                        if (mouseY >= SCREEN_HEIGHT / 2 && mouseY <= SCREEN_HEIGHT / 2 + 40) {
-                            if (clickSound) Mix_PlayChannel(-1, clickSound, 0);
-                            previousState = MENU;
-                            gameState = SETTINGS;
-                        }
-                        if (mouseY >= SCREEN_HEIGHT / 2 + 60 && mouseY <= SCREEN_HEIGHT / 2 + 100) {
-                            if (clickSound) Mix_PlayChannel(-1, clickSound, 0);
-                            running = false;
-                        }
+            case UPGRADE_MENU: {
+                if (mouseX >= SCREEN_WIDTH / 2 - 150 && mouseX <= SCREEN_WIDTH / 2 + 150) {
+                    if (mouseY >= SCREEN_HEIGHT / 2 - 120 && mouseY <= SCREEN_HEIGHT / 2 - 80) {
+                        playUiSound(clickSound);
+                        queueCommand(CMD_UPGRADE_1);
                     }
-                    break;
-                }
-                case SETTINGS: {
-                    int musicKnobX = SCREEN_WIDTH / 2 - 100 + (musicVolume * 200) / 128 - 5;
-                    if (mouseX >= musicKnobX && mouseX <= musicKnobX + 10 &&
-                        mouseY >= SCREEN_HEIGHT / 2 - 105 && mouseY <= SCREEN_HEIGHT / 2 - 75) {
-                        draggingMusicSlider = true;
+                    if (mouseY >= SCREEN_HEIGHT / 2 - 60 && mouseY <= SCREEN_HEIGHT / 2 - 20) {
+                        playUiSound(clickSound);
+                        queueCommand(CMD_UPGRADE_2);
                     }
-                    int sfxKnobX = SCREEN_WIDTH / 2 - 100 + (sfxVolume * 200) / 128 - 5;
-                    if (mouseX >= sfxKnobX && mouseX <= sfxKnobX + 10 &&
-                        mouseY >= SCREEN_HEIGHT / 2 - 45 && mouseY <= SCREEN_HEIGHT / 2 - 15) {
-                        draggingSFXSlider = true;
+                    if (mouseY >= SCREEN_HEIGHT / 2 && mouseY <= SCREEN_HEIGHT / 2 + 40) {
+                        playUiSound(clickSound);
+                        queueCommand(CMD_UPGRADE_3);
                     }
-                    if (mouseX >= SCREEN_WIDTH / 2 - 100 && mouseX <= SCREEN_WIDTH / 2 + 100 &&
-                        mouseY >= SCREEN_HEIGHT / 2 + 60 && mouseY <= SCREEN_HEIGHT / 2 + 100) {
-                        if (clickSound) Mix_PlayChannel(-1, clickSound, 0);
-                        gameState = previousState;
+                    if (!shotgunUnlocked && mouseY >= SCREEN_HEIGHT / 2 + 60 && mouseY <= SCREEN_HEIGHT / 2 + 100) {
+                        playUiSound(clickSound);
+                        queueCommand(CMD_UPGRADE_4);
                     }
-                    break;
                 }
-                case UPGRADE_MENU: {
-                    if (mouseX >= SCREEN_WIDTH / 2 - 150 && mouseX <= SCREEN_WIDTH / 2 + 150) {
-                        if (mouseY >= SCREEN_HEIGHT / 2 - 120 && mouseY <= SCREEN_HEIGHT / 2 - 80) {
-                            if (clickSound) Mix_PlayChannel(-1, clickSound, 0);
-                            applyUpgrade(1);
-                        }
-                        if (mouseY >= SCREEN_HEIGHT / 2 - 60 && mouseY <= SCREEN_HEIGHT / 2 - 20) {
-                            if (clickSound) Mix_PlayChannel(-1, clickSound, 0);
-                            applyUpgrade(2);
-                        }
-                        if (mouseY >= SCREEN_HEIGHT / 2 && mouseY <= SCREEN_HEIGHT / 2 + 40) {
-                            if (clickSound) Mix_PlayChannel(-1, clickSound, 0);
-                            applyUpgrade(3);
-                        }
-                        if (!shotgunUnlocked && mouseY >= SCREEN_HEIGHT / 2 + 60 && mouseY <= SCREEN_HEIGHT / 2 + 100) {
-                            if (clickSound) Mix_PlayChannel(-1, clickSound, 0);
-                            applyUpgrade(4);
-                        }
+                break;
+            }
+            case PAUSED: {
+                if (mouseX >= SCREEN_WIDTH / 2 - 100 && mouseX <= SCREEN_WIDTH / 2 + 100) {
+                    if (mouseY >= SCREEN_HEIGHT / 2 - 60 && mouseY <= SCREEN_HEIGHT / 2 - 20) {
+                        playUiSound(clickSound);
+                        queueCommand(CMD_RESUME);
                     }
-                    break;
-                }
-                case PAUSED: {
-                    if (mouseX >= SCREEN_WIDTH / 2 - 100 && mouseX <= SCREEN_WIDTH / 2 + 100) {
-                        if (mouseY >= SCREEN_HEIGHT / 2 - 60 && mouseY <= SCREEN_HEIGHT / 2 - 20) {
-                            if (clickSound) Mix_PlayChannel(-1, clickSound, 0);
-                            gameState = PLAYING;
-                        }
-                        if (mouseY >= SCREEN_HEIGHT / 2 && mouseY <= SCREEN_HEIGHT / 2 + 40) {
-                            if (clickSound) Mix_PlayChannel(-1, clickSound, 0);
-                            previousState = PAUSED;
-                            gameState = SETTINGS;
-                        }
-                        if (mouseY >= SCREEN_HEIGHT / 2 + 60 && mouseY <= SCREEN_HEIGHT / 2 + 100) {
-                            if (clickSound) Mix_PlayChannel(-1, clickSound, 0);
-                            running = false;
-                        }
+                    if (mouseY >= SCREEN_HEIGHT / 2 && mouseY <= SCREEN_HEIGHT / 2 + 40) {
+                        playUiSound(clickSound);
+                        queueCommand(CMD_OPEN_SETTINGS);
                     }
-                    break;
-                }
-                case GAME_OVER: {
-                    if (deathTimer <= 0 && mouseX >= SCREEN_WIDTH / 2 - 150 && mouseX <= SCREEN_WIDTH / 2 + 150) {
-                        if (mouseY >= SCREEN_HEIGHT / 2 - 60 && mouseY <= SCREEN_HEIGHT / 2 - 20) {
-                            if (clickSound) Mix_PlayChannel(-1, clickSound, 0);
-                            resetGame();
-                        }
-                        if (mouseY >= SCREEN_HEIGHT / 2 + 20 && mouseY <= SCREEN_HEIGHT / 2 + 60) {
-                            if (clickSound) Mix_PlayChannel(-1, clickSound, 0);
-                            previousState = GAME_OVER;
-                            gameState = SETTINGS;
-                        }
-                        if (mouseY >= SCREEN_HEIGHT / 2 + 100 && mouseY <= SCREEN_HEIGHT / 2 + 140) {
-                            if (clickSound) Mix_PlayChannel(-1, clickSound, 0);
-                            running = false;
-                        }
+                    if (mouseY >= SCREEN_HEIGHT / 2 + 60 && mouseY <= SCREEN_HEIGHT / 2 + 100) {
+                        playUiSound(clickSound);
+                        running = false;
                     }
-                    break;
                 }
+                break;
+            }
+            case GAME_OVER: {
+                if (deathTimer <= 0 && mouseX >= SCREEN_WIDTH / 2 - 150 && mouseX <= SCREEN_WIDTH / 2 + 150) {
+                    if (mouseY >= SCREEN_HEIGHT / 2 - 60 && mouseY <= SCREEN_HEIGHT / 2 - 20) {
+                        playUiSound(clickSound);
+                        queueCommand(CMD_START_GAME);
+                    }
+                    if (mouseY >= SCREEN_HEIGHT / 2 + 20 && mouseY <= SCREEN_HEIGHT / 2 + 60) {
+                        playUiSound(clickSound);
+                        queueCommand(CMD_OPEN_SETTINGS);
+                    }
+                    if (mouseY >= SCREEN_HEIGHT / 2 + 100 && mouseY <= SCREEN_HEIGHT / 2 + 140) {
+                        playUiSound(clickSound);
+                        running = false;
+                    }
                 }
+                break;
             }
-            if (event.type == SDL_MOUSEBUTTONUP && event.button.button == SDL_BUTTON_LEFT) {
-                draggingMusicSlider = false;
-                draggingSFXSlider = false;
             }
-            if (event.type == SDL_MOUSEMOTION && gameState == SETTINGS) {
-                int mouseX = event.motion.x;
-                if (draggingMusicSlider) {
-                    musicVolume = ((mouseX - (SCREEN_WIDTH / 2 - 100)) * 128) / 200;
-                    if (musicVolume < 0) musicVolume = 0;
-                    if (musicVolume > 128) musicVolume = 128;
-                    Mix_VolumeMusic(musicVolume);
-                }
-                if (draggingSFXSlider) {
-                    sfxVolume = ((mouseX - (SCREEN_WIDTH / 2 - 100)) * 128) / 200;
-                    if (sfxVolume < 0) sfxVolume = 0;
-                    if (sfxVolume > 128) sfxVolume = 128;
-                    Mix_VolumeChunk(shootSound, sfxVolume);
-                    Mix_VolumeChunk(hurtSound, sfxVolume);
-                    Mix_VolumeChunk(deathSound, sfxVolume);
-                    Mix_VolumeChunk(enemyAttackSound, sfxVolume);
-                    Mix_VolumeChunk(enemyDeathSound, sfxVolume);
-                    Mix_VolumeChunk(spawnSound, sfxVolume);
-                    Mix_VolumeChunk(levelUpSound, sfxVolume);
-                    Mix_VolumeChunk(upgradeSound, sfxVolume);
-                    Mix_VolumeChunk(clickSound, sfxVolume);
-                }
+        }
+        if (event.type == SDL_MOUSEBUTTONUP && event.button.button == SDL_BUTTON_LEFT) {
+            draggingMusicSlider = false;
+            draggingSFXSlider = false;
+        }
+        if (event.type == SDL_MOUSEMOTION && gameState == SETTINGS) {
+            int mouseX = event.motion.x;
+            if (draggingMusicSlider) {
+                musicVolume = ((mouseX - (SCREEN_WIDTH / 2 - 100)) * 128) / 200;
+                if (musicVolume < 0) musicVolume = 0;
+                if (musicVolume > 128) musicVolume = 128;
+                Mix_VolumeMusic(musicVolume);
             }
+            if (draggingSFXSlider) {
+                sfxVolume = ((mouseX - (SCREEN_WIDTH / 2 - 100)) * 128) / 200;
+                if (sfxVolume < 0) sfxVolume = 0;
+                if (sfxVolume > 128) sfxVolume = 128;
+                Mix_VolumeChunk(shootSound, sfxVolume);
+                Mix_VolumeChunk(hurtSound, sfxVolume);
+                Mix_VolumeChunk(deathSound, sfxVolume);
+                Mix_VolumeChunk(enemyAttackSound, sfxVolume);
+                Mix_VolumeChunk(enemyDeathSound, sfxVolume);
+                Mix_VolumeChunk(spawnSound, sfxVolume);
+                Mix_VolumeChunk(levelUpSound, sfxVolume);
+                Mix_VolumeChunk(upgradeSound, sfxVolume);
+                Mix_VolumeChunk(clickSound, sfxVolume);
+            }
+        }
+    }
+}
+
+int main(int argc, char* argv[]) {
+    installAllocationHooks();
+    bool headless = false;
+    Uint64 headlessTicks = DEFAULT_HEADLESS_TICKS;
+    Uint64 seed = static_cast<Uint64>(time(nullptr));
+    std::string recordPath;
+    std::string replayPath;
+    size_t steeringBenchCount = 0;
+    bool bench = false;
+    bool renderBench = false;
+    std::string benchPath;
+    int benchSamples = DEFAULT_BENCH_SAMPLES;
+    int renderBenchFrames = DEFAULT_RENDER_BENCH_FRAMES;
+    std::string renderBenchDump;
+    bool allocCheck = false;
+    int allocCheckFrames = DEFAULT_ALLOC_CHECK_FRAMES;
+    int threadCount = SDL_GetCPUCount();
+    bool pipelined = true;
+    bool useArchive = true;
+    bool telemetryEnabled = true;
+#ifndef DODGE_NO_PROFILER
+    bool traceAtStart = false;
+#endif
+    steeringKernel = bestSteeringKernel();
+    for (int i = 1; i < argc; i++) {
+        if (std::strcmp(argv[i], "--tick-rate") == 0 && i + 1 < argc) {
+            int rate = std::atoi(argv[++i]);
+            if (supportedTickRate(rate)) tickRate = rate;
+            else std::cout << "WARNING: Unsupported tick rate " << rate << ", using " << tickRate << std::endl;
+        }
+        else if (std::strcmp(argv[i], "--texture-quality") == 0 && i + 1 < argc) {
+            const char* quality = argv[++i];
+            if (!parseTextureQuality(quality, textureQuality)) std::cout << "WARNING: Unknown texture quality " << quality << std::endl;
+        }
+        else if (std::strcmp(argv[i], "--headless") == 0) {
+            headless = true;
+        }
+        else if (std::strcmp(argv[i], "--ticks") == 0 && i + 1 < argc) {
+            headlessTicks = std::strtoull(argv[++i], nullptr, 10);
+        }
+        else if (std::strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            seed = std::strtoull(argv[++i], nullptr, 10);
+        }
+        else if (std::strcmp(argv[i], "--steering") == 0 && i + 1 < argc) {
+            const char* name = argv[++i];
+            int kernel = STEER_SCALAR;
+            while (kernel <= STEER_AVX2 && std::strcmp(name, STEERING_KERNEL_NAMES[kernel]) != 0) kernel++;
+            if (kernel <= STEER_AVX2 && steeringKernelSupported(static_cast<SteeringKernelType>(kernel))) {
+                steeringKernel = static_cast<SteeringKernelType>(kernel);
+            }
+            else std::cout << "WARNING: Steering kernel " << name << " unavailable, using " << STEERING_KERNEL_NAMES[steeringKernel] << std::endl;
+        }
+        else if (std::strcmp(argv[i], "--steering-bench") == 0 && i + 1 < argc) {
+            steeringBenchCount = std::strtoull(argv[++i], nullptr, 10);
+        }
+        else if (std::strcmp(argv[i], "--bench") == 0) {
+            bench = true;
+        }
+        else if (std::strcmp(argv[i], "--bench-out") == 0 && i + 1 < argc) {
+            benchPath = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--bench-samples") == 0 && i + 1 < argc) {
+            benchSamples = std::atoi(argv[++i]);
         }
+        else if (std::strcmp(argv[i], "--render-bench") == 0) {
+            renderBench = true;
+        }
+        else if (std::strcmp(argv[i], "--render-bench-frames") == 0 && i + 1 < argc) {
+            renderBenchFrames = std::atoi(argv[++i]);
+        }
+        else if (std::strcmp(argv[i], "--render-bench-dump") == 0 && i + 1 < argc) {
+            renderBenchDump = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--alloc-check") == 0) {
+            allocCheck = true;
+        }
+        else if (std::strcmp(argv[i], "--alloc-check-frames") == 0 && i + 1 < argc) {
+            allocCheckFrames = std::atoi(argv[++i]);
+        }
+        else if (std::strcmp(argv[i], "--no-pipeline") == 0) {
+            pipelined = false;
+        }
+        else if (std::strcmp(argv[i], "--no-archive") == 0) {
+            useArchive = false;
+        }
+        else if (std::strcmp(argv[i], "--no-telemetry") == 0) {
+            telemetryEnabled = false;
+        }
+        else if (std::strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            threadCount = std::atoi(argv[++i]);
+        }
+        else if (std::strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+            recordPath = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+            replayPath = argv[++i];
+        }
+#ifndef DODGE_NO_PROFILER
+        else if (std::strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+            tracePath = argv[++i];
+            traceAtStart = true;
+        }
+        else if (std::strcmp(argv[i], "--trace-seconds") == 0 && i + 1 < argc) {
+            traceSeconds = std::atof(argv[++i]);
+        }
+#endif
+    }
+
+    if (!replayPath.empty() && !openReplay(replayPath, seed)) return 1;
+    if (!recordPath.empty() && replayPath.empty() && !openRecording(recordPath, seed)) return 1;
+    seedRandomStreams(seed);
+    jobs.start(threadCount);
+    if (steeringBenchCount > 0) {
+        bool ok = runSteeringBench(steeringBenchCount);
+        jobs.stop();
+        return ok ? 0 : 1;
+    }
+    if (bench) {
+        bool ok = runBenchmarks(benchPath.empty() ? DEFAULT_BENCH_PATH : benchPath, benchSamples);
+        jobs.stop();
+        return ok ? 0 : 1;
+    }
+    if (renderBench) {
+        SDL_Surface* target = SDL_CreateRGBSurfaceWithFormat(0, SCREEN_WIDTH, SCREEN_HEIGHT, 32, SDL_PIXELFORMAT_ARGB8888);
+        bool ok = target && init(useArchive, target) &&
+            runRenderBench(target, benchPath.empty() ? DEFAULT_RENDER_BENCH_PATH : benchPath, renderBenchFrames, renderBenchDump);
+        clean();
+        if (target) SDL_FreeSurface(target);
+        return ok ? 0 : 1;
+    }
+    if (allocCheck) {
+        SDL_Surface* target = SDL_CreateRGBSurfaceWithFormat(0, SCREEN_WIDTH, SCREEN_HEIGHT, 32, SDL_PIXELFORMAT_ARGB8888);
+        bool ok = target && init(useArchive, target) && runAllocationCheck(allocCheckFrames);
+        clean();
+        if (target) SDL_FreeSurface(target);
+        return ok ? 0 : 1;
+    }
+    if (headless) {
+        HeadlessResult result = runHeadless(headlessTicks);
+        std::cout << "Headless: " << result.ticks << " ticks (" << result.simSeconds << " s simulated) in "
+            << result.wallSeconds << " s, " << result.runs << " runs, best score " << result.bestScore
+            << ", best level " << result.bestLevel << ", seed " << seed << ", " << jobs.participants << " threads" << std::endl;
+        jobs.stop();
+        return 0;
+    }
+
+#ifndef DODGE_NO_PROFILER
+    PROFILE_THREAD("Main");
+    if (traceAtStart) profiler.startCapture(tracePath, traceSeconds);
+#endif
+    if (!init(useArchive)) {
+#ifndef DODGE_NO_PROFILER
+        // Capture bắt đầu trước init() để đo cả lúc nạp tài nguyên: đóng file trace cho hợp lệ.
+        profiler.stopCapture();
+#endif
+        jobs.stop();
+        return 1;
+    }
+
+    const double fixedStep = 1.0 / tickRate;
+    const Uint64 counterFrequency = SDL_GetPerformanceFrequency();
+    Uint64 lastCounter = SDL_GetPerformanceCounter();
+    double accumulator = 0.0;
+    bool running = true;
 
-        if (gameState == PLAYING && rand() % static_cast<int>(spawnRate) == 0) spawnEnemyMarker();
+    if (gameMusic) Mix_PlayMusic(gameMusic, -1);
+    if (telemetryEnabled) {
+        std::string dir = executableDir();
+        telemetry.open(dir + TELEMETRY_RING_FILE, dir + TELEMETRY_SUMMARY_FILE);
+    }
 
-        update(deltaTime);
-        render();
+    reserveFrameBuffers();
+    captureSnapshot(snapshots[1], 0.0f);
+    frontSnapshot = 0;
+    simulation.start(pipelined);
+    Uint64 lastAllocations = heapAllocations.load(std::memory_order_relaxed);
+    bool allocationWarned = false;
+
+    while (running) {
+        Uint64 currentCounter = SDL_GetPerformanceCounter();
+        double frameTime = static_cast<double>(currentCounter - lastCounter) / counterFrequency;
+        lastCounter = currentCounter;
+#ifndef DODGE_NO_PROFILER
+        profiler.endFrame(frameTime);
+#endif
+        // Giới hạn để một frame bị treo không kéo theo hàng loạt tick bù (spiral of death).
+        if (frameTime > MAX_FRAME_TIME) frameTime = MAX_FRAME_TIME;
+        accumulator += frameTime;
+
+        // Frame trước đã mô phỏng xong: snapshot của nó thành front, trạng thái game lại an toàn để đọc/ghi.
+        {
+            PROFILE_ZONE("waitSimulation");
+            simulation.wait();
+        }
+        frontSnapshot = 1 - frontSnapshot;
+        const RenderSnapshot& front = snapshots[frontSnapshot];
+        if (front.finished) running = false;
+        // Cấp phát kể từ lần đọc trước: vẽ frame trước cùng mô phỏng frame này.
+        Uint64 allocationCount = heapAllocations.load(std::memory_order_relaxed);
+        frameAllocations = allocationCount - lastAllocations;
+        lastAllocations = allocationCount;
+        if (steadyFrameAllocated(front, frameAllocations) && !allocationWarned) {
+            std::cout << "WARNING: " << frameAllocations << " heap allocations in a steady PLAYING frame" << std::endl;
+            allocationWarned = true;
+            SDL_assert(frameAllocations == 0);
+        }
+#ifndef DODGE_NO_PROFILER
+        if (profiler.capturing) {
+            size_t particleCount = 0;
+            for (int e = 0; e < NUM_PARTICLE_EMITTERS; e++) particleCount += front.particles[e].size();
+            profiler.counter("enemies", static_cast<double>(front.enemies.size()));
+            profiler.counter("particles", static_cast<double>(particleCount));
+            profiler.counter("score", front.score);
+            profiler.counter("combo", front.combo);
+            profiler.counter("allocations", static_cast<double>(frameAllocations));
+        }
+#endif
+        assets.pump(ASSET_UPLOAD_BUDGET);
+        // Ở menu chưa có map đang chơi, chỉ cần map của ván sắp bắt đầu.
+        mapStreamer.update(front.gameState == MENU ? -1 : front.currentMap, front.nextMap);
+
+        pollEvents(running);
+
+        if (!replayFile.is_open()) readKeyboardInput();
+        int ticks = 0;
+        while (accumulator >= fixedStep && ticks < MAX_TICKS_PER_FRAME) {
+            accumulator -= fixedStep;
+            ticks++;
+        }
+        if (ticks == MAX_TICKS_PER_FRAME && accumulator > fixedStep) accumulator = fixedStep;
+
+        if (running) simulation.submit(ticks, static_cast<float>(fixedStep), static_cast<float>(accumulator / fixedStep), snapshots[1 - frontSnapshot]);
+        playAudioEvents(front.audio);
+        Uint64 renderStart = SDL_GetPerformanceCounter();
+        render(front);
+        Uint64 frameEnd = SDL_GetPerformanceCounter();
+        double renderMs = static_cast<double>(frameEnd - renderStart) * 1000.0 / counterFrequency;
+        double frameMs = static_cast<double>(frameEnd - currentCounter) * 1000.0 / counterFrequency;
+        telemetry.record(front, frameMs, renderMs - presentMs, presentMs);
     }
 
+    simulation.wait();
+    simulation.stop();
     clean();
     return 0;
 }
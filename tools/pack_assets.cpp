@@ -0,0 +1,243 @@
+// Đóng gói mọi tài nguyên trong ASSET_MANIFEST vào một file archive cho game map vào bộ nhớ.
+// Chạy từ thư mục chứa assets/:
+//   pack_assets [-o assets.pak] [--texture-quality low|medium|high] [--allow-missing]
+// Ảnh được giải mã, chuyển ARGB8888 và thu nhỏ sẵn theo quality; WAV được chuyển về định dạng
+// thiết bị âm thanh của game; font và nhạc giữ nguyên. Thiếu file nào thì báo lỗi và không ghi archive,
+// trừ khi có --allow-missing (file thiếu bị bỏ qua, game nạp file rời như khi không có archive).
+#include <SDL.h>
+#include <SDL_image.h>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "../AssetArchive.h"
+
+struct PackedAsset {
+    ArchiveEntry entry;
+    std::vector<Uint8> data;
+};
+
+bool fileExists(const std::string& path) {
+    std::ifstream file(path, std::ios::binary);
+    return file.good();
+}
+
+SDL_Surface* loadArgb(const std::string& path) {
+    SDL_Surface* loaded = IMG_Load(path.c_str());
+    if (!loaded) {
+        std::cout << "ERROR: Failed to load image: " << path << " - " << IMG_GetError() << std::endl;
+        return nullptr;
+    }
+    SDL_Surface* converted = SDL_ConvertSurfaceFormat(loaded, SDL_PIXELFORMAT_ARGB8888, 0);
+    SDL_FreeSurface(loaded);
+    if (!converted) std::cout << "ERROR: Failed to convert image: " << path << " - " << SDL_GetError() << std::endl;
+    return converted;
+}
+
+// Ghi pixel của surface (pitch = w * 4) vào asset.
+void storePixels(PackedAsset& asset, SDL_Surface* surface) {
+    asset.entry.type = ARCHIVE_PIXELS;
+    asset.entry.width = surface->w;
+    asset.entry.height = surface->h;
+    asset.entry.pitch = surface->w * 4;
+    asset.data.resize(static_cast<size_t>(asset.entry.pitch) * surface->h);
+    for (int y = 0; y < surface->h; y++) {
+        std::memcpy(&asset.data[static_cast<size_t>(y) * asset.entry.pitch], static_cast<Uint8*>(surface->pixels) + y * surface->pitch, asset.entry.pitch);
+    }
+}
+
+// Thu nhỏ cả ảnh (ảnh đơn, frame rời) về kích thước game sẽ dùng ở quality này.
+bool packImage(PackedAsset& asset, const std::string& path, int displayW, int displayH, TextureQuality quality) {
+    SDL_Surface* surface = loadArgb(path);
+    if (!surface) return false;
+    int w = scaledSize(surface->w, displayW, quality);
+    int h = scaledSize(surface->h, displayH, quality);
+    if (w != surface->w || h != surface->h) {
+        SDL_Surface* scaled = resampleSurface(surface, { 0, 0, surface->w, surface->h }, w, h);
+        SDL_FreeSurface(surface);
+        if (!scaled) return false;
+        surface = scaled;
+    }
+    storePixels(asset, surface);
+    SDL_FreeSurface(surface);
+    return true;
+}
+
+// Sheet được thu nhỏ từng frame riêng để box filter không trộn pixel giữa hai frame kề nhau.
+bool packSheet(PackedAsset& asset, const std::string& path, int frameCount, int displayW, int displayH, TextureQuality quality) {
+    SDL_Surface* sheet = loadArgb(path);
+    if (!sheet) return false;
+    int sourceWidth = sheet->w / frameCount;
+    int frameWidth = scaledSize(sourceWidth, displayW, quality);
+    int frameHeight = scaledSize(sheet->h, displayH, quality);
+    SDL_Surface* packed = SDL_CreateRGBSurfaceWithFormat(0, frameWidth * frameCount, frameHeight, 32, SDL_PIXELFORMAT_ARGB8888);
+    bool ok = packed != nullptr;
+    for (int i = 0; ok && i < frameCount; i++) {
+        SDL_Surface* frame = resampleSurface(sheet, { i * sourceWidth, 0, sourceWidth, sheet->h }, frameWidth, frameHeight);
+        if (!frame) {
+            ok = false;
+            break;
+        }
+        SDL_Rect dst = { i * frameWidth, 0, frameWidth, frameHeight };
+        SDL_SetSurfaceBlendMode(frame, SDL_BLENDMODE_NONE);
+        SDL_BlitSurface(frame, nullptr, packed, &dst);
+        SDL_FreeSurface(frame);
+    }
+    if (ok) storePixels(asset, packed);
+    if (packed) SDL_FreeSurface(packed);
+    SDL_FreeSurface(sheet);
+    return ok;
+}
+
+bool packSound(PackedAsset& asset, const std::string& path) {
+    SDL_AudioSpec spec;
+    Uint8* buffer = nullptr;
+    Uint32 length = 0;
+    if (!SDL_LoadWAV(path.c_str(), &spec, &buffer, &length)) {
+        std::cout << "ERROR: Failed to load sound: " << path << " - " << SDL_GetError() << std::endl;
+        return false;
+    }
+    SDL_AudioCVT cvt;
+    int needed = SDL_BuildAudioCVT(&cvt, spec.format, spec.channels, spec.freq, AUDIO_SAMPLE_FORMAT, AUDIO_CHANNELS, AUDIO_FREQUENCY);
+    if (needed < 0) {
+        std::cout << "ERROR: Unsupported sound format: " << path << " - " << SDL_GetError() << std::endl;
+        SDL_FreeWAV(buffer);
+        return false;
+    }
+    std::vector<Uint8> pcm(static_cast<size_t>(length) * std::max(cvt.len_mult, 1));
+    std::memcpy(pcm.data(), buffer, length);
+    SDL_FreeWAV(buffer);
+    Uint32 outLength = length;
+    if (needed > 0) {
+        cvt.buf = pcm.data();
+        cvt.len = static_cast<int>(length);
+        if (SDL_ConvertAudio(&cvt) < 0) {
+            std::cout << "ERROR: Failed to convert sound: " << path << " - " << SDL_GetError() << std::endl;
+            return false;
+        }
+        outLength = static_cast<Uint32>(cvt.len_cvt);
+    }
+    pcm.resize(outLength);
+    asset.entry.type = ARCHIVE_PCM;
+    asset.entry.audioFrequency = AUDIO_FREQUENCY;
+    asset.entry.audioFormat = AUDIO_SAMPLE_FORMAT;
+    asset.entry.audioChannels = AUDIO_CHANNELS;
+    asset.data.swap(pcm);
+    return true;
+}
+
+bool packRaw(PackedAsset& asset, const std::string& path) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        std::cout << "ERROR: Failed to open: " << path << std::endl;
+        return false;
+    }
+    asset.entry.type = ARCHIVE_RAW;
+    asset.data.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    return true;
+}
+
+bool writeArchive(const std::string& outPath, const std::vector<PackedAsset>& packed, TextureQuality quality) {
+    std::ofstream out(outPath, std::ios::binary);
+    if (!out) {
+        std::cout << "ERROR: Failed to create archive: " << outPath << std::endl;
+        return false;
+    }
+    ArchiveHeader header = { ARCHIVE_MAGIC, ARCHIVE_VERSION, static_cast<Uint32>(packed.size()), static_cast<Uint32>(quality) };
+    std::vector<ArchiveEntry> table;
+    Uint64 offset = sizeof(header) + packed.size() * sizeof(ArchiveEntry);
+    for (const PackedAsset& asset : packed) {
+        offset = (offset + ARCHIVE_ALIGNMENT - 1) / ARCHIVE_ALIGNMENT * ARCHIVE_ALIGNMENT;
+        ArchiveEntry entry = asset.entry;
+        entry.offset = offset;
+        entry.size = asset.data.size();
+        table.push_back(entry);
+        offset += entry.size;
+    }
+
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char*>(table.data()), table.size() * sizeof(ArchiveEntry));
+    Uint64 position = sizeof(header) + table.size() * sizeof(ArchiveEntry);
+    const char padding[ARCHIVE_ALIGNMENT] = {};
+    for (size_t i = 0; i < packed.size(); i++) {
+        out.write(padding, static_cast<std::streamsize>(table[i].offset - position));
+        out.write(reinterpret_cast<const char*>(packed[i].data.data()), static_cast<std::streamsize>(packed[i].data.size()));
+        position = table[i].offset + table[i].size;
+    }
+    if (!out) {
+        std::cout << "ERROR: Failed to write archive: " << outPath << std::endl;
+        return false;
+    }
+    std::cout << "Packed " << packed.size() << " assets into " << outPath << " (" << position / (1024.0 * 1024.0) << " MB)" << std::endl;
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    std::string outPath = "assets.pak";
+    TextureQuality quality = QUALITY_MEDIUM;
+    bool allowMissing = false;
+    for (int i = 1; i < argc; i++) {
+        if (std::strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            outPath = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--texture-quality") == 0 && i + 1 < argc) {
+            const char* name = argv[++i];
+            if (!parseTextureQuality(name, quality)) std::cout << "WARNING: Unknown texture quality " << name << std::endl;
+        }
+        else if (std::strcmp(argv[i], "--allow-missing") == 0) {
+            allowMissing = true;
+        }
+    }
+
+    // Kiểm tra trước để báo đủ mọi file thiếu trong một lần chạy.
+    std::vector<std::string> missing;
+    for (const ManifestEntry& entry : ASSET_MANIFEST) {
+        int files = (entry.kind == ASSET_FRAME) ? entry.frameCount : 1;
+        for (int i = 0; i < files; i++) {
+            std::string path = manifestFilePath(entry, i);
+            if (!fileExists(path)) missing.push_back(path);
+        }
+    }
+    for (const std::string& path : missing) std::cout << (allowMissing ? "WARNING" : "ERROR") << ": Missing asset: " << path << std::endl;
+    if (!missing.empty() && !allowMissing) return 1;
+
+    if (SDL_Init(0) < 0) return 1;
+    if ((IMG_Init(IMG_INIT_PNG) & IMG_INIT_PNG) == 0) return 1;
+
+    std::vector<PackedAsset> packed;
+    bool ok = true;
+    for (const ManifestEntry& entry : ASSET_MANIFEST) {
+        int files = (entry.kind == ASSET_FRAME) ? entry.frameCount : 1;
+        for (int i = 0; i < files; i++) {
+            std::string path = manifestFilePath(entry, i);
+            if (!fileExists(path)) continue;
+            std::string key = normalizeAssetPath(path);
+            if (key.size() >= static_cast<size_t>(ARCHIVE_PATH_SIZE)) {
+                std::cout << "ERROR: Asset path too long: " << path << std::endl;
+                ok = false;
+                continue;
+            }
+            PackedAsset asset;
+            std::memset(&asset.entry, 0, sizeof(asset.entry));
+            std::memcpy(asset.entry.path, key.c_str(), key.size());
+            bool packedOk = false;
+            switch (entry.kind) {
+            case ASSET_SHEET: packedOk = packSheet(asset, path, entry.frameCount, entry.displayW, entry.displayH, quality); break;
+            case ASSET_FRAME:
+            case ASSET_TEXTURE: packedOk = packImage(asset, path, entry.displayW, entry.displayH, quality); break;
+            case ASSET_SOUND: packedOk = packSound(asset, path); break;
+            case ASSET_MUSIC:
+            case ASSET_FONT: packedOk = packRaw(asset, path); break;
+            }
+            if (packedOk) packed.push_back(std::move(asset));
+            else ok = false;
+        }
+    }
+
+    ok = ok && writeArchive(outPath, packed, quality);
+    IMG_Quit();
+    SDL_Quit();
+    return ok ? 0 : 1;
+}